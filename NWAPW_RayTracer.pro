@@ -34,23 +34,38 @@ HEADERS += src/MainWindow.hpp \
            src/Viewport.hpp \
            src/CameraController.hpp \
            src/rendering/ModelLoader.hpp \
+           src/rendering/AsyncModelLoader.hpp \
+           src/rendering/ObjLoader.hpp \
            src/rendering/ModelLoaderData.hpp \
            src/rendering/OpenGLWidget.hpp \
            src/rendering/Shader.hpp \
            src/rendering/Texture.hpp \
            src/rendering/Renderer3D.hpp \
            src/rendering/Renderer3DOptions.hpp \
+           src/rendering/BVH.hpp \
+           src/rendering/BVH4D.hpp \
+           src/rendering/GPUBVHBuilder.hpp \
+           src/rendering/GPUDimensionDropper.hpp \
+           src/rendering/StreamingBuffer.hpp \
+           src/rendering/WorkerPool.hpp \
+           src/rendering/GPUHeap.hpp \
            src/rendering/Camera3D.hpp \
            src/rendering/objects/Vertex.hpp \
            src/rendering/objects/AbstractMesh.hpp \
            src/rendering/objects/StaticMesh.hpp \
            src/rendering/objects/StaticMesh.tpp \
+           src/rendering/objects/StaticVectorMesh.hpp \
            src/rendering/objects/DynamicMesh.hpp \
+           src/rendering/objects/SlicedMesh.hpp \
            src/rendering/objects/Node.hpp \
            src/rendering/objects/Scene.hpp \
            src/rendering/objects/Material.hpp \
            src/rendering/objects/MaterialManager.hpp \
            src/rendering/DimensionDropper.hpp \
+           src/rendering/Hyperplane4D.hpp \
+           src/rendering/SliceCache.hpp \
+           src/rendering/TetrahedralMeshOptimizer.hpp \
+           src/rendering/DimensionDropperBenchmark.hpp \
            src/Settings3D.hpp
 
 SOURCES += src/main.cpp \
@@ -58,20 +73,35 @@ SOURCES += src/main.cpp \
            src/Viewport.cpp \
            src/CameraController.cpp \
            src/rendering/ModelLoader.cpp \
+           src/rendering/AsyncModelLoader.cpp \
+           src/rendering/ObjLoader.cpp \
            src/rendering/OpenGLWidget.cpp \
            src/rendering/Shader.cpp \
            src/rendering/Texture.cpp \
            src/rendering/Renderer3D.cpp \
            src/rendering/Renderer3DOptions.cpp \
+           src/rendering/BVH.cpp \
+           src/rendering/BVH4D.cpp \
+           src/rendering/GPUBVHBuilder.cpp \
+           src/rendering/GPUDimensionDropper.cpp \
+           src/rendering/StreamingBuffer.cpp \
+           src/rendering/WorkerPool.cpp \
+           src/rendering/GPUHeap.cpp \
            src/rendering/Camera3D.cpp \
            src/rendering/objects/Vertex.cpp \
            src/rendering/objects/AbstractMesh.cpp \
            src/rendering/objects/DynamicMesh.cpp \
+           src/rendering/objects/StaticVectorMesh.cpp \
+           src/rendering/objects/SlicedMesh.cpp \
            src/rendering/objects/Node.cpp \
            src/rendering/objects/Scene.cpp \
            src/rendering/objects/Material.cpp \
            src/rendering/objects/MaterialManager.cpp \
            src/rendering/DimensionDropper.cpp \
+           src/rendering/Hyperplane4D.cpp \
+           src/rendering/SliceCache.cpp \
+           src/rendering/TetrahedralMeshOptimizer.cpp \
+           src/rendering/DimensionDropperBenchmark.cpp \
            src/Settings3D.cpp
 
 FORMS +=   src/MainWindow.ui
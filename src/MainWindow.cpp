@@ -26,7 +26,11 @@ static void print_matrix(const glm::mat4& matrix) {
         qDebug() << matrix[i][0] << matrix[i][1] << matrix[i][2] << matrix[i][3];
 }
 
-MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent), model_rotation(1.0f) {
+MainWindow::MainWindow(const QString& environment_path, QWidget* parent) :
+    QMainWindow(parent),
+    environment_path(environment_path),
+    model_rotation(1.0f)
+{
     ui.setupUi(this);
     setWindowTitle("Ray Tracer");
 
@@ -34,7 +38,19 @@ MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent), model_rotation(1.
     model_path = dir.absoluteFilePath("resources/models/4D/Platonic Solids/pentachoron.ob4");
 
     loader = new ModelLoader(this);
+    obj_loader = new ObjLoader(this);
+    optimizer = new TetrahedralMeshOptimizer(this);
     dropper = new DimensionDropper(this);
+    slice_cache = new SliceCache(dropper, this);
+
+    async_loader = new AsyncModelLoader(this);
+    connect(async_loader, &AsyncModelLoader::progress, this, &MainWindow::show_load_progress);
+    connect(async_loader, &AsyncModelLoader::finished, this, &MainWindow::swap_in_loaded_model);
+    connect(async_loader, &AsyncModelLoader::failed, this, &MainWindow::show_load_failed);
+    connect(async_loader, &AsyncModelLoader::cancelled, this, &MainWindow::show_load_cancelled);
+    // Escape cancels loading a model
+    QShortcut* cancel_load_shortcut = new QShortcut(QKeySequence(Qt::Key_Escape), this);
+    connect(cancel_load_shortcut, &QShortcut::activated, async_loader, &AsyncModelLoader::cancel);
 
     viewport = new Viewport(this);
     connect(viewport, &Viewport::opengl_initialized, this, &MainWindow::resource_initialization);
@@ -64,10 +80,8 @@ void MainWindow::resource_initialization() {
 
     // Must convert file paths from QStrings to char*
     QByteArray char_model_path = model_path.toLocal8Bit();
-    loaded_model = loader->load_model(char_model_path);
-    sliced_node = dropper->drop(loaded_model, position_w);
-    update_rotation();
-    scene.add_root_node(sliced_node);
+    set_loaded_model(loader->load_model(char_model_path));
+    replace_sliced_node();
 
     // Load mats into material manager object
     MaterialManager& material_manager = scene.get_material_manager();
@@ -84,10 +98,16 @@ void MainWindow::resource_initialization() {
     mat.metalness_ti = material_manager.add_texture(metalness_texture);
     int metal_material = material_manager.add_material(mat);
 
-//     Node* monkey = loader->load_model("resources/models/3D/monkey.obj");
-//     for (auto m : monkey->meshes)
-//         m->material_index = metal_material;
-//     scene.add_root_node(monkey);
+    // The environment keeps the materials from its material libraries
+    if (!environment_path.isEmpty()) {
+        QElapsedTimer environment_timer;
+        environment_timer.start();
+        Node* environment = obj_loader->load_model(environment_path.toLocal8Bit(), material_manager);
+        if (environment) {
+            qDebug() << "Loaded" << environment_path << "in" << environment_timer.elapsed() << "ms";
+            scene.add_root_node(environment);
+        }
+    }
 
     Vertex verts[4] = {
         // Floor
@@ -162,7 +182,20 @@ void MainWindow::main_loop() {
     viewport->main_loop(dt);
 
     update_rotation();
-    update_model_rotation();
+
+    Renderer3DOptions* options3D = viewport->get_renderer_3D_options();
+    const SliceCache::Statistics& slice_cache_statistics = slice_cache->get_statistics();
+    QString status = QString("Ray trace: %1 ms | BVH build: %2 ms | BVH refits: %3 | BVH rebuilds: %4 | Slice cache: %5 hits, %6 misses, %7 MB")
+        .arg(options3D->get_render_time(), 0, 'f', 2)
+        .arg(options3D->get_bvh_build_time(), 0, 'f', 2)
+        .arg(options3D->get_bvh_refit_count())
+        .arg(options3D->get_bvh_rebuild_count())
+        .arg(slice_cache_statistics.hits)
+        .arg(slice_cache_statistics.misses)
+        .arg(slice_cache_statistics.bytes / 1e6, 0, 'f', 1);
+    if (!load_status.isEmpty())
+        status += " | " + load_status;
+    statusBar()->showMessage(status);
 
     if (viewport->is_mouse_pressed()) {
         // Reset input for next update
@@ -184,41 +217,103 @@ void MainWindow::on_iterativeRenderCheckBox_toggled(bool checked) {
     settings3D->toggle_iterative_rendering(checked, viewport->get_renderer_3D_options());
 }
 
+void MainWindow::on_bvhCheckBox_toggled(bool checked) {
+    settings3D->toggle_bvh(checked, viewport->get_renderer_3D_options());
+}
+
+void MainWindow::on_gpuBvhCheckBox_toggled(bool checked) {
+    settings3D->toggle_gpu_bvh(checked, viewport->get_renderer_3D_options());
+}
+
+void MainWindow::on_gpuSliceCheckBox_toggled(bool checked) {
+    gpu_slicing = checked;
+    if (loaded_model)
+        replace_sliced_node();
+}
+
 void MainWindow::on_fileButton_clicked() {
     // Only 4D models are allowed to be loaded
     QString new_model_path = QFileDialog::getOpenFileName(this, "Load a model", "./resources/models/4D/", ("Model Files (*.ob4)"));
     // If a file was selected
     if (new_model_path.length()) {
-        modelLabel->setText(truncate_path(new_model_path));
-        model_path = new_model_path;
+        // The new model is loaded, prepared and sliced on another thread while the
+        // old one keeps being rendered, and swapped in by swap_in_loaded_model once it's ready
+        update_model_rotation();
+        load_key = slice_cache->make_key(nullptr, rotation_xw, rotation_yw, rotation_zw, position_w);
+        async_loader->load(new_model_path, dropper, Hyperplane4D::from_rotation(model_rotation, position_w));
+    }
+}
+
+void MainWindow::show_load_progress(const QString& file_path, float fraction) {
+    load_status = QString("Loading %1: %2%").arg(truncate_path(file_path)).arg((int)(fraction * 100.0f));
+}
+
+void MainWindow::swap_in_loaded_model(const QString& file_path, Node* model4d, Node* slice) {
+    load_status.clear();
+    modelLabel->setText(truncate_path(file_path));
+    model_path = file_path;
 
-        // Load the new model
-        Node* new_model = loader->load_model(model_path.toLocal8Bit());
+    // Parented like the ones loaded and sliced on this thread
+    model4d->setParent(loader);
+    slice->setParent(dropper);
 
-        // If the model was successfully loaded
-        if (new_model) {
-            // Remove the sliced node from the scene and delete it and its meshes
+    if (gpu_slicing) {
+        // The renderer slices the model itself
+        for (auto mesh : slice->meshes)
+            delete mesh;
+        delete slice;
+
+        // The old sliced meshes can't outlive the loaded model they slice
+        if (sliced_node) {
             scene.remove_root_node(sliced_node);
             for (auto mesh : sliced_node->meshes)
                 delete mesh;
             delete sliced_node;
-
-            // Delete the loaded model and load the new model
-            delete loaded_model;
-            loaded_model = new_model;
-
-            // Slice the new model and add it to the scene
-            sliced_node = dropper->drop(loaded_model, position_w);
-            update_rotation();
-            scene.add_root_node(sliced_node);
-            selected_node = sliced_node;
+            sliced_node = nullptr;
         }
+        set_loaded_model(model4d, true);
+        replace_sliced_node();
+        selected_node = sliced_node;
+        return;
+    }
+
+    // The new slice takes the old one's place in a single step, so no frame is ever rendered without either
+    if (sliced_node) {
+        // Keep the node where it was
+        slice->transformation = sliced_node->transformation;
+        scene.replace_root_node(sliced_node, slice);
+        for (auto mesh : sliced_node->meshes)
+            delete mesh;
+        delete sliced_node;
+    } else {
+        scene.add_root_node(slice);
     }
+    sliced_node = slice;
+    selected_node = sliced_node;
+
+    // The old sliced meshes had to go first since they can't outlive the loaded model they slice
+    set_loaded_model(model4d, true);
+
+    // The slice is only made again if the rotation or w changed while the model was loading
+    load_key.model = loaded_model;
+    slice_cache->insert(load_key, sliced_node);
+    sliced_key = load_key;
+    sliced_key_valid = true;
+    update_rotation();
+}
+
+void MainWindow::show_load_failed(const QString& file_path) {
+    load_status = QString("Failed to load %1").arg(truncate_path(file_path));
+}
+
+void MainWindow::show_load_cancelled(const QString& file_path) {
+    load_status.clear();
+    qDebug() << "Cancelled loading" << file_path;
 }
 
 void MainWindow::update_transformation() {
     if (selected_node) {
-        // This translation should happen before the 4D rotation in update_rotation (where note 1 is) but only for 4D nodes
+        // This translation should happen before the 4D rotation in update_rotation but only for 4D nodes
         selected_node->transformation = glm::translate(glm::mat4(1.0f), glm::vec3(position_x, position_y, position_z));
         selected_node->transformation = glm::rotate(selected_node->transformation, glm::radians(rotation_x), glm::vec3(0.0f, 0.0f, 1.0f));
         selected_node->transformation = glm::rotate(selected_node->transformation, glm::radians(rotation_y), glm::vec3(1.0f, 0.0f, 0.0f));
@@ -234,64 +329,70 @@ void MainWindow::update_model_rotation() {
 
 void MainWindow::update_rotation() {
     // 4D rotations must be applied before the model is sliced
-    // Since the loaded model should remain untouched, this means
-    // there must be an itermediate step in which the rotation
-    // is applied, then the result of that step is sliced
-
-    // For every mesh in the model
-    for (size_t i = 0; i < loaded_model->meshes.size(); i++) {
-        // Get current loaded mesh
-        // Loaded models always consist of only dynamic meshes, this is fine
-        DynamicMesh* loaded_mesh = dynamic_cast<DynamicMesh*>(loaded_model->meshes[i]);
-
-        // Get vertices and indices
-        std::vector<Vertex>& loaded_mesh_vertices = loaded_mesh->modify_vertices();
-        std::vector<Index>& loaded_mesh_indices = loaded_mesh->modify_indices();
-
-        // Copy and rotate vertices
-        std::vector<Vertex> rotated_mesh_vertices;
-        rotated_mesh_vertices.reserve(loaded_mesh_vertices.size());
-        for (const auto& vertex : loaded_mesh_vertices)
-            rotated_mesh_vertices.push_back(model_rotation * /* note 1 */ vertex.position);
-
-        // Copy indices
-        std::vector<Index> rotated_mesh_indices;
-        rotated_mesh_indices.reserve(loaded_mesh_indices.size());
-        for (const auto& index : loaded_mesh_indices)
-            rotated_mesh_indices.push_back(index);
-
-        // Create a temporary mesh and node
-        DynamicMesh* rotated_mesh = new DynamicMesh(rotated_mesh_vertices, rotated_mesh_indices);
-        Node* rotated_model = new Node(std::vector<AbstractMesh*>{rotated_mesh});
-
-        // Slice the newly created mesh
-        Node* new_sliced_node = dropper->drop(rotated_model, position_w);
-
-        // Get the old mesh's vertices and indices
-        DynamicMesh* old_sliced_mesh = dynamic_cast<DynamicMesh*>(sliced_node->meshes[i]);
-        std::vector<Vertex>& vertices = old_sliced_mesh->modify_vertices();
-        std::vector<Index>& indices = old_sliced_mesh->modify_indices();
-
-        // Clear the old mesh's vertices and indices
-        vertices.clear();
-        indices.clear();
-
-        // DimensionDropper always returns a node of dynamic meshs, so this is safe
-        // In this case, only one mesh went in, so only one mesh comes out
-        // Even if the 3D slice did not overlap with the shape, an empty mesh
-        // is added to the returned node
-        DynamicMesh* new_sliced_mesh = dynamic_cast<DynamicMesh*>(new_sliced_node->meshes[0]);
-
-        // Get the new vertices and indices
-        std::vector<Vertex>& new_sliced_mesh_vertices = new_sliced_mesh->modify_vertices();
-        std::vector<Index>& new_sliced_mesh_indices = new_sliced_mesh->modify_indices();
-
-        // Fill the old mesh's vertices and indices with the new ones
-        vertices.insert(vertices.begin(), new_sliced_mesh_vertices.begin(), new_sliced_mesh_vertices.end());
-        indices.insert(indices.begin(), new_sliced_mesh_indices.begin(), new_sliced_mesh_indices.end());
-
-        // Delete the temporary model and mesh to prevent memory leaks
-        delete rotated_model;
-        delete rotated_mesh;
+    // Rather than rotating the loaded model, it's sliced with the hyperplane
+    // the rotated model would be sliced with, so it's never copied
+    // The rotation is updated first so the slice (and the key it's cached with) always
+    // matches the current angles
+    update_model_rotation();
+    Hyperplane4D hyperplane = Hyperplane4D::from_rotation(model_rotation, position_w);
+
+    if (gpu_slicing) {
+        // The renderer slices the loaded model itself
+        for (auto mesh : sliced_node->meshes)
+            static_cast<SlicedMesh*>(mesh)->set_hyperplane(hyperplane);
+        return;
+    }
+
+    // The slice replaces the vertices and indices of the sliced node's meshes
+    SliceCache::Key key = slice_cache->make_key(loaded_model, rotation_xw, rotation_yw, rotation_zw, position_w);
+    if (sliced_key_valid && key == sliced_key)
+        return;
+    slice_cache->drop(loaded_model, key, hyperplane, sliced_node);
+    sliced_key = key;
+    sliced_key_valid = true;
+}
+
+void MainWindow::set_loaded_model(Node* model, bool prepared) {
+    // The meshes have no parent, and the dropper only lets go of what it built for them once they're destroyed
+    if (loaded_model) {
+        for (auto mesh : loaded_model->meshes)
+            delete mesh;
+    }
+    delete loaded_model;
+    loaded_model = model;
+
+    // Building the model's edges once here means slicing never has to
+    // Models that were prepared already were optimized by the AsyncModelLoader too
+    if (!prepared) {
+        qDebug().noquote() << "Optimized model:" << optimizer->optimize(loaded_model).to_string();
+        dropper->prepare(loaded_model);
+    }
+}
+
+void MainWindow::replace_sliced_node() {
+    Node* new_sliced_node;
+    if (gpu_slicing) {
+        std::vector<AbstractMesh*> sliced_meshes;
+        for (const auto mesh : loaded_model->meshes)
+            sliced_meshes.push_back(new SlicedMesh(mesh, this));
+        new_sliced_node = new Node(sliced_meshes, this);
+    } else {
+        new_sliced_node = dropper->drop(loaded_model, Hyperplane4D::from_rotation(model_rotation, position_w));
     }
+
+    if (sliced_node) {
+        // Keep the node where it was
+        new_sliced_node->transformation = sliced_node->transformation;
+        if (selected_node == sliced_node)
+            selected_node = new_sliced_node;
+
+        scene.remove_root_node(sliced_node);
+        for (auto mesh : sliced_node->meshes)
+            delete mesh;
+        delete sliced_node;
+    }
+    sliced_node = new_sliced_node;
+    sliced_key_valid = false;
+    update_rotation();
+    scene.add_root_node(sliced_node);
 }
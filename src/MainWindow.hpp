@@ -4,6 +4,7 @@
 #include <QMainWindow>
 #include <QElapsedTimer>
 #include <QTimer>
+#include <QShortcut>
 #include <QtUiTools>
 #include <QApplication>
 #include <QTextStream>
@@ -13,8 +14,13 @@
 #include "rendering/objects/Scene.hpp"
 #include "rendering/objects/StaticMesh.hpp"
 #include "rendering/objects/DynamicMesh.hpp"
+#include "rendering/objects/SlicedMesh.hpp"
 #include "rendering/ModelLoader.hpp"
+#include "rendering/AsyncModelLoader.hpp"
+#include "rendering/ObjLoader.hpp"
+#include "rendering/TetrahedralMeshOptimizer.hpp"
 #include "rendering/DimensionDropper.hpp"
+#include "rendering/SliceCache.hpp"
 
 #include "Settings3D.hpp"
 #include "ui_MainWindow.h"
@@ -22,12 +28,22 @@
 class MainWindow : public QMainWindow {
     Q_OBJECT;
 public:
-    MainWindow(QWidget* parent=nullptr);
+    // environment_path is a Wavefront OBJ that's added to the scene as static meshes, if it isn't empty
+    MainWindow(const QString& environment_path=QString(), QWidget* parent=nullptr);
     virtual ~MainWindow() {}
 private slots:
     void on_iterativeRenderCheckBox_toggled(bool checked);
+    void on_bvhCheckBox_toggled(bool checked);
+    void on_gpuBvhCheckBox_toggled(bool checked);
+    void on_gpuSliceCheckBox_toggled(bool checked);
     void on_fileButton_clicked();
 
+    // Connected to async_loader
+    void show_load_progress(const QString& file_path, float fraction);
+    void swap_in_loaded_model(const QString& file_path, Node* model4d, Node* slice);
+    void show_load_failed(const QString& file_path);
+    void show_load_cancelled(const QString& file_path);
+
     inline void on_rotateXSlider_sliderMoved(int position)  { rotation_x  = position / 10.0f; update_transformation(); }
     inline void on_rotateYSlider_sliderMoved(int position)  { rotation_y  = position / 10.0f; update_transformation(); }
     inline void on_rotateZSlider_sliderMoved(int position)  { rotation_z  = position / 10.0f; update_transformation(); }
@@ -57,14 +73,33 @@ private:
     Scene scene; // if viewport, loader, and dropper are all pointers, should this?
     Viewport* viewport;
     ModelLoader* loader;
+    ObjLoader* obj_loader;
+    // Removes the duplicate and degenerate tetrahedra of every model before it's prepared
+    TetrahedralMeshOptimizer* optimizer;
+    // Loads the models picked with the file button, the one loaded before keeps being rendered meanwhile
+    AsyncModelLoader* async_loader;
+    // Shown in the status bar while a model is loading
+    QString load_status;
+    // The rotation and w the model that's loading is sliced with
+    SliceCache::Key load_key;
     DimensionDropper* dropper;
+    // Reuses the dropper's slices of rotations and w's the loaded model was recently sliced with
+    SliceCache* slice_cache;
     QString model_path;
+    QString environment_path;
 
     // TODO: move this to somewhere more suitable
     Node* loaded_model = nullptr;
+    // The 4D rotation of loaded_model, which is folded into the hyperplane it's sliced with
     glm::mat4 model_rotation;
     bool fourD = false;
     Node* sliced_node = nullptr;
+    // The key of the slice sliced_node has, so it's only sliced again when the rotation or w changed
+    SliceCache::Key sliced_key;
+    bool sliced_key_valid = false;
+    // When true, sliced_node is made of SlicedMeshes the renderer slices on the GPU
+    // instead of the meshes the dropper returns
+    bool gpu_slicing = false;
 
     float rotation_x = 0.0f;
     float rotation_y = 0.0f;
@@ -81,6 +116,10 @@ private:
     void update_transformation();
     void update_model_rotation();
     void update_rotation();
+    // Replaces the loaded model (deleting the old one) and prepares it to be sliced unless it already is
+    void set_loaded_model(Node* model, bool prepared=false);
+    // Replaces sliced_node (deleting the old one and its meshes) with a new slice of the loaded model
+    void replace_sliced_node();
 
     Node* selected_node = nullptr;
 
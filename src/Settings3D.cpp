@@ -13,3 +13,11 @@ void Settings3D::toggle_iterative_rendering(bool toggle, Renderer3DOptions* opti
         options3D->begin_iterative_rendering();
     else options3D->end_iterative_rendering();
 }
+
+void Settings3D::toggle_bvh(bool toggle, Renderer3DOptions* options3D) {
+    options3D->set_bvh_enabled(toggle);
+}
+
+void Settings3D::toggle_gpu_bvh(bool toggle, Renderer3DOptions* options3D) {
+    options3D->set_gpu_bvh_enabled(toggle);
+}
@@ -20,6 +20,8 @@ public:
 
 
     void toggle_iterative_rendering(bool toggle, Renderer3DOptions* options3D);
+    void toggle_bvh(bool toggle, Renderer3DOptions* options3D);
+    void toggle_gpu_bvh(bool toggle, Renderer3DOptions* options3D);
 
 private:
 };
@@ -1,10 +1,27 @@
 #include <QApplication>
 #include "MainWindow.hpp"
+#include "rendering/DimensionDropperBenchmark.hpp"
 
 int main(int argc, char* argv[]) {
   QApplication app(argc, argv);
 
-  MainWindow window;
+  // --benchmark-dropper [directory] [slices]
+  QStringList arguments = app.arguments();
+  int benchmark_index = arguments.indexOf("--benchmark-dropper");
+  if (benchmark_index != -1) {
+    QString directory = arguments.value(benchmark_index + 1, "resources/models/4D/");
+    int nr_slices = arguments.value(benchmark_index + 2, "16").toInt();
+    DimensionDropperBenchmark benchmark;
+    return benchmark.run(directory, nr_slices);
+  }
+
+  // --environment file.obj
+  int environment_index = arguments.indexOf("--environment");
+  QString environment_path;
+  if (environment_index != -1)
+    environment_path = arguments.value(environment_index + 1);
+
+  MainWindow window(environment_path);
 
   return app.exec();
 }
@@ -0,0 +1,164 @@
+#include "AsyncModelLoader.hpp"
+#include <QDebug>
+#include <QMetaObject>
+
+AsyncModelLoader::AsyncModelLoader(QObject* parent) :
+    QObject(parent),
+    latest_load_id(0),
+    loading(false)
+{
+    worker = new QObject;
+    loader = new ModelLoader(worker);
+    optimizer = new TetrahedralMeshOptimizer(worker);
+    worker->moveToThread(&loading_thread);
+    loading_thread.start();
+}
+
+AsyncModelLoader::~AsyncModelLoader() {
+    // Nothing is emitted since whatever's connected could be being destroyed too
+    latest_load_id++;
+    loader->cancel();
+    loading_thread.quit();
+    loading_thread.wait();
+    // Deletes the loader with it
+    delete worker;
+}
+
+void AsyncModelLoader::load(const QString& file_path, DimensionDropper* dropper, const Hyperplane4D& hyperplane) {
+    cancel();
+    unsigned int load_id = ++latest_load_id;
+    loading = true;
+    loading_file_path = file_path;
+
+    DropperSettings settings;
+    settings.slice_mode = dropper->get_slice_mode();
+    settings.weld_mode = dropper->get_weld_mode();
+    settings.normal_mode = dropper->get_normal_mode();
+    settings.nr_threads = dropper->get_nr_threads_used();
+    settings.culling = dropper->get_culling();
+    settings.kinetic = dropper->get_kinetic();
+
+    QPointer<DimensionDropper> target_dropper(dropper);
+    QMetaObject::invokeMethod(worker, [=]() {
+        run(load_id, file_path, settings, target_dropper, hyperplane);
+    }, Qt::QueuedConnection);
+}
+
+void AsyncModelLoader::cancel() {
+    if (!loading)
+        return;
+    latest_load_id++;
+    loader->cancel();
+    loading = false;
+    emit cancelled(loading_file_path);
+}
+
+bool AsyncModelLoader::is_loading() const {
+    return loading;
+}
+
+void AsyncModelLoader::run(unsigned int load_id, const QString& file_path, const DropperSettings& settings, QPointer<DimensionDropper> dropper, const Hyperplane4D& hyperplane) {
+    // Loads that were cancelled before they started are skipped
+    if (is_cancelled(load_id))
+        return;
+
+    report_progress(load_id, file_path, 0.0f);
+    QMetaObject::Connection progress_connection = connect(loader, &ModelLoader::load_progress, [&](float fraction) {
+        report_progress(load_id, file_path, fraction * loading_fraction);
+    });
+    Node* model4d = loader->load_model(file_path.toLocal8Bit());
+    disconnect(progress_connection);
+
+    if (!model4d) {
+        QMetaObject::invokeMethod(this, [=]() {
+            if (is_cancelled(load_id))
+                return;
+            loading = false;
+            emit failed(file_path);
+        }, Qt::QueuedConnection);
+        return;
+    }
+    // Its parent is the loader, which lives on this thread
+    model4d->setParent(nullptr);
+    if (is_cancelled(load_id)) {
+        delete_node(model4d);
+        return;
+    }
+    report_progress(load_id, file_path, loading_fraction);
+
+    qDebug().noquote() << "Optimized" << file_path << optimizer->optimize(model4d).to_string();
+
+    DimensionDropper* load_dropper = new DimensionDropper;
+    load_dropper->set_slice_mode(settings.slice_mode);
+    load_dropper->set_weld_mode(settings.weld_mode);
+    load_dropper->set_normal_mode(settings.normal_mode);
+    load_dropper->set_nr_threads(settings.nr_threads);
+    load_dropper->set_culling(settings.culling);
+    load_dropper->set_kinetic(settings.kinetic);
+    load_dropper->prepare(model4d);
+    if (is_cancelled(load_id)) {
+        delete_node(model4d);
+        delete load_dropper;
+        return;
+    }
+    report_progress(load_id, file_path, loading_fraction + preparing_fraction);
+
+    Node* slice = load_dropper->drop(model4d, hyperplane);
+    // The slice and its meshes are children of load_dropper, which is deleted once it's handed over,
+    // and objects with a parent can't be moved to another thread on their own
+    slice->setParent(nullptr);
+    for (auto mesh : slice->meshes) {
+        mesh->setParent(nullptr);
+        mesh->update_bvh();
+    }
+    if (is_cancelled(load_id)) {
+        delete_node(model4d);
+        delete_node(slice);
+        delete load_dropper;
+        return;
+    }
+
+    // Hand everything over to the thread this lives on, objects can only be moved from the thread they live on
+    QThread* target_thread = this->thread();
+    for (Node* node : { model4d, slice }) {
+        node->moveToThread(target_thread);
+        for (auto mesh : node->meshes)
+            mesh->moveToThread(target_thread);
+    }
+    load_dropper->moveToThread(target_thread);
+    std::vector<QPointer<AbstractMesh>> slice_meshes(slice->meshes.begin(), slice->meshes.end());
+
+    QMetaObject::invokeMethod(this, [=]() {
+        if (is_cancelled(load_id)) {
+            delete_node(model4d);
+            delete_node(slice);
+            delete load_dropper;
+            return;
+        }
+        if (dropper)
+            dropper->take_prepared(load_dropper, model4d);
+        delete load_dropper;
+        for (const auto& mesh : slice_meshes)
+            Q_ASSERT_X(mesh && mesh->thread() == thread(), "AsyncModelLoader::run", "The slice's meshes must outlive the dropper that made them");
+        loading = false;
+        emit progress(file_path, 1.0f);
+        emit finished(file_path, model4d, slice);
+    }, Qt::QueuedConnection);
+}
+
+bool AsyncModelLoader::is_cancelled(unsigned int load_id) const {
+    return load_id != latest_load_id;
+}
+
+void AsyncModelLoader::report_progress(unsigned int load_id, const QString& file_path, float fraction) {
+    QMetaObject::invokeMethod(this, [=]() {
+        if (!is_cancelled(load_id))
+            emit progress(file_path, fraction);
+    }, Qt::QueuedConnection);
+}
+
+void AsyncModelLoader::delete_node(Node* node) {
+    for (auto mesh : node->meshes)
+        delete mesh;
+    delete node;
+}
@@ -0,0 +1,84 @@
+#ifndef ASYNC_MODEL_LOADER_HPP
+#define ASYNC_MODEL_LOADER_HPP
+
+#include <QObject>
+#include <QPointer>
+#include <QString>
+#include <QThread>
+#include <atomic>
+#include "ModelLoader.hpp"
+#include "TetrahedralMeshOptimizer.hpp"
+#include "DimensionDropper.hpp"
+
+/*
+Loads models on a thread of its own so the window keeps rendering the old model at full frame rate
+while a new one loads
+
+A load parses the model (or maps its binary cache), optimizes its meshes, builds their topology and BVH with a
+DimensionDropper of its own, slices it once and builds the BVHs of the slice's meshes, all on the loading thread
+Once it's done everything is handed back to the thread the AsyncModelLoader lives on, where the prepared
+topologies are moved into the dropper the load was started with and finished is emitted
+
+Every signal is emitted on the thread the AsyncModelLoader lives on, and every load ends with
+exactly one of finished, failed or cancelled
+*/
+class AsyncModelLoader : public QObject {
+    Q_OBJECT;
+public:
+    AsyncModelLoader(QObject* parent=nullptr);
+    // Cancels the load that's running (if any) without emitting cancelled and waits for the thread to stop
+    virtual ~AsyncModelLoader();
+
+    // Starts loading a model, cancelling the load that's running (if any)
+    // The model is prepared and sliced with the settings dropper has now, the slice with hyperplane
+    void load(const QString& file_path, DimensionDropper* dropper, const Hyperplane4D& hyperplane);
+    // Emits cancelled for the load that's running (if any) right away, the loading thread stops
+    // working on it as soon as it can and deletes everything it made
+    void cancel();
+    bool is_loading() const;
+
+signals:
+    // How much of the load is done, loading the model is most of it
+    void progress(const QString& file_path, float fraction);
+    // The model and its slice have no parents, the caller owns them and their meshes
+    void finished(const QString& file_path, Node* model4d, Node* slice);
+    void failed(const QString& file_path);
+    void cancelled(const QString& file_path);
+
+private:
+    // How much of a load's progress loading the model and then preparing it are
+    static constexpr float loading_fraction = 0.8f;
+    static constexpr float preparing_fraction = 0.15f;
+
+    // The settings of the dropper a load was started with, which its own dropper is given
+    struct DropperSettings {
+        DimensionDropper::SliceMode slice_mode;
+        DimensionDropper::WeldMode weld_mode;
+        DimensionDropper::NormalMode normal_mode;
+        int nr_threads;
+        bool culling;
+        bool kinetic;
+    };
+
+    // Runs on the loading thread
+    void run(unsigned int load_id, const QString& file_path, const DropperSettings& settings, QPointer<DimensionDropper> dropper, const Hyperplane4D& hyperplane);
+    // Both can be called from any thread
+    bool is_cancelled(unsigned int load_id) const;
+    void report_progress(unsigned int load_id, const QString& file_path, float fraction);
+    // Deletes a node and its meshes
+    static void delete_node(Node* node);
+
+    QThread loading_thread;
+    // Lives on the loading thread, every load is run as one of its events
+    QObject* worker;
+    ModelLoader* loader;
+    TetrahedralMeshOptimizer* optimizer;
+
+    // Incremented by every load and cancel, a load stops once it isn't the latest
+    std::atomic<unsigned int> latest_load_id;
+    // The load that's running or waiting to (if any)
+    bool loading;
+    QString loading_file_path;
+};
+
+#endif
@@ -0,0 +1,284 @@
+#include "BVH.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <QtGlobal>
+
+AABB::AABB() :
+    min(std::numeric_limits<float>::max()),
+    max(-std::numeric_limits<float>::max())
+{}
+
+AABB::AABB(const glm::vec3& min, const glm::vec3& max) : min(min), max(max) {}
+
+void AABB::grow(const glm::vec3& point) {
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+}
+
+void AABB::grow(const AABB& other) {
+    min = glm::min(min, other.min);
+    max = glm::max(max, other.max);
+}
+
+glm::vec3 AABB::centroid() const {
+    return (min + max) * 0.5f;
+}
+
+float AABB::surface_area() const {
+    if (empty())
+        return 0.0f;
+    glm::vec3 extent = max - min;
+    return 2.0f * (extent.x*extent.y + extent.y*extent.z + extent.z*extent.x);
+}
+
+bool AABB::empty() const {
+    return min.x > max.x || min.y > max.y || min.z > max.z;
+}
+
+AABB BVH::triangle_bounds(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2) {
+    AABB bounds;
+    bounds.grow(v0);
+    bounds.grow(v1);
+    bounds.grow(v2);
+    return bounds;
+}
+
+void BVH::build(const std::vector<AABB>& primitive_bounds, int max_depth) {
+    unsigned int nr_primitives = (unsigned int)primitive_bounds.size();
+
+    nodes.clear();
+    nodes.reserve(std::max(2*nr_primitives, 1u));
+    primitive_indices.resize(nr_primitives);
+    std::iota(primitive_indices.begin(), primitive_indices.end(), 0u);
+
+    centroids.resize(nr_primitives);
+    for (unsigned int i=0; i<nr_primitives; i++) {
+        centroids[i] = primitive_bounds[i].centroid();
+    }
+
+    // The root starts out as a leaf containing every primitive
+    // An empty hierarchy still gets a root (with empty bounds) so the shader never has to special case it
+    BVHNode root;
+    root.left_first = 0;
+    root.nr_primitives = (int)nr_primitives;
+    nodes.push_back(root);
+    update_node_bounds(0, primitive_bounds);
+
+    // Subdividing with an explicit stack because degenerate inputs can get very deep
+    // The depth of each node is kept alongside it, max_depth keeps the shader's traversal stack from overflowing
+    depth = 0;
+    std::vector<std::pair<int, int>> to_subdivide{{0, 0}};
+    while (!to_subdivide.empty()) {
+        int node_index = to_subdivide.back().first;
+        int node_depth = to_subdivide.back().second;
+        to_subdivide.pop_back();
+        if (subdivide(node_index, primitive_bounds, max_depth - node_depth)) {
+            to_subdivide.emplace_back(nodes[node_index].left_first, node_depth+1);
+            to_subdivide.emplace_back(nodes[node_index].left_first+1, node_depth+1);
+        } else {
+            depth = std::max(depth, node_depth);
+        }
+    }
+}
+
+void BVH::refit(const std::vector<AABB>& primitive_bounds) {
+    Q_ASSERT_X(primitive_bounds.size() == primitive_indices.size(), "BVH::refit", "Refitting requires the same primitives as the last build");
+    // Children are always after their parents so going backwards visits
+    // both children before their parent
+    for (int i=(int)nodes.size()-1; i>=0; i--) {
+        BVHNode& node = nodes[i];
+        // A lone root is always a leaf, even when it has no primitives
+        if (node.nr_primitives > 0 || nodes.size() == 1) {
+            update_node_bounds(i, primitive_bounds);
+        } else {
+            AABB bounds(nodes[node.left_first].aabb_min, nodes[node.left_first].aabb_max);
+            bounds.grow(AABB(nodes[node.left_first+1].aabb_min, nodes[node.left_first+1].aabb_max));
+            node.aabb_min = bounds.min;
+            node.aabb_max = bounds.max;
+        }
+    }
+}
+
+float BVH::sah_cost() const {
+    float root_area = AABB(nodes[0].aabb_min, nodes[0].aabb_max).surface_area();
+    if (root_area <= 0.0f)
+        return 0.0f;
+
+    float cost = 0.0f;
+    for (const auto& node : nodes) {
+        float area = AABB(node.aabb_min, node.aabb_max).surface_area();
+        if (node.nr_primitives > 0)
+            cost += node.nr_primitives * area;
+        else
+            cost += traversal_cost * area;
+    }
+    return cost / root_area;
+}
+
+size_t BVH::size_primitives() const {
+    return primitive_indices.size();
+}
+
+int BVH::get_depth() const {
+    return depth;
+}
+
+const std::vector<BVHNode>& BVH::get_nodes() const {
+    return nodes;
+}
+
+const std::vector<unsigned int>& BVH::get_primitive_indices() const {
+    return primitive_indices;
+}
+
+void BVH::update_node_bounds(int node_index, const std::vector<AABB>& primitive_bounds) {
+    BVHNode& node = nodes[node_index];
+    AABB bounds;
+    for (int i=0; i<node.nr_primitives; i++) {
+        bounds.grow(primitive_bounds[primitive_indices[node.left_first+i]]);
+    }
+    node.aabb_min = bounds.min;
+    node.aabb_max = bounds.max;
+}
+
+bool BVH::subdivide(int node_index, const std::vector<AABB>& primitive_bounds, int levels_left) {
+    int first = nodes[node_index].left_first;
+    int count = nodes[node_index].nr_primitives;
+    if (count <= 1 || levels_left <= 0)
+        return false;
+    // A subtree with this many levels left can still split down to single primitives if neither child
+    // gets more than this many, which a median split always keeps to if the node itself fit
+    long long max_child_count = levels_left <= 32 ? 1ll << (levels_left-1) : std::numeric_limits<long long>::max();
+
+    // Bin by centroid rather than by primitive bounds so large primitives don't
+    // stretch the bins out
+    AABB centroid_bounds;
+    for (int i=0; i<count; i++) {
+        centroid_bounds.grow(centroids[primitive_indices[first+i]]);
+    }
+
+    int best_axis = -1;
+    int best_split = 0;
+    int best_left_count = 0;
+    float best_cost = std::numeric_limits<float>::max();
+
+    for (int axis=0; axis<3; axis++) {
+        float axis_min = centroid_bounds.min[axis];
+        float axis_max = centroid_bounds.max[axis];
+        float scale = nr_bins / (axis_max - axis_min);
+        // Centroids too close together (denormal extents) would make the scale infinite and the bins NaN
+        if (axis_max <= axis_min || std::isinf(scale))
+            continue;
+
+        AABB bin_bounds[nr_bins];
+        int bin_counts[nr_bins] = {0};
+        for (int i=0; i<count; i++) {
+            unsigned int primitive = primitive_indices[first+i];
+            int bin = std::min(nr_bins-1, (int)((centroids[primitive][axis] - axis_min) * scale));
+            bin_counts[bin]++;
+            bin_bounds[bin].grow(primitive_bounds[primitive]);
+        }
+
+        // Sweep from both sides to get the cost of splitting after each bin
+        float left_areas[nr_bins-1];
+        int left_counts[nr_bins-1];
+        AABB left_bounds;
+        int left_count = 0;
+        for (int i=0; i<nr_bins-1; i++) {
+            left_count += bin_counts[i];
+            left_bounds.grow(bin_bounds[i]);
+            left_counts[i] = left_count;
+            left_areas[i] = left_bounds.surface_area();
+        }
+        AABB right_bounds;
+        int right_count = 0;
+        for (int i=nr_bins-1; i>0; i--) {
+            right_count += bin_counts[i];
+            right_bounds.grow(bin_bounds[i]);
+            if (left_counts[i-1] == 0 || right_count == 0)
+                continue;
+            float cost = left_counts[i-1]*left_areas[i-1] + right_count*right_bounds.surface_area();
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = i;
+                best_left_count = left_counts[i-1];
+            }
+        }
+    }
+
+    if (best_axis == -1)
+        // Every centroid is in the same place so there is nothing to split on
+        return false;
+
+    // Costs are relative to the cost of a single triangle intersection
+    AABB node_bounds(nodes[node_index].aabb_min, nodes[node_index].aabb_max);
+    float node_area = node_bounds.surface_area();
+    float leaf_cost = count * node_area;
+    float split_cost = traversal_cost * node_area + best_cost;
+    if (split_cost >= leaf_cost && count <= max_leaf_size)
+        return false;
+    if (std::max(best_left_count, count-best_left_count) > max_child_count) {
+        subdivide_median(node_index, primitive_bounds, centroid_bounds);
+        return true;
+    }
+
+    // Partition the primitives using the exact same binning as above so both sides are non-empty
+    float axis_min = centroid_bounds.min[best_axis];
+    float scale = nr_bins / (centroid_bounds.max[best_axis] - axis_min);
+    auto middle = std::partition(
+        primitive_indices.begin()+first,
+        primitive_indices.begin()+first+count,
+        [&](unsigned int primitive) {
+            int bin = std::min(nr_bins-1, (int)((centroids[primitive][best_axis] - axis_min) * scale));
+            return bin < best_split;
+        }
+    );
+    int left_count = (int)(middle - (primitive_indices.begin()+first));
+    if (left_count == 0 || left_count == count)
+        return false;
+
+    add_children(node_index, left_count, primitive_bounds);
+    return true;
+}
+
+void BVH::subdivide_median(int node_index, const std::vector<AABB>& primitive_bounds, const AABB& centroid_bounds) {
+    int first = nodes[node_index].left_first;
+    int count = nodes[node_index].nr_primitives;
+    glm::vec3 extent = centroid_bounds.max - centroid_bounds.min;
+    int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+
+    // Splitting by position rather than by bins always halves the primitives, even ones with the same centroid
+    int left_count = count/2;
+    std::nth_element(
+        primitive_indices.begin()+first,
+        primitive_indices.begin()+first+left_count,
+        primitive_indices.begin()+first+count,
+        [&](unsigned int a, unsigned int b) {
+            return centroids[a][axis] < centroids[b][axis];
+        }
+    );
+    add_children(node_index, left_count, primitive_bounds);
+}
+
+void BVH::add_children(int node_index, int left_count, const std::vector<AABB>& primitive_bounds) {
+    int first = nodes[node_index].left_first;
+    int count = nodes[node_index].nr_primitives;
+    int left_index = (int)nodes.size();
+    BVHNode left;
+    left.left_first = first;
+    left.nr_primitives = left_count;
+    BVHNode right;
+    right.left_first = first + left_count;
+    right.nr_primitives = count - left_count;
+    nodes.push_back(left);
+    nodes.push_back(right);
+
+    nodes[node_index].left_first = left_index;
+    nodes[node_index].nr_primitives = 0;
+
+    update_node_bounds(left_index, primitive_bounds);
+    update_node_bounds(left_index+1, primitive_bounds);
+}
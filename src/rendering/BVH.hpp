@@ -0,0 +1,106 @@
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <type_traits>
+
+#include "objects/Vertex.hpp"
+
+struct AABB {
+    glm::vec3 min;
+    glm::vec3 max;
+
+    // An empty AABB (min > max) so growing it by anything results in that thing's bounds
+    AABB();
+    AABB(const glm::vec3& min, const glm::vec3& max);
+
+    void grow(const glm::vec3& point);
+    void grow(const AABB& other);
+
+    glm::vec3 centroid() const;
+    float surface_area() const;
+    bool empty() const;
+};
+
+constexpr int bvh_node_size_in_opengl = 32;
+
+struct BVHNode {
+                            // Base Alignment  // Aligned Offset
+    glm::vec3 aabb_min;     // 4               // 0
+                            // 4               // 4
+                            // 4               // 8
+    int left_first;         // 4               // 12
+
+    glm::vec3 aabb_max;     // 4               // 16
+                            // 4               // 20
+                            // 4               // 24
+    int nr_primitives;      // 4               // 28
+
+    // Total Size: 32
+
+    // Interior nodes have nr_primitives == 0 and left_first is the index of the left child
+    // (the right child is always at left_first+1)
+    // Leaf nodes have nr_primitives > 0 and left_first is the index of their first primitive
+    // in the primitive index array
+};
+constexpr bool bvh_node_is_opengl_compatible = (sizeof(BVHNode) == bvh_node_size_in_opengl) && std::is_standard_layout<BVHNode>::value;
+
+// The traversal stack sizes in raytracer.glsl (BVH_STACK_SIZE and TLAS_STACK_SIZE)
+// Traversing a hierarchy takes at most one more stack entry than its depth, so it must be less than these
+constexpr int bvh_stack_size = 64;
+constexpr int tlas_stack_size = 32;
+
+/*
+A bounding volume hierarchy built with binned SAH (surface area heuristic)
+
+The nodes are laid out so they can be uploaded directly to the BVHNodeBuffer in
+raytracer.glsl: node 0 is the root and siblings are always next to each other
+*/
+class BVH {
+public:
+    BVH() = default;
+
+    // Builds the hierarchy over arbitrary primitives given only their bounds
+    // No leaf is deeper than max_depth (the root is at depth 0), nodes switch from SAH to median
+    // splits when a SAH split could leave a child with too many primitives to fit in the levels left
+    void build(const std::vector<AABB>& primitive_bounds, int max_depth=bvh_stack_size-1);
+    // Recalculates the bounds of every node without changing the structure of the hierarchy
+    // primitive_bounds must have the same number of primitives as the last call to build
+    // This is O(n) but the hierarchy gets worse the further the primitives move
+    void refit(const std::vector<AABB>& primitive_bounds);
+
+    // The SAH cost of the hierarchy relative to the surface area of the root
+    // Used to decide when a refitted hierarchy has degraded enough to rebuild
+    float sah_cost() const;
+    size_t size_primitives() const;
+    // The depth of the deepest leaf, the root is at depth 0
+    int get_depth() const;
+
+    const std::vector<BVHNode>& get_nodes() const;
+    // Leaf nodes reference a range of this array which contains the indices of the
+    // primitives passed to build
+    const std::vector<unsigned int>& get_primitive_indices() const;
+
+    static AABB triangle_bounds(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2);
+
+private:
+    static constexpr int nr_bins = 16;
+    static constexpr int max_leaf_size = 4;
+    static constexpr float traversal_cost = 1.0f;
+
+    void update_node_bounds(int node_index, const std::vector<AABB>& primitive_bounds);
+    // Returns true if the node was split
+    // levels_left is how many more levels the node's subtree can have below it
+    bool subdivide(int node_index, const std::vector<AABB>& primitive_bounds, int levels_left);
+    // Splits the node's primitives in half by their centroids along the axis the centroids spread the most along
+    void subdivide_median(int node_index, const std::vector<AABB>& primitive_bounds, const AABB& centroid_bounds);
+    void add_children(int node_index, int left_count, const std::vector<AABB>& primitive_bounds);
+
+    std::vector<BVHNode> nodes;
+    std::vector<unsigned int> primitive_indices;
+    std::vector<glm::vec3> centroids;
+    int depth = 0;
+};
+
+#endif
@@ -0,0 +1,163 @@
+#include "BVH4D.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+// How much a box is grown by (relative to the size of the numbers involved) before it's tested
+// against a hyperplane, which is much more than the rounding error of Hyperplane4D::distance
+static constexpr float hyperplane_epsilon = 0.00001f;
+
+AABB4D::AABB4D() :
+    min(std::numeric_limits<float>::max()),
+    max(-std::numeric_limits<float>::max())
+{}
+
+void AABB4D::grow(const glm::vec4& point) {
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+}
+
+void AABB4D::grow(const AABB4D& other) {
+    min = glm::min(min, other.min);
+    max = glm::max(max, other.max);
+}
+
+glm::vec4 AABB4D::centroid() const {
+    return (min + max) * 0.5f;
+}
+
+bool AABB4D::empty() const {
+    return min.x > max.x || min.y > max.y || min.z > max.z || min.w > max.w;
+}
+
+bool AABB4D::intersects(const Hyperplane4D& hyperplane) const {
+    if (empty())
+        return false;
+
+    // The corners furthest above and below the hyperplane are the center plus or
+    // minus the extents, each flipped to the side the normal points to on its axis
+    glm::vec4 center = centroid();
+    glm::vec4 extents = (max - min) * 0.5f;
+    glm::vec4 abs_normal = glm::abs(hyperplane.normal);
+    float distance = hyperplane.distance(center);
+    float radius = glm::dot(abs_normal, extents);
+    float slack = hyperplane_epsilon * (glm::dot(abs_normal, glm::abs(center) + extents) + std::abs(hyperplane.offset));
+    return std::abs(distance) <= radius + slack;
+}
+
+void BVH4D::build(const std::vector<AABB4D>& primitive_bounds) {
+    unsigned int nr_primitives = (unsigned int)primitive_bounds.size();
+
+    nodes.clear();
+    nodes.reserve(std::max(2*nr_primitives, 1u));
+    primitive_indices.resize(nr_primitives);
+    std::iota(primitive_indices.begin(), primitive_indices.end(), 0u);
+
+    centroids.resize(nr_primitives);
+    for (unsigned int i=0; i<nr_primitives; i++) {
+        centroids[i] = primitive_bounds[i].centroid();
+    }
+
+    // The root starts out as a leaf containing every primitive
+    BVH4DNode root;
+    root.left_first = 0;
+    root.nr_primitives = (int)nr_primitives;
+    for (const auto& bounds : primitive_bounds) {
+        root.bounds.grow(bounds);
+    }
+    nodes.push_back(root);
+
+    // Subdividing with an explicit stack because degenerate inputs can get very deep
+    std::vector<int> to_subdivide{0};
+    while (!to_subdivide.empty()) {
+        int node_index = to_subdivide.back();
+        to_subdivide.pop_back();
+        if (subdivide(node_index, primitive_bounds)) {
+            to_subdivide.push_back(nodes[node_index].left_first);
+            to_subdivide.push_back(nodes[node_index].left_first+1);
+        }
+    }
+
+    // Only needed while building
+    centroids.clear();
+    centroids.shrink_to_fit();
+}
+
+void BVH4D::intersect(const Hyperplane4D& hyperplane, std::vector<unsigned int>& primitives) const {
+    if (nodes.empty() || !nodes[0].bounds.intersects(hyperplane))
+        return;
+
+    // Children are tested before they are pushed so every node on the stack intersects
+    int stack[64];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+    while (stack_size > 0) {
+        const BVH4DNode& node = nodes[stack[--stack_size]];
+        if (node.nr_primitives > 0) {
+            primitives.insert(primitives.end(),
+                              primitive_indices.begin() + node.left_first,
+                              primitive_indices.begin() + node.left_first + node.nr_primitives);
+            continue;
+        }
+        for (int child=node.left_first; child<node.left_first+2; child++) {
+            if (nodes[child].bounds.intersects(hyperplane))
+                stack[stack_size++] = child;
+        }
+    }
+}
+
+const std::vector<BVH4DNode>& BVH4D::get_nodes() const {
+    return nodes;
+}
+
+const std::vector<unsigned int>& BVH4D::get_primitive_indices() const {
+    return primitive_indices;
+}
+
+bool BVH4D::subdivide(int node_index, const std::vector<AABB4D>& primitive_bounds) {
+    int first = nodes[node_index].left_first;
+    int count = nodes[node_index].nr_primitives;
+    if (count <= max_leaf_size)
+        return false;
+
+    AABB4D centroid_bounds;
+    for (int i=0; i<count; i++) {
+        centroid_bounds.grow(centroids[primitive_indices[first+i]]);
+    }
+    glm::vec4 extents = centroid_bounds.max - centroid_bounds.min;
+    int axis = 0;
+    for (int i=1; i<4; i++) {
+        if (extents[i] > extents[axis])
+            axis = i;
+    }
+    if (extents[axis] <= 0.0f)
+        // Every centroid is in the same place so there is nothing to split on
+        return false;
+
+    // Splitting at the median keeps the hierarchy balanced, so its depth is
+    // logarithmic and always fits in the traversal stack
+    int half = count / 2;
+    std::nth_element(
+        primitive_indices.begin()+first,
+        primitive_indices.begin()+first+half,
+        primitive_indices.begin()+first+count,
+        [&](unsigned int a, unsigned int b) {
+            return centroids[a][axis] < centroids[b][axis];
+        }
+    );
+
+    int left_index = (int)nodes.size();
+    for (int i=0; i<2; i++) {
+        BVH4DNode child;
+        child.left_first = first + i*half;
+        child.nr_primitives = i == 0 ? half : count-half;
+        for (int j=0; j<child.nr_primitives; j++) {
+            child.bounds.grow(primitive_bounds[primitive_indices[child.left_first+j]]);
+        }
+        nodes.push_back(child);
+    }
+    nodes[node_index].left_first = left_index;
+    nodes[node_index].nr_primitives = 0;
+    return true;
+}
@@ -0,0 +1,68 @@
+#ifndef BVH_4D_HPP
+#define BVH_4D_HPP
+
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "Hyperplane4D.hpp"
+
+struct AABB4D {
+    glm::vec4 min;
+    glm::vec4 max;
+
+    // An empty AABB (min > max) so growing it by anything results in that thing's bounds
+    AABB4D();
+
+    void grow(const glm::vec4& point);
+    void grow(const AABB4D& other);
+
+    glm::vec4 centroid() const;
+    bool empty() const;
+    // Whether the hyperplane could pass through the box, erring on the side of yes
+    // so nothing exactly on the hyperplane is ever missed to rounding
+    bool intersects(const Hyperplane4D& hyperplane) const;
+};
+
+struct BVH4DNode {
+    AABB4D bounds;
+    // The same as BVHNode:
+    // Interior nodes have nr_primitives == 0 and left_first is the index of the left child
+    // (the right child is always at left_first+1)
+    // Leaf nodes have nr_primitives > 0 and left_first is the index of their first primitive
+    // in the primitive index array
+    int left_first;
+    int nr_primitives;
+};
+
+/*
+A bounding volume hierarchy over 4D primitives (the tetrahedra of a 4D mesh) for finding the
+ones a hyperplane could pass through without testing all of them
+
+It's only ever queried with hyperplanes, whose orientation isn't known when it's built, so
+nodes are split at the median of their widest axis rather than with a surface area heuristic
+*/
+class BVH4D {
+public:
+    BVH4D() = default;
+
+    void build(const std::vector<AABB4D>& primitive_bounds);
+
+    // Appends the primitives of every leaf the hyperplane could pass through to primitives
+    // in no particular order, which includes every primitive it passes through
+    void intersect(const Hyperplane4D& hyperplane, std::vector<unsigned int>& primitives) const;
+
+    const std::vector<BVH4DNode>& get_nodes() const;
+    const std::vector<unsigned int>& get_primitive_indices() const;
+
+private:
+    static constexpr int max_leaf_size = 8;
+
+    // Returns true if the node was split
+    bool subdivide(int node_index, const std::vector<AABB4D>& primitive_bounds);
+
+    std::vector<BVH4DNode> nodes;
+    std::vector<unsigned int> primitive_indices;
+    std::vector<glm::vec4> centroids;
+};
+
+#endif
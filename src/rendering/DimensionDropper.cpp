@@ -1,6 +1,14 @@
 #include "DimensionDropper.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <numeric>
+#include <thread>
+#include <unordered_map>
 #include <glm/glm.hpp>
 #include <glm/gtx/compatibility.hpp>
+#include <glm/gtc/type_precision.hpp>
 #include <QDebug>
 #include "objects/DynamicMesh.hpp"
 #include <QMatrix3x3>
@@ -25,184 +33,1127 @@ struct compare_vec3s : public std::unary_function<glm::vec3, bool> {
     glm::vec3 v1;
 };
 
-Node* DimensionDropper::drop(Node* node4d, float slice) {
+// Finds the first vertex compare_vec3s considers equal to a point in O(1) instead of O(n)
+//
+// Vertices are sorted into a grid of cells much wider than epsilon, so a point
+// only has to be compared with the vertices in the one cell (or, near the edge
+// of a cell, up to 8 cells) that its epsilon neighbourhood overlaps
+// The cells are hashed into a fixed number of buckets that each hold a chain
+// of vertices, a bucket can be shared by several cells since every vertex in
+// it is compared with compare_vec3s anyways
+class SpatialHashWelder {
+public:
+    // max_vertices is only used to pick how many buckets there are
+    SpatialHashWelder(std::vector<glm::vec3>& vertices, size_t max_vertices) : vertices(vertices) {
+        size_t nr_buckets = 16;
+        while (nr_buckets < 2*max_vertices)
+            nr_buckets *= 2;
+        buckets.assign(nr_buckets, no_vertex);
+        next.reserve(max_vertices);
+    }
+
+    // Returns the index of the first matching vertex, adding the point if there is none
+    Index weld(const glm::vec3& point, Index& verts_added) {
+        glm::i64vec3 min_cell = get_cell(point - epsilon);
+        glm::i64vec3 max_cell = get_cell(point + epsilon);
+        Index found = no_vertex;
+        for (auto x = min_cell.x; x <= max_cell.x; x++) {
+            for (auto y = min_cell.y; y <= max_cell.y; y++) {
+                for (auto z = min_cell.z; z <= max_cell.z; z++) {
+                    // Chains run from the newest vertex to the oldest, but the
+                    // oldest match is wanted so welding is the same as with std::find_if
+                    for (Index v = buckets[get_bucket(glm::i64vec3(x, y, z))]; v != no_vertex; v = next[v]) {
+                        if (v < found && compare_vec3s(point)(vertices[v]))
+                            found = v;
+                    }
+                }
+            }
+        }
+        if (found != no_vertex)
+            return found;
+
+        Index index = (Index)vertices.size();
+        Index& bucket = buckets[get_bucket(get_cell(point))];
+        vertices.push_back(point);
+        next.push_back(bucket);
+        bucket = index;
+        verts_added++;
+        return index;
+    }
+
+    // Removes the last count vertices, which are always at the start of their chains
+    void remove_last(Index count) {
+        for (Index i = 0; i < count; i++) {
+            buckets[get_bucket(get_cell(vertices.back()))] = next.back();
+            vertices.pop_back();
+            next.pop_back();
+        }
+    }
+
+private:
+    static constexpr Index no_vertex = ~(Index)0;
+    static constexpr double cell_size = 1024.0 * epsilon;
+
+    static glm::i64vec3 get_cell(const glm::vec3& point) {
+        return glm::i64vec3(std::floor(point.x / cell_size),
+                            std::floor(point.y / cell_size),
+                            std::floor(point.z / cell_size));
+    }
+
+    size_t get_bucket(const glm::i64vec3& cell) const {
+        std::uint64_t hash = (std::uint64_t)cell.x * 73856093u ^
+                             (std::uint64_t)cell.y * 19349663u ^
+                             (std::uint64_t)cell.z * 83492791u;
+        return hash & (buckets.size() - 1);
+    }
+
+    std::vector<glm::vec3>& vertices;
+    // The newest vertex in each bucket and the next (older) vertex in each vertex's bucket
+    std::vector<Index> buckets;
+    std::vector<Index> next;
+};
+
+// Appends the polygon a tetrahedron's cross section makes with the slice
+// to the buffer as one line per face of the tetrahedron it crosses
+static void slice_tetrahedron(const glm::vec4 points[4], float slice, std::vector<std::pair<glm::vec3, glm::vec3>>& lines, std::vector<unsigned char>& polygon_sizes) {
+    // accumulate all intersections for each tetrahedron
+    // (fixed size arrays since this runs for every tetrahedron of every slice)
+    constexpr unsigned char pointCount = 4;
+    std::pair<glm::vec3, glm::vec3> faceIntersections[pointCount];
+    unsigned char faceIntersectionCount = 0;
+
+    // for each triangle in the tetrahedron
+    for (unsigned char j = 0; j < pointCount; ++j) {
+        constexpr unsigned char triCount = pointCount - 1;
+        glm::vec3 triIntersections[triCount];
+        unsigned char triIntersectionCount = 0;
+
+        glm::vec4 triPoints[triCount] {
+            points[0 + (j <= 0)],
+            points[1 + (j <= 1)],
+            points[2 + (j <= 2)]
+        };
+
+        // for each line segment in the triangle
+        for (unsigned char k = 0; k < triCount; ++k) {
+            glm::vec4 a = triPoints[k];
+            glm::vec4 b = triPoints[(k + 1) % triCount];
+
+            a.w -= slice;
+            b.w -= slice;
+
+            // this also removes any intersections that
+            // exactly intersect either end of the line
+            if (a.w * b.w < 0.0f) {
+                // the edge intersects
+                float t = a.w / (a.w - b.w);
+
+                glm::vec3 intersection = glm::lerp(a, b, t);
+                triIntersections[triIntersectionCount++] = intersection;
+            }
+        }
+
+        // if a single valid line intersection was found in the triangle
+        if (triIntersectionCount == 2 && !compare_vec3s(triIntersections[0])(triIntersections[1]))
+            faceIntersections[faceIntersectionCount++] = {triIntersections[0], triIntersections[1]};
+    }
+
+    // 3 = trigon   (1 triangle ) (tetrahedron, hexahedron,             dodecahedron)
+    // 4 = tetragon (2 triangles) (tetrahedron, hexahedron, octahedron, dodecahedron)
+    // 5 = pentagon (3 triangles) (                                     dodecahedron)
+    // 6 = hexagon  (4 triangles) (             hexahedron, octahedron, dodecahedron)
+    // 7 = heptagon (5 triangles) (                                     dodecahedron)
+    // 8 = octagon  (6 triangles) (                                     dodecahedron)
+    if (faceIntersectionCount > 2) {
+        lines.insert(lines.end(), faceIntersections, faceIntersections + faceIntersectionCount);
+        polygon_sizes.push_back(faceIntersectionCount);
+    }
+}
+
+// Runs function(chunk) for every chunk in [0, nr_chunks) on the dropper's threads
+// Every chunk writes its own output, so which thread runs a chunk never changes the result
+template<typename Function>
+static void run_chunks(WorkerPool& workers, int nr_chunks, const Function& function) {
+    workers.run(nr_chunks, function);
+}
+
+// Concatenates the data of every chunk in the order of the chunks, each chunk is
+// copied to the offset an exclusive scan over the chunks' sizes gives it
+// Returns those offsets, a single chunk is swapped into the result instead of copied
+template<typename T>
+static std::vector<size_t> concatenate_chunks(WorkerPool& workers, int nr_chunks, std::vector<std::vector<T>>& chunk_data, std::vector<T>& result) {
+    std::vector<size_t> offsets(nr_chunks + 1, 0);
+    for (int chunk = 0; chunk < nr_chunks; chunk++)
+        offsets[chunk + 1] = offsets[chunk] + chunk_data[chunk].size();
+
+    if (nr_chunks == 1) {
+        std::swap(chunk_data[0], result);
+    } else {
+        result.resize(offsets[nr_chunks]);
+        run_chunks(workers, nr_chunks, [&](int chunk) {
+            std::copy(chunk_data[chunk].begin(), chunk_data[chunk].end(), result.begin() + offsets[chunk]);
+        });
+    }
+    return offsets;
+}
+
+// The vertices at the ends of each of a tetrahedron's edges, in the order of Topology::tetrahedron_edges
+static constexpr unsigned char tetrahedron_edge_vertices[6][2] = {
+    {0, 1}, {0, 2}, {0, 3}, {1, 2}, {1, 3}, {2, 3}
+};
+
+// The triangles a tetrahedron's cross section is made of, as the edges
+// (see tetrahedron_edge_vertices) their vertices are on, for every case
+// of which of the tetrahedron's vertices are above the slice (bit i is vertex i)
+// A quad's edges are in order around it so it can be split along a diagonal
+// Complementary cases cross the same edges, so they have the same triangles
+struct SliceCase {
+    unsigned char nr_triangles;
+    unsigned char edges[6];
+};
+
+static constexpr SliceCase slice_cases[16] = {
+    {0, {}},                    // 0000
+    {1, {0, 1, 2}},             // 0001 vertex 0
+    {1, {0, 3, 4}},             // 0010 vertex 1
+    {2, {1, 2, 4, 1, 4, 3}},    // 0011 vertices 0 and 1
+    {1, {1, 3, 5}},             // 0100 vertex 2
+    {2, {0, 2, 5, 0, 5, 3}},    // 0101 vertices 0 and 2
+    {2, {0, 1, 5, 0, 5, 4}},    // 0110 vertices 1 and 2
+    {1, {2, 4, 5}},             // 0111 vertex 3
+    {1, {2, 4, 5}},             // 1000 vertex 3
+    {2, {0, 1, 5, 0, 5, 4}},    // 1001 vertices 0 and 3
+    {2, {0, 2, 5, 0, 5, 3}},    // 1010 vertices 1 and 3
+    {1, {1, 3, 5}},             // 1011 vertex 2
+    {2, {1, 2, 4, 1, 4, 3}},    // 1100 vertices 2 and 3
+    {1, {0, 3, 4}},             // 1101 vertex 1
+    {1, {0, 1, 2}},             // 1110 vertex 0
+    {0, {}}                     // 1111
+};
+
+static constexpr Index no_edge_vertex = ~(Index)0;
+
+// Appends the triangles of a tetrahedron's cross section to indices, from the crossings
+// (edge_vertices) of its edges (topology.tetrahedron_edges) and the points they index
+static void triangulate_tetrahedron(unsigned char slice_case, const Index* edges, const std::vector<Index>& edge_vertices, const std::vector<glm::vec3>& points, std::vector<Index>& indices) {
+    const SliceCase& triangles = slice_cases[slice_case];
+    for (unsigned char j = 0; j < 3*triangles.nr_triangles; j += 3) {
+        Index i0 = edge_vertices[edges[triangles.edges[j + 0]]];
+        Index i1 = edge_vertices[edges[triangles.edges[j + 1]]];
+        Index i2 = edge_vertices[edges[triangles.edges[j + 2]]];
+
+        // A slice going exactly through a vertex makes several edges cross at
+        // the same point, which can leave triangles without any area
+        glm::vec3 p0 = points[i0];
+        if (glm::cross(points[i1] - p0, points[i2] - p0) == glm::vec3(0.0f))
+            continue;
+
+        indices.push_back(i0);
+        indices.push_back(i1);
+        indices.push_back(i2);
+    }
+}
+
+// Whether a vertex is above the slice from its distance to the hyperplane, MUST be the same test
+// for edges and tetrahedra so that every edge a slice case uses has a crossing
+static bool above_slice(float distance) {
+    return distance > 0.0f;
+}
+
+// Replaces vertices and indices with the vertices of the points of a cross section and its triangles
+// Every point is one vertex shared by all of its triangles, which only need their own
+// normals for flat shading and the ray tracer can get those from the triangles themselves
+// normals is only used with NormalMode::Smooth, for the sum of the normals of each point's triangles
+static void make_vertices(DimensionDropper::NormalMode normal_mode, const std::vector<glm::vec3>& points, const std::vector<Index>& triangles,
+                          std::vector<glm::vec3>& normals, std::vector<Vertex>& vertices, std::vector<Index>& indices) {
+    size_t nr_points = points.size();
+    if (normal_mode == DimensionDropper::NormalMode::Smooth) {
+        normals.assign(nr_points, glm::vec3(0.0f));
+        for (size_t i = 0; i < triangles.size(); i += 3) {
+            const Index* triangle = &triangles[i];
+            glm::vec3 p0 = points[triangle[0]];
+            // Its length is twice the triangle's area, which weighs bigger triangles more
+            glm::vec3 normal = glm::cross(points[triangle[1]] - p0, points[triangle[2]] - p0);
+            // The triangles aren't wound consistently (the ray tracer shades both sides the same),
+            // so each normal is flipped to the side its vertex's normal is already on
+            for (unsigned char j = 0; j < 3; j++) {
+                glm::vec3& sum = normals[triangle[j]];
+                sum += glm::dot(sum, normal) < 0.0f ? -normal : normal;
+            }
+        }
+    }
+
+    vertices.resize(nr_points);
+    for (size_t i = 0; i < nr_points; i++) {
+        glm::vec4 normal(0.0f);
+        if (normal_mode == DimensionDropper::NormalMode::Smooth && normals[i] != glm::vec3(0.0f))
+            normal = glm::vec4(glm::normalize(normals[i]), 0.0f);
+        vertices[i] = Vertex(glm::vec4(points[i], 0.0f), normal);
+    }
+    indices.assign(triangles.begin(), triangles.end());
+}
+
+Node* DimensionDropper::drop(Node* node4d, const Hyperplane4D& hyperplane) {
     std::vector<AbstractMesh*> meshes3d;
 
+    std::vector<Vertex> vertices;
+    std::vector<Index> indices;
     for (const auto& mesh4d : node4d->meshes) {
-        // calculate intersection points
-        std::vector<std::vector<std::pair<glm::vec3, glm::vec3>>> intersections;
+        slice_mesh(mesh4d, hyperplane, vertices, indices);
+//        qDebug() << "Mesh" << meshes3d.size() << "has" << vertices.size() << "vertices.";
+//        qDebug() << "Mesh" << meshes3d.size() << "has" << indices.size() << "indices.";
+//        qDebug() << "Mesh" << meshes3d.size() << "successfully dropped.";
+        DynamicMesh* mesh3d = new DynamicMesh(vertices, indices, this);
+        mesh3d->flat_normals = normal_mode == NormalMode::Flat;
+        meshes3d.push_back(mesh3d);
+    }
 
-        // for each tetrahedron in the mesh
-        for (size_t i = 0; i < mesh4d->size_indices(); i += 4) {
-            // accumulate all intersections for each tetrahedron
-            std::vector<std::pair<glm::vec3, glm::vec3>> faceIntersections;
+    return new Node(meshes3d, this);
+}
 
-            // get the current tetrahedron
-            constexpr unsigned char pointCount = 4;
-            glm::vec4 points[pointCount] {
-                mesh4d->get_vertices()[mesh4d->get_indices()[i + 0]].position,
-                mesh4d->get_vertices()[mesh4d->get_indices()[i + 1]].position,
-                mesh4d->get_vertices()[mesh4d->get_indices()[i + 2]].position,
-                mesh4d->get_vertices()[mesh4d->get_indices()[i + 3]].position
-            };
+Node* DimensionDropper::drop(Node* node4d, float slice) {
+    return drop(node4d, Hyperplane4D(slice));
+}
 
-            // for each triangle in the tetrahedron
-            for (unsigned char j = 0; j < pointCount; ++j) {
-                std::vector<glm::vec3> triIntersections;
+void DimensionDropper::drop(Node* node4d, const Hyperplane4D& hyperplane, Node* node3d) {
+    // drop always returns a node of dynamic meshes with one mesh
+    // for every mesh that went in, so this is safe
+    for (size_t i = 0; i < node4d->meshes.size(); i++) {
+        DynamicMesh* mesh3d = static_cast<DynamicMesh*>(node3d->meshes[i]);
+        slice_mesh(node4d->meshes[i], hyperplane, mesh3d->modify_vertices(), mesh3d->modify_indices());
+        mesh3d->flat_normals = normal_mode == NormalMode::Flat;
+    }
+}
 
-                constexpr unsigned char triCount = pointCount - 1;
-                glm::vec4 triPoints[triCount] {
-                    points[0 + (j <= 0)],
-                    points[1 + (j <= 1)],
-                    points[2 + (j <= 2)]
-                };
+std::vector<Node*> DimensionDropper::drop_sweep(Node* node4d, const Hyperplane4D& hyperplane, float offset_begin, float offset_end, int count) {
+    count = std::max(count, 0);
+    size_t nr_meshes = node4d->meshes.size();
+    std::vector<float> offsets(count);
+    for (int i = 0; i < count; i++)
+        offsets[i] = count == 1 ? offset_begin : offset_begin + (offset_end - offset_begin) * i / (count - 1);
+    // The order the slices are swept through in
+    std::vector<int> slice_order(count);
+    std::iota(slice_order.begin(), slice_order.end(), 0);
+    std::stable_sort(slice_order.begin(), slice_order.end(), [&](int a, int b) {
+        return offsets[a] < offsets[b];
+    });
 
-                // for each line segment in the triangle
-                for (unsigned char k = 0; k < triCount; ++k) {
-                    glm::vec4 a = triPoints[k];
-                    glm::vec4 b = triPoints[(k + 1) % triCount];
+    std::vector<std::vector<std::vector<Vertex>>> slice_vertices(count, std::vector<std::vector<Vertex>>(nr_meshes));
+    std::vector<std::vector<std::vector<Index>>> slice_indices(count, std::vector<std::vector<Index>>(nr_meshes));
+    std::vector<float> heights;
+    std::vector<float> min_heights;
+    std::vector<float> max_heights;
+    std::vector<Index> tetrahedra_by_min;
+    std::vector<float> sorted_min_heights;
+    for (size_t m = 0; m < nr_meshes; m++) {
+        const AbstractMesh* mesh4d = node4d->meshes[m];
+        // Built here since building it from the threads isn't safe
+        const Topology& topology = get_topology(mesh4d);
+        const Vertex* vertices4d = mesh4d->get_vertices();
+        const Index* indices4d = mesh4d->get_indices();
+        size_t nr_vertices = mesh4d->size_vertices();
+        size_t nr_tetrahedra = mesh4d->size_indices() / 4;
+
+        // A vertex is above a slice when height - offset > 0, which is the same as height > offset,
+        // so a tetrahedron crosses every slice in [min height, max height) and no others
+        heights.resize(nr_vertices);
+        int nr_chunks = get_nr_chunks(nr_vertices);
+        run_chunks(*workers, nr_chunks, [&](int chunk) {
+            for (size_t i = nr_vertices * chunk / nr_chunks; i < nr_vertices * (chunk + 1) / nr_chunks; i++)
+                heights[i] = glm::dot(hyperplane.normal, vertices4d[i].position);
+        });
+        min_heights.resize(nr_tetrahedra);
+        max_heights.resize(nr_tetrahedra);
+        for (size_t i = 0; i < nr_tetrahedra; i++) {
+            const Index* tetrahedron = &indices4d[4*i];
+            min_heights[i] = std::min(std::min(heights[tetrahedron[0]], heights[tetrahedron[1]]), std::min(heights[tetrahedron[2]], heights[tetrahedron[3]]));
+            max_heights[i] = std::max(std::max(heights[tetrahedron[0]], heights[tetrahedron[1]]), std::max(heights[tetrahedron[2]], heights[tetrahedron[3]]));
+        }
+        tetrahedra_by_min.resize(nr_tetrahedra);
+        std::iota(tetrahedra_by_min.begin(), tetrahedra_by_min.end(), (Index)0);
+        std::sort(tetrahedra_by_min.begin(), tetrahedra_by_min.end(), [&](Index a, Index b) {
+            return min_heights[a] < min_heights[b];
+        });
+        sorted_min_heights.resize(nr_tetrahedra);
+        for (size_t i = 0; i < nr_tetrahedra; i++)
+            sorted_min_heights[i] = min_heights[tetrahedra_by_min[i]];
 
-                    a.w -= slice;
-                    b.w -= slice;
+        // Every thread sweeps through a range of the slices with its own buffers
+        int nr_sweeps = std::max(std::min(get_nr_threads_used(), count), 1);
+        run_chunks(*workers, nr_sweeps, [&](int sweep) {
+            // The tetrahedra the current slice crosses with their max height, sorted by tetrahedron
+            std::vector<std::pair<Index, float>> active_tetrahedra;
+            std::vector<std::pair<Index, float>> started_tetrahedra;
+            std::vector<std::pair<Index, float>> merged_tetrahedra;
+            std::vector<CrossingTetrahedron> crossing;
+            std::vector<Index> crossing_edges;
+            std::vector<Index> edge_vertices(topology.edges.size(), no_edge_vertex);
+            std::vector<glm::vec3> points;
+            std::vector<Index> triangles;
+            std::vector<glm::vec3> normals;
+            size_t next_tetrahedron = 0;
+
+            for (int i = count * sweep / nr_sweeps; i < count * (sweep + 1) / nr_sweeps; i++) {
+                int slice = slice_order[i];
+                float offset = offsets[slice];
+
+                // The tetrahedra that stopped crossing since the last slice are removed for good
+                // since the offset only goes up, and the ones that started are merged in
+                auto stopped = [offset](const std::pair<Index, float>& tetrahedron) {
+                    return tetrahedron.second <= offset;
+                };
+                active_tetrahedra.erase(std::remove_if(active_tetrahedra.begin(), active_tetrahedra.end(), stopped), active_tetrahedra.end());
+                started_tetrahedra.clear();
+                for (; next_tetrahedron < nr_tetrahedra && sorted_min_heights[next_tetrahedron] <= offset; next_tetrahedron++) {
+                    Index tetrahedron = tetrahedra_by_min[next_tetrahedron];
+                    if (max_heights[tetrahedron] > offset)
+                        started_tetrahedra.emplace_back(tetrahedron, max_heights[tetrahedron]);
+                }
+                if (!started_tetrahedra.empty()) {
+                    std::sort(started_tetrahedra.begin(), started_tetrahedra.end());
+                    merged_tetrahedra.clear();
+                    std::merge(active_tetrahedra.begin(), active_tetrahedra.end(), started_tetrahedra.begin(), started_tetrahedra.end(), std::back_inserter(merged_tetrahedra));
+                    std::swap(active_tetrahedra, merged_tetrahedra);
+                }
 
-                    // this also removes any intersections that
-                    // exactly intersect either end of the line
-                    if (a.w * b.w < 0.0f) {
-                        // the edge intersects
-                        float t = a.w / (a.w - b.w);
+                // The rest is the same as slice_edge_table_culled with the heights it already has
+                // and the crossing tetrahedra already in order
+                crossing.clear();
+                for (const auto& tetrahedron : active_tetrahedra) {
+                    unsigned char slice_case = 0;
+                    for (unsigned char j = 0; j < 4; j++)
+                        slice_case |= above_slice(heights[indices4d[4*tetrahedron.first + j]] - offset) << j;
+                    crossing.push_back({tetrahedron.first, slice_case});
+                }
 
-                        glm::vec3 intersection = glm::lerp(a, b, t);
-                        triIntersections.push_back(intersection);
+                crossing_edges.clear();
+                for (const auto& tetrahedron : crossing) {
+                    for (unsigned char j = 0; j < 6; j++) {
+                        unsigned char a = tetrahedron_edge_vertices[j][0];
+                        unsigned char b = tetrahedron_edge_vertices[j][1];
+                        Index edge = topology.tetrahedron_edges[6*tetrahedron.tetrahedron + j];
+                        if (((tetrahedron.slice_case >> a) & 1) == ((tetrahedron.slice_case >> b) & 1) || edge_vertices[edge] != no_edge_vertex)
+                            continue;
+                        edge_vertices[edge] = 0;
+                        crossing_edges.push_back(edge);
                     }
                 }
+                std::sort(crossing_edges.begin(), crossing_edges.end());
 
-                // if a single valid line intersection was found in the triangle
-                if (triIntersections.size() == 2 && !compare_vec3s(triIntersections[0])(triIntersections[1]))
-                    faceIntersections.push_back({triIntersections[0], triIntersections[1]});
-            }
+                points.resize(crossing_edges.size());
+                for (size_t j = 0; j < crossing_edges.size(); j++) {
+                    const auto& vertices = topology.edges[crossing_edges[j]];
+                    float distance_a = heights[vertices.first] - offset;
+                    float distance_b = heights[vertices.second] - offset;
+                    float t = distance_a / (distance_a - distance_b);
+                    edge_vertices[crossing_edges[j]] = (Index)j;
+                    points[j] = glm::lerp(hyperplane.project(vertices4d[vertices.first].position), hyperplane.project(vertices4d[vertices.second].position), t);
+                }
+
+                triangles.clear();
+                for (const auto& tetrahedron : crossing)
+                    triangulate_tetrahedron(tetrahedron.slice_case, &topology.tetrahedron_edges[6*tetrahedron.tetrahedron], edge_vertices, points, triangles);
+                for (Index edge : crossing_edges)
+                    edge_vertices[edge] = no_edge_vertex;
 
-            // 3 = trigon   (1 triangle ) (tetrahedron, hexahedron,             dodecahedron)
-            // 4 = tetragon (2 triangles) (tetrahedron, hexahedron, octahedron, dodecahedron)
-            // 5 = pentagon (3 triangles) (                                     dodecahedron)
-            // 6 = hexagon  (4 triangles) (             hexahedron, octahedron, dodecahedron)
-            // 7 = heptagon (5 triangles) (                                     dodecahedron)
-            // 8 = octagon  (6 triangles) (                                     dodecahedron)
-            if (faceIntersections.size() > 2)
-               intersections.push_back(faceIntersections);
-        }
-
-        // assemble the intersection points into triangles
-        std::vector<glm::vec3> mesh3d_vertices;
-        std::vector<Index> mesh3d_indices;
-
-        // for all tetrahedron with intersections
-        for (const auto& faceIntersection : intersections) {
-            // temporary pool of indices to add them in order
-            std::vector<Index> inds;
-            inds.reserve(8);
-            Index verts_added = 0;
-
-            // only add the vertex positions if they are unique
-            for (const auto& line : faceIntersection) {
-                auto it_first = std::find_if(mesh3d_vertices.begin(), mesh3d_vertices.end(), compare_vec3s(line.first));
-                if (it_first == mesh3d_vertices.end()) { inds.push_back((Index)mesh3d_vertices.size()); mesh3d_vertices.push_back(line.first); verts_added++; }
-                else inds.push_back((Index)(it_first - mesh3d_vertices.begin()));
-
-                auto it_second = std::find_if(mesh3d_vertices.begin(), mesh3d_vertices.end(), compare_vec3s(line.second));
-                if (it_second == mesh3d_vertices.end()) { inds.push_back((Index)mesh3d_vertices.size()); mesh3d_vertices.push_back(line.second); verts_added++; }
-                else inds.push_back((Index)(it_second - mesh3d_vertices.begin()));
+                make_vertices(normal_mode, points, triangles, normals, slice_vertices[slice][m], slice_indices[slice][m]);
             }
+        });
+    }
 
-            // remove duplicate indices... weird, I know.
-            std::sort(inds.begin(), inds.end());
-            inds.erase(std::unique(inds.begin(), inds.end()), inds.end());
-
-            // at certain angles, for example 90 degrees,
-            // triangles may be generated that have 0
-            // volume, that is all of their points are
-            // the same point, and since duplicates are
-            // removed, inds will be left with only one
-            // index, and adding any index other than
-            // inds[0] will result in a crash.
-            // if that happens, remove this intersection
-            if (inds.size() < faceIntersection.size()) {
+    // QObjects are only made on this thread
+    std::vector<Node*> nodes3d;
+    for (int i = 0; i < count; i++) {
+        std::vector<AbstractMesh*> meshes3d;
+        for (size_t m = 0; m < nr_meshes; m++) {
+            DynamicMesh* mesh3d = new DynamicMesh(slice_vertices[i][m], slice_indices[i][m], this);
+            mesh3d->flat_normals = normal_mode == NormalMode::Flat;
+            meshes3d.push_back(mesh3d);
+        }
+        nodes3d.push_back(new Node(meshes3d, this));
+    }
+    return nodes3d;
+}
+
+std::vector<Node*> DimensionDropper::drop_sweep(Node* node4d, float w_begin, float w_end, int count) {
+    return drop_sweep(node4d, Hyperplane4D(), w_begin, w_end, count);
+}
+
+void DimensionDropper::slice_mesh(const AbstractMesh* mesh4d, const Hyperplane4D& hyperplane, std::vector<Vertex>& vertices, std::vector<Index>& indices) {
+    // assemble the intersection points into triangles
+    slice_points.clear();
+    slice_indices.clear();
+    bool updated = slice_mode == SliceMode::EdgeTable && kinetic && slice_edge_table_kinetic(mesh4d, hyperplane, slice_points, slice_indices);
+    if (!updated) {
+        bool culled = culling && find_candidates(mesh4d, hyperplane);
+        if (slice_mode == SliceMode::EdgeTable && culled)
+            slice_edge_table_culled(mesh4d, hyperplane, slice_points, slice_indices);
+        else if (slice_mode == SliceMode::EdgeTable)
+            slice_edge_table(mesh4d, hyperplane, slice_points, slice_indices);
+        else
+            slice_per_face(mesh4d, hyperplane, culled, slice_points, slice_indices);
+    }
+
+    make_vertices(normal_mode, slice_points, slice_indices, slice_normals, vertices, indices);
+}
+
+void DimensionDropper::slice_per_face(const AbstractMesh* mesh4d, const Hyperplane4D& hyperplane, bool culled, std::vector<glm::vec3>& mesh3d_vertices, std::vector<Index>& mesh3d_indices) {
+    // calculate intersection points
+    // Every chunk of tetrahedra is sliced into its own buffer, and they are
+    // merged in the order of the chunks so the result doesn't depend on the
+    // number of threads
+    // When culled, only the candidates are sliced (in the same order), the rest can't cross
+    size_t nr_tetrahedra = mesh4d->size_indices() / 4;
+    if (culled) {
+        std::sort(candidate_tetrahedra.begin(), candidate_tetrahedra.end());
+        nr_tetrahedra = candidate_tetrahedra.size();
+    }
+    int nr_chunks = get_nr_chunks(nr_tetrahedra);
+    // The tetrahedra are moved into the space where the hyperplane is w = offset
+    glm::mat4 slice_space = hyperplane.get_slice_space();
+    chunk_lines.resize(std::max(chunk_lines.size(), (size_t)nr_chunks));
+    chunk_polygon_sizes.resize(std::max(chunk_polygon_sizes.size(), (size_t)nr_chunks));
+
+    run_chunks(*workers, nr_chunks, [&](int chunk) {
+        chunk_lines[chunk].clear();
+        chunk_polygon_sizes[chunk].clear();
+
+        // for each tetrahedron in the chunk
+        size_t first = nr_tetrahedra * chunk / nr_chunks;
+        size_t last = nr_tetrahedra * (chunk + 1) / nr_chunks;
+        const Vertex* vertices4d = mesh4d->get_vertices();
+        const Index* indices4d = mesh4d->get_indices();
+        for (size_t j = first; j < last; j++) {
+            // get the current tetrahedron
+            size_t i = 4 * (culled ? candidate_tetrahedra[j] : j);
+            glm::vec4 points[4] {
+                slice_space * vertices4d[indices4d[i + 0]].position,
+                slice_space * vertices4d[indices4d[i + 1]].position,
+                slice_space * vertices4d[indices4d[i + 2]].position,
+                slice_space * vertices4d[indices4d[i + 3]].position
+            };
+            slice_tetrahedron(points, hyperplane.offset, chunk_lines[chunk], chunk_polygon_sizes[chunk]);
+        }
+    });
+
+    concatenate_chunks(*workers, nr_chunks, chunk_lines, lines);
+    concatenate_chunks(*workers, nr_chunks, chunk_polygon_sizes, polygon_sizes);
+
+    size_t max_vertices = 2*lines.size();
+    SpatialHashWelder welder(mesh3d_vertices, weld_mode == WeldMode::SpatialHash ? max_vertices : 0);
+
+    auto weld = [&](const glm::vec3& point, Index& verts_added) -> Index {
+        if (weld_mode == WeldMode::SpatialHash)
+            return welder.weld(point, verts_added);
+
+        auto it = std::find_if(mesh3d_vertices.begin(), mesh3d_vertices.end(), compare_vec3s(point));
+        if (it != mesh3d_vertices.end())
+            return (Index)(it - mesh3d_vertices.begin());
+        mesh3d_vertices.push_back(point);
+        verts_added++;
+        return (Index)mesh3d_vertices.size() - 1;
+    };
+
+    // for all tetrahedron with intersections
+    const std::pair<glm::vec3, glm::vec3>* polygon_lines = lines.data();
+    for (unsigned char polygon_size : polygon_sizes) {
+        const std::pair<glm::vec3, glm::vec3>* faceIntersection = polygon_lines;
+        polygon_lines += polygon_size;
+
+        // temporary pool of indices to add them in order
+        Index inds[8];
+        size_t nr_inds = 0;
+        Index verts_added = 0;
+
+        // only add the vertex positions if they are unique
+        for (unsigned char j = 0; j < polygon_size; j++) {
+            inds[nr_inds++] = weld(faceIntersection[j].first, verts_added);
+            inds[nr_inds++] = weld(faceIntersection[j].second, verts_added);
+        }
+
+        // remove duplicate indices... weird, I know.
+        std::sort(inds, inds + nr_inds);
+        nr_inds = std::unique(inds, inds + nr_inds) - inds;
+
+        // at certain angles, for example 90 degrees,
+        // triangles may be generated that have 0
+        // volume, that is all of their points are
+        // the same point, and since duplicates are
+        // removed, inds will be left with only one
+        // index, and adding any index other than
+        // inds[0] will result in a crash.
+        // if that happens, remove this intersection
+        if (nr_inds < polygon_size) {
+            if (weld_mode == WeldMode::SpatialHash)
+                welder.remove_last(verts_added);
+            else
                 mesh3d_vertices.erase(mesh3d_vertices.end() - verts_added, mesh3d_vertices.end());
-                continue;
-            }
+            continue;
+        }
 
-            // Ideally, normals would be calculated here
-            // because all triangles in this face face
-            // the same direction, so they wouldn't have
-            // to be recalculated once per triangle.
-            // Another thing is that the best way I can
-            // think of rendering these is with triangle
-            // strips and use a restart index to separate
-            // each cell, with each point fed into a
-            // geometry shader.
-            // The only problem is how to get an arbitrary
-            // amount of vertices into the shader.
-            // For tetrahedral faces, it would be to use
-            // GL_QUADS instead of GL_TRIANGLES so four
-            // vertices are passed to the geometry shader.
-            // But for any other shape other than
-            // tetrahedron, such as cubes, octohedrons,
-            // etc. A restart index would be required ...
-            // scratch that, I just did some research and
-            // there's a primitive type called GL_PATCHES
-            // that lets the programmer decide how many
-            // vertices are a part of it.
-
-            // Sorry for the massive comment, I'm just
-            // documenting my thinking.
+        // Ideally, normals would be calculated here
+        // because all triangles in this face face
+        // the same direction, so they wouldn't have
+        // to be recalculated once per triangle.
+        // Another thing is that the best way I can
+        // think of rendering these is with triangle
+        // strips and use a restart index to separate
+        // each cell, with each point fed into a
+        // geometry shader.
+        // The only problem is how to get an arbitrary
+        // amount of vertices into the shader.
+        // For tetrahedral faces, it would be to use
+        // GL_QUADS instead of GL_TRIANGLES so four
+        // vertices are passed to the geometry shader.
+        // But for any other shape other than
+        // tetrahedron, such as cubes, octohedrons,
+        // etc. A restart index would be required ...
+        // scratch that, I just did some research and
+        // there's a primitive type called GL_PATCHES
+        // that lets the programmer decide how many
+        // vertices are a part of it.
 
-            mesh3d_indices.push_back(inds[0]);
+        // Sorry for the massive comment, I'm just
+        // documenting my thinking.
+
+        mesh3d_indices.push_back(inds[0]);
+        mesh3d_indices.push_back(inds[1]);
+        mesh3d_indices.push_back(inds[2]);
+        if (polygon_size == 4) {
             mesh3d_indices.push_back(inds[1]);
+            mesh3d_indices.push_back(inds[3]);
+            mesh3d_indices.push_back(inds[2]);
+
+            // TODO: this is a hack
             mesh3d_indices.push_back(inds[2]);
-            if (faceIntersection.size() == 4) {
-                mesh3d_indices.push_back(inds[1]);
-                mesh3d_indices.push_back(inds[3]);
-                mesh3d_indices.push_back(inds[2]);
-
-                // TODO: this is a hack
-                mesh3d_indices.push_back(inds[2]);
-                mesh3d_indices.push_back(inds[3]);
-                mesh3d_indices.push_back(inds[0]);
+            mesh3d_indices.push_back(inds[3]);
+            mesh3d_indices.push_back(inds[0]);
+        }
+    }
+}
+
+void DimensionDropper::slice_edge_table(const AbstractMesh* mesh4d, const Hyperplane4D& hyperplane, std::vector<glm::vec3>& mesh3d_vertices, std::vector<Index>& mesh3d_indices) {
+    const Topology& topology = get_topology(mesh4d);
+    const Vertex* vertices4d = mesh4d->get_vertices();
+    size_t nr_vertices = mesh4d->size_vertices();
+    size_t nr_edges = topology.edges.size();
+    size_t nr_tetrahedra = topology.tetrahedron_edges.size() / 6;
+
+    // Every vertex is shared by several edges and tetrahedra, so its distance is only found once
+    int nr_chunks = get_nr_chunks(nr_vertices);
+    vertex_distances.resize(nr_vertices);
+    run_chunks(*workers, nr_chunks, [&](int chunk) {
+        for (size_t i = nr_vertices * chunk / nr_chunks; i < nr_vertices * (chunk + 1) / nr_chunks; i++)
+            vertex_distances[i] = hyperplane.distance(vertices4d[i].position);
+    });
+
+    // Intersect every edge that crosses the slice exactly once
+    // Each edge first gets the index of its crossing within its chunk, which
+    // is offset once it's known how many crossings the chunks before it have
+    nr_chunks = get_nr_chunks(nr_edges);
+    chunk_points.resize(std::max(chunk_points.size(), (size_t)nr_chunks));
+    edge_vertices.resize(nr_edges);
+    edge_vertices_cleared = false;
+    run_chunks(*workers, nr_chunks, [&](int chunk) {
+        std::vector<glm::vec3>& points = chunk_points[chunk];
+        points.clear();
+        for (size_t i = nr_edges * chunk / nr_chunks; i < nr_edges * (chunk + 1) / nr_chunks; i++) {
+            Index a = topology.edges[i].first;
+            Index b = topology.edges[i].second;
+            float distance_a = vertex_distances[a];
+            float distance_b = vertex_distances[b];
+            if (above_slice(distance_a) == above_slice(distance_b)) {
+                edge_vertices[i] = no_edge_vertex;
+                continue;
             }
+
+            // Only the crossings are projected into the hyperplane, the vertices never are
+            float t = distance_a / (distance_a - distance_b);
+            edge_vertices[i] = (Index)points.size();
+            points.push_back(glm::lerp(hyperplane.project(vertices4d[a].position), hyperplane.project(vertices4d[b].position), t));
         }
+    });
+    std::vector<size_t> point_offsets = concatenate_chunks(*workers, nr_chunks, chunk_points, mesh3d_vertices);
+    if (nr_chunks > 1) {
+        run_chunks(*workers, nr_chunks, [&](int chunk) {
+            for (size_t i = nr_edges * chunk / nr_chunks; i < nr_edges * (chunk + 1) / nr_chunks; i++) {
+                if (edge_vertices[i] != no_edge_vertex)
+                    edge_vertices[i] += (Index)point_offsets[chunk];
+            }
+        });
+    }
 
-        // calculate normals and separate vertices with different normals
-        std::vector<Vertex> vertices;
-        vertices.reserve(mesh3d_vertices.size() * 3);
-        std::vector<Index> indices;
-        indices.reserve(mesh3d_indices.size());
+    // Triangulate every tetrahedron's cross section straight from the edge crossings
+    nr_chunks = get_nr_chunks(nr_tetrahedra);
+    chunk_indices.resize(std::max(chunk_indices.size(), (size_t)nr_chunks));
+    const Index* indices4d = mesh4d->get_indices();
+    run_chunks(*workers, nr_chunks, [&](int chunk) {
+        std::vector<Index>& indices = chunk_indices[chunk];
+        indices.clear();
+        for (size_t i = nr_tetrahedra * chunk / nr_chunks; i < nr_tetrahedra * (chunk + 1) / nr_chunks; i++) {
+            unsigned char slice_case = 0;
+            for (unsigned char j = 0; j < 4; j++)
+                slice_case |= above_slice(vertex_distances[indices4d[4*i + j]]) << j;
 
-        // for every triangle
-        for (unsigned int i = 0; i < mesh3d_indices.size(); i += 3) {
-            glm::vec3 p0 = mesh3d_vertices[mesh3d_indices[i+0]];
-            glm::vec3 p1 = mesh3d_vertices[mesh3d_indices[i+1]];
-            glm::vec3 p2 = mesh3d_vertices[mesh3d_indices[i+2]];
+            triangulate_tetrahedron(slice_case, &topology.tetrahedron_edges[6*i], edge_vertices, mesh3d_vertices, indices);
+        }
+    });
+    concatenate_chunks(*workers, nr_chunks, chunk_indices, mesh3d_indices);
+}
 
-            glm::vec3 line1 = p0 - p1;
-            glm::vec3 line2 = p0 - p2;
+void DimensionDropper::slice_edge_table_culled(const AbstractMesh* mesh4d, const Hyperplane4D& hyperplane, std::vector<glm::vec3>& mesh3d_vertices, std::vector<Index>& mesh3d_indices) {
+    const Topology& topology = get_topology(mesh4d);
+    const Vertex* vertices4d = mesh4d->get_vertices();
+    const Index* indices4d = mesh4d->get_indices();
 
-            glm::vec4 normal = glm::vec4(glm::normalize(glm::cross(line1, line2)), 0.0f);
+    // Keep the candidates that actually cross the hyperplane
+    // Every vertex's distance is found by every candidate it's part of rather than once
+    // for all of them, so that vertices far from the hyperplane are never visited
+    size_t nr_candidates = candidate_tetrahedra.size();
+    int nr_chunks = get_nr_chunks(nr_candidates);
+    chunk_crossing_tetrahedra.resize(std::max(chunk_crossing_tetrahedra.size(), (size_t)nr_chunks));
+    run_chunks(*workers, nr_chunks, [&](int chunk) {
+        std::vector<CrossingTetrahedron>& crossing = chunk_crossing_tetrahedra[chunk];
+        crossing.clear();
+        for (size_t i = nr_candidates * chunk / nr_chunks; i < nr_candidates * (chunk + 1) / nr_chunks; i++) {
+            Index tetrahedron = candidate_tetrahedra[i];
+            unsigned char slice_case = 0;
+            for (unsigned char j = 0; j < 4; j++)
+                slice_case |= above_slice(hyperplane.distance(vertices4d[indices4d[4*tetrahedron + j]].position)) << j;
+            if (slice_case != 0 && slice_case != 15)
+                crossing.push_back({tetrahedron, slice_case});
+        }
+    });
+    concatenate_chunks(*workers, nr_chunks, chunk_crossing_tetrahedra, crossing_tetrahedra);
+    // The candidates were found in no particular order
+    std::sort(crossing_tetrahedra.begin(), crossing_tetrahedra.end(), [](const CrossingTetrahedron& a, const CrossingTetrahedron& b) {
+        return a.tetrahedron < b.tetrahedron;
+    });
+
+    // Every edge that crosses is part of a tetrahedron that crosses, and an edge crosses
+    // when the slice case has one of its vertices above the slice and not the other
+    // Sorting them numbers the crossings in the same order slice_edge_table does
+    if (!edge_vertices_cleared)
+        std::fill(edge_vertices.begin(), edge_vertices.end(), no_edge_vertex);
+    edge_vertices.resize(topology.edges.size(), no_edge_vertex);
+    edge_vertices_cleared = true;
+    crossing_edges.clear();
+    for (const auto& crossing : crossing_tetrahedra) {
+        for (unsigned char j = 0; j < 6; j++) {
+            unsigned char a = tetrahedron_edge_vertices[j][0];
+            unsigned char b = tetrahedron_edge_vertices[j][1];
+            Index edge = topology.tetrahedron_edges[6*crossing.tetrahedron + j];
+            if (((crossing.slice_case >> a) & 1) == ((crossing.slice_case >> b) & 1) || edge_vertices[edge] != no_edge_vertex)
+                continue;
+            // Only marks the edge as found for now
+            edge_vertices[edge] = 0;
+            crossing_edges.push_back(edge);
+        }
+    }
+    std::sort(crossing_edges.begin(), crossing_edges.end());
 
-            vertices.push_back(Vertex(glm::vec4(p0, 0.0f), normal));
-            vertices.push_back(Vertex(glm::vec4(p1, 0.0f), normal));
-            vertices.push_back(Vertex(glm::vec4(p2, 0.0f), normal));
+    // Intersect the crossing edges
+    size_t nr_crossing_edges = crossing_edges.size();
+    mesh3d_vertices.resize(nr_crossing_edges);
+    nr_chunks = get_nr_chunks(nr_crossing_edges);
+    run_chunks(*workers, nr_chunks, [&](int chunk) {
+        for (size_t i = nr_crossing_edges * chunk / nr_chunks; i < nr_crossing_edges * (chunk + 1) / nr_chunks; i++) {
+            const auto& vertices = topology.edges[crossing_edges[i]];
+            glm::vec4 a = vertices4d[vertices.first].position;
+            glm::vec4 b = vertices4d[vertices.second].position;
+            float distance_a = hyperplane.distance(a);
+            float distance_b = hyperplane.distance(b);
+            float t = distance_a / (distance_a - distance_b);
+            edge_vertices[crossing_edges[i]] = (Index)i;
+            mesh3d_vertices[i] = glm::lerp(hyperplane.project(a), hyperplane.project(b), t);
+        }
+    });
 
-            indices.push_back(i+0);
-            indices.push_back(i+1);
-            indices.push_back(i+2);
+    // Triangulate the crossing tetrahedra
+    size_t nr_crossing_tetrahedra = crossing_tetrahedra.size();
+    nr_chunks = get_nr_chunks(nr_crossing_tetrahedra);
+    chunk_indices.resize(std::max(chunk_indices.size(), (size_t)nr_chunks));
+    run_chunks(*workers, nr_chunks, [&](int chunk) {
+        std::vector<Index>& indices = chunk_indices[chunk];
+        indices.clear();
+        for (size_t i = nr_crossing_tetrahedra * chunk / nr_chunks; i < nr_crossing_tetrahedra * (chunk + 1) / nr_chunks; i++) {
+            const CrossingTetrahedron& crossing = crossing_tetrahedra[i];
+            triangulate_tetrahedron(crossing.slice_case, &topology.tetrahedron_edges[6*crossing.tetrahedron], edge_vertices, mesh3d_vertices, indices);
         }
+    });
+    concatenate_chunks(*workers, nr_chunks, chunk_indices, mesh3d_indices);
 
-        if (indices.size() == 0)
-            vertices.clear();
-//        qDebug() << "Mesh" << meshes3d.size() << "has" << vertices.size() << "vertices.";
-//        qDebug() << "Mesh" << meshes3d.size() << "has" << indices.size() << "indices.";
-//        qDebug() << "Mesh" << meshes3d.size() << "successfully dropped.";
-        meshes3d.push_back(new DynamicMesh(vertices, indices, this));
+    for (Index edge : crossing_edges)
+        edge_vertices[edge] = no_edge_vertex;
+}
+
+// Replaces the items of sorted whose keys are in sorted_keys with updated, which must be sorted
+// and only have items with keys in sorted_keys, so sorted stays sorted
+template<typename T, typename Key>
+static void replace_sorted(std::vector<T>& sorted, const std::vector<Index>& sorted_keys, const std::vector<T>& updated, const Key& key, std::vector<T>& scratch) {
+    scratch.clear();
+    scratch.reserve(sorted.size() + updated.size());
+    auto next_key = sorted_keys.begin();
+    auto next_updated = updated.begin();
+    for (const auto& item : sorted) {
+        while (next_updated != updated.end() && key(*next_updated) < key(item))
+            scratch.push_back(*next_updated++);
+        while (next_key != sorted_keys.end() && *next_key < key(item))
+            next_key++;
+        if (next_key == sorted_keys.end() || *next_key != key(item))
+            scratch.push_back(item);
     }
+    scratch.insert(scratch.end(), next_updated, updated.end());
+    std::swap(sorted, scratch);
+}
 
-    return new Node(meshes3d, this);
+// Builds the compressed lists of which items (edges or tetrahedra) each vertex is part of,
+// get_vertex(i, j) is vertex j of item i
+template<typename GetVertex>
+static void build_vertex_items(size_t nr_vertices, size_t nr_items, unsigned char nr_vertices_per_item, const GetVertex& get_vertex, std::vector<Index>& offsets, std::vector<Index>& items) {
+    offsets.assign(nr_vertices + 1, 0);
+    for (size_t i = 0; i < nr_items; i++) {
+        for (unsigned char j = 0; j < nr_vertices_per_item; j++)
+            offsets[get_vertex(i, j) + 1]++;
+    }
+    for (size_t i = 0; i < nr_vertices; i++)
+        offsets[i + 1] += offsets[i];
+    items.resize(offsets[nr_vertices]);
+    std::vector<Index> next_items(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < nr_items; i++) {
+        for (unsigned char j = 0; j < nr_vertices_per_item; j++)
+            items[next_items[get_vertex(i, j)]++] = (Index)i;
+    }
+}
+
+bool DimensionDropper::slice_edge_table_kinetic(const AbstractMesh* mesh4d, const Hyperplane4D& hyperplane, std::vector<glm::vec3>& mesh3d_vertices, std::vector<Index>& mesh3d_indices) {
+    const Topology& topology = get_topology(mesh4d);
+    KineticSlice& kinetic_slice = kinetic_slices[mesh4d];
+
+    // Only the offset may change, the normal and basis have to be exactly the same
+    const Hyperplane4D& last = kinetic_slice.hyperplane;
+    bool same_direction = kinetic_slice.has_hyperplane && last.normal == hyperplane.normal &&
+        last.basis[0] == hyperplane.basis[0] && last.basis[1] == hyperplane.basis[1] && last.basis[2] == hyperplane.basis[2];
+    if (!same_direction) {
+        kinetic_slice.hyperplane = hyperplane;
+        kinetic_slice.has_hyperplane = true;
+        kinetic_slice.valid = false;
+        return false;
+    }
+
+    if (kinetic_slice.valid) {
+        update_kinetic_slice(mesh4d, topology, kinetic_slice, hyperplane.offset);
+    } else {
+        kinetic_slice.hyperplane = hyperplane;
+        build_kinetic_slice(mesh4d, topology, kinetic_slice);
+    }
+
+    // Move every crossing along its edge, this is the same as slice_edge_table
+    // but with the heights and projections it already has
+    if (!edge_vertices_cleared)
+        std::fill(edge_vertices.begin(), edge_vertices.end(), no_edge_vertex);
+    edge_vertices.resize(topology.edges.size(), no_edge_vertex);
+    edge_vertices_cleared = true;
+    const std::vector<CrossingEdge>& crossing_edges = kinetic_slice.crossing_edges;
+    size_t nr_crossing_edges = crossing_edges.size();
+    mesh3d_vertices.resize(nr_crossing_edges);
+    int nr_chunks = get_nr_chunks(nr_crossing_edges);
+    run_chunks(*workers, nr_chunks, [&](int chunk) {
+        for (size_t i = nr_crossing_edges * chunk / nr_chunks; i < nr_crossing_edges * (chunk + 1) / nr_chunks; i++) {
+            const CrossingEdge& crossing = crossing_edges[i];
+            float distance_a = crossing.height_a - hyperplane.offset;
+            float distance_b = crossing.height_b - hyperplane.offset;
+            float t = distance_a / (distance_a - distance_b);
+            edge_vertices[crossing.edge] = (Index)i;
+            mesh3d_vertices[i] = glm::lerp(crossing.a, crossing.b, t);
+        }
+    });
+
+    // The slice cases only change when the hyperplane moves past a vertex, but which of the
+    // triangles have any area can change whenever it moves
+    const std::vector<CrossingTetrahedron>& crossing_tetrahedra = kinetic_slice.crossing_tetrahedra;
+    size_t nr_crossing_tetrahedra = crossing_tetrahedra.size();
+    nr_chunks = get_nr_chunks(nr_crossing_tetrahedra);
+    chunk_indices.resize(std::max(chunk_indices.size(), (size_t)nr_chunks));
+    run_chunks(*workers, nr_chunks, [&](int chunk) {
+        std::vector<Index>& indices = chunk_indices[chunk];
+        indices.clear();
+        for (size_t i = nr_crossing_tetrahedra * chunk / nr_chunks; i < nr_crossing_tetrahedra * (chunk + 1) / nr_chunks; i++) {
+            const CrossingTetrahedron& crossing = crossing_tetrahedra[i];
+            triangulate_tetrahedron(crossing.slice_case, &topology.tetrahedron_edges[6*crossing.tetrahedron], edge_vertices, mesh3d_vertices, indices);
+        }
+    });
+    concatenate_chunks(*workers, nr_chunks, chunk_indices, mesh3d_indices);
+
+    for (const auto& crossing : crossing_edges)
+        edge_vertices[crossing.edge] = no_edge_vertex;
+    return true;
+}
+
+void DimensionDropper::build_kinetic_slice(const AbstractMesh* mesh4d, const Topology& topology, KineticSlice& kinetic_slice) {
+    const Hyperplane4D& hyperplane = kinetic_slice.hyperplane;
+    const Vertex* vertices4d = mesh4d->get_vertices();
+    const Index* indices4d = mesh4d->get_indices();
+    size_t nr_vertices = mesh4d->size_vertices();
+    size_t nr_tetrahedra = topology.tetrahedron_edges.size() / 6;
+
+    // Which tetrahedra and edges each vertex is part of only depends on the mesh
+    if (kinetic_slice.vertex_tetrahedra_offsets.size() != nr_vertices + 1) {
+        build_vertex_items(nr_vertices, nr_tetrahedra, 4, [&](size_t i, unsigned char j) {
+            return indices4d[4*i + j];
+        }, kinetic_slice.vertex_tetrahedra_offsets, kinetic_slice.vertex_tetrahedra);
+        build_vertex_items(nr_vertices, topology.edges.size(), 2, [&](size_t i, unsigned char j) {
+            return j == 0 ? topology.edges[i].first : topology.edges[i].second;
+        }, kinetic_slice.vertex_edges_offsets, kinetic_slice.vertex_edges);
+    }
+
+    std::vector<float>& heights = kinetic_slice.heights;
+    heights.resize(nr_vertices);
+    int nr_chunks = get_nr_chunks(nr_vertices);
+    run_chunks(*workers, nr_chunks, [&](int chunk) {
+        for (size_t i = nr_vertices * chunk / nr_chunks; i < nr_vertices * (chunk + 1) / nr_chunks; i++)
+            heights[i] = glm::dot(hyperplane.normal, vertices4d[i].position);
+    });
+
+    kinetic_slice.events.resize(nr_vertices);
+    std::iota(kinetic_slice.events.begin(), kinetic_slice.events.end(), (Index)0);
+    std::sort(kinetic_slice.events.begin(), kinetic_slice.events.end(), [&](Index a, Index b) {
+        return heights[a] < heights[b];
+    });
+    kinetic_slice.event_heights.resize(nr_vertices);
+    for (size_t i = 0; i < nr_vertices; i++)
+        kinetic_slice.event_heights[i] = heights[kinetic_slice.events[i]];
+
+    kinetic_slice.valid = true;
+    recheck_everything(topology);
+    recheck_moved(mesh4d, topology, kinetic_slice);
+}
+
+void DimensionDropper::update_kinetic_slice(const AbstractMesh* mesh4d, const Topology& topology, KineticSlice& kinetic_slice, float offset) {
+    // A vertex is above the hyperplane when height - offset > 0, which is the same as height > offset,
+    // so the ones the hyperplane moved past have heights in (lower offset, higher offset]
+    float last_offset = kinetic_slice.hyperplane.offset;
+    kinetic_slice.hyperplane.offset = offset;
+    auto first = std::upper_bound(kinetic_slice.event_heights.begin(), kinetic_slice.event_heights.end(), std::min(offset, last_offset));
+    auto last = std::upper_bound(first, kinetic_slice.event_heights.end(), std::max(offset, last_offset));
+
+    // Jumping past a lot of vertices at once is faster to just redo
+    if ((size_t)(last - first) * max_moved_fraction > kinetic_slice.events.size()) {
+        recheck_everything(topology);
+        recheck_moved(mesh4d, topology, kinetic_slice);
+        return;
+    }
+
+    moved_tetrahedra.clear();
+    moved_edges.clear();
+    for (auto event = first; event != last; event++) {
+        Index vertex = kinetic_slice.events[event - kinetic_slice.event_heights.begin()];
+        moved_tetrahedra.insert(moved_tetrahedra.end(),
+                                kinetic_slice.vertex_tetrahedra.begin() + kinetic_slice.vertex_tetrahedra_offsets[vertex],
+                                kinetic_slice.vertex_tetrahedra.begin() + kinetic_slice.vertex_tetrahedra_offsets[vertex + 1]);
+        moved_edges.insert(moved_edges.end(),
+                           kinetic_slice.vertex_edges.begin() + kinetic_slice.vertex_edges_offsets[vertex],
+                           kinetic_slice.vertex_edges.begin() + kinetic_slice.vertex_edges_offsets[vertex + 1]);
+    }
+    // Tetrahedra and edges with several vertices that were moved past are only checked once
+    std::sort(moved_tetrahedra.begin(), moved_tetrahedra.end());
+    moved_tetrahedra.erase(std::unique(moved_tetrahedra.begin(), moved_tetrahedra.end()), moved_tetrahedra.end());
+    std::sort(moved_edges.begin(), moved_edges.end());
+    moved_edges.erase(std::unique(moved_edges.begin(), moved_edges.end()), moved_edges.end());
+    recheck_moved(mesh4d, topology, kinetic_slice);
+}
+
+void DimensionDropper::recheck_everything(const Topology& topology) {
+    moved_tetrahedra.resize(topology.tetrahedron_edges.size() / 6);
+    std::iota(moved_tetrahedra.begin(), moved_tetrahedra.end(), (Index)0);
+    moved_edges.resize(topology.edges.size());
+    std::iota(moved_edges.begin(), moved_edges.end(), (Index)0);
+}
+
+void DimensionDropper::recheck_moved(const AbstractMesh* mesh4d, const Topology& topology, KineticSlice& kinetic_slice) {
+    const Vertex* vertices4d = mesh4d->get_vertices();
+    const Index* indices4d = mesh4d->get_indices();
+    const std::vector<float>& heights = kinetic_slice.heights;
+    const Hyperplane4D& hyperplane = kinetic_slice.hyperplane;
+
+    // The same as above_slice(hyperplane.distance(vertex)) but without reading the vertex
+    moved_crossing_tetrahedra.clear();
+    for (Index tetrahedron : moved_tetrahedra) {
+        unsigned char slice_case = 0;
+        for (unsigned char j = 0; j < 4; j++)
+            slice_case |= above_slice(heights[indices4d[4*tetrahedron + j]] - hyperplane.offset) << j;
+        if (slice_case != 0 && slice_case != 15)
+            moved_crossing_tetrahedra.push_back({tetrahedron, slice_case});
+    }
+    moved_crossing_edges.clear();
+    for (Index edge : moved_edges) {
+        Index a = topology.edges[edge].first;
+        Index b = topology.edges[edge].second;
+        if (above_slice(heights[a] - hyperplane.offset) == above_slice(heights[b] - hyperplane.offset))
+            continue;
+        moved_crossing_edges.push_back({edge, heights[a], heights[b],
+                                        hyperplane.project(vertices4d[a].position),
+                                        hyperplane.project(vertices4d[b].position)});
+    }
+
+    replace_sorted(kinetic_slice.crossing_tetrahedra, moved_tetrahedra, moved_crossing_tetrahedra,
+                   [](const CrossingTetrahedron& crossing) { return crossing.tetrahedron; }, kinetic_tetrahedra_scratch);
+    replace_sorted(kinetic_slice.crossing_edges, moved_edges, moved_crossing_edges,
+                   [](const CrossingEdge& crossing) { return crossing.edge; }, kinetic_edges_scratch);
+}
+
+bool DimensionDropper::find_candidates(const AbstractMesh* mesh4d, const Hyperplane4D& hyperplane) {
+    candidate_tetrahedra.clear();
+    get_topology(mesh4d).bvh.intersect(hyperplane, candidate_tetrahedra);
+    return candidate_tetrahedra.size() * max_candidates_fraction <= mesh4d->size_indices() / 4;
+}
+
+void DimensionDropper::prepare(Node* node4d) {
+    for (const auto mesh4d : node4d->meshes)
+        prepare_mesh(mesh4d);
+}
+
+void DimensionDropper::take_prepared(DimensionDropper* other, Node* node4d) {
+    for (const auto mesh4d : node4d->meshes) {
+        auto topology = other->topologies.find(mesh4d);
+        if (topology == other->topologies.end())
+            continue;
+
+        disconnect(mesh4d, &QObject::destroyed, other, nullptr);
+        if (!topologies.count(mesh4d))
+            forget_when_destroyed(mesh4d);
+        topologies[mesh4d] = std::move(topology->second);
+        other->topologies.erase(topology);
+        // Kinetic slices aren't taken, the next slice just starts over
+        kinetic_slices.erase(mesh4d);
+        other->kinetic_slices.erase(mesh4d);
+    }
+}
+
+void DimensionDropper::forget_when_destroyed(const AbstractMesh* mesh4d) {
+    // A destroyed mesh's address could be reused by a mesh with different tetrahedra
+    connect(mesh4d, &QObject::destroyed, this, [this, mesh4d]() {
+        topologies.erase(mesh4d);
+        kinetic_slices.erase(mesh4d);
+    });
+}
+
+const DimensionDropper::Topology& DimensionDropper::get_topology(const AbstractMesh* mesh4d) {
+    auto topology = topologies.find(mesh4d);
+    if (topology != topologies.end())
+        return topology->second;
+    return prepare_mesh(mesh4d);
+}
+
+const DimensionDropper::Topology& DimensionDropper::prepare_mesh(const AbstractMesh* mesh4d) {
+    bool cached = topologies.count(mesh4d) > 0;
+    Topology& topology = topologies[mesh4d];
+    if (!cached)
+        forget_when_destroyed(mesh4d);
+    build_topology(mesh4d, topology);
+    // The last slice (and which vertices are part of which tetrahedra) may have changed with the mesh
+    kinetic_slices.erase(mesh4d);
+
+    const Vertex* vertices4d = mesh4d->get_vertices();
+    const Index* indices4d = mesh4d->get_indices();
+    std::vector<AABB4D> tetrahedron_bounds(mesh4d->size_indices() / 4);
+    for (size_t i = 0; i < tetrahedron_bounds.size(); i++) {
+        for (unsigned char j = 0; j < 4; j++)
+            tetrahedron_bounds[i].grow(vertices4d[indices4d[4*i + j]].position);
+    }
+    topology.bvh.build(tetrahedron_bounds);
+    return topology;
+}
+
+void DimensionDropper::build_topology(const AbstractMesh* mesh4d, Topology& topology) {
+    topology = Topology();
+
+    const Index* indices4d = mesh4d->get_indices();
+    size_t nr_tetrahedra = mesh4d->size_indices() / 4;
+    topology.tetrahedron_edges.reserve(6*nr_tetrahedra);
+
+    // Edges are keyed by their vertices, the lower one first so both directions are the same edge
+    std::unordered_map<std::uint64_t, Index> edge_indices;
+    edge_indices.reserve(3*nr_tetrahedra);
+    for (size_t i = 0; i < nr_tetrahedra; i++) {
+        for (const auto& local_edge : tetrahedron_edge_vertices) {
+            Index a = indices4d[4*i + local_edge[0]];
+            Index b = indices4d[4*i + local_edge[1]];
+            if (a > b)
+                std::swap(a, b);
+
+            auto inserted = edge_indices.emplace((std::uint64_t)a << 32 | b, (Index)topology.edges.size());
+            if (inserted.second)
+                topology.edges.push_back({a, b});
+            topology.tetrahedron_edges.push_back(inserted.first->second);
+        }
+    }
+
+    // Edge to tetrahedron adjacency, counted first then filled in
+    topology.edge_tetrahedra_offsets.assign(topology.edges.size() + 1, 0);
+    for (Index edge : topology.tetrahedron_edges)
+        topology.edge_tetrahedra_offsets[edge + 1]++;
+    for (size_t i = 0; i < topology.edges.size(); i++)
+        topology.edge_tetrahedra_offsets[i + 1] += topology.edge_tetrahedra_offsets[i];
+    topology.edge_tetrahedra.resize(topology.tetrahedron_edges.size());
+    std::vector<Index> next_edge_tetrahedra(topology.edge_tetrahedra_offsets.begin(), topology.edge_tetrahedra_offsets.end() - 1);
+    for (size_t i = 0; i < topology.tetrahedron_edges.size(); i++)
+        topology.edge_tetrahedra[next_edge_tetrahedra[topology.tetrahedron_edges[i]]++] = (Index)(i / 6);
+}
+
+int DimensionDropper::get_nr_chunks(size_t nr_items) const {
+    size_t max_chunks = (nr_items + min_items_per_thread - 1) / min_items_per_thread;
+    return (int)std::max(std::min((size_t)get_nr_threads_used(), max_chunks), (size_t)1);
+}
+
+void DimensionDropper::set_weld_mode(WeldMode weld_mode) {
+    this->weld_mode = weld_mode;
+}
+
+DimensionDropper::WeldMode DimensionDropper::get_weld_mode() const {
+    return weld_mode;
+}
+
+void DimensionDropper::set_normal_mode(NormalMode normal_mode) {
+    this->normal_mode = normal_mode;
+}
+
+DimensionDropper::NormalMode DimensionDropper::get_normal_mode() const {
+    return normal_mode;
+}
+
+void DimensionDropper::set_nr_threads(int nr_threads) {
+    this->nr_threads = std::max(nr_threads, 0);
+    if (!workers || workers->get_nr_threads() != get_nr_threads_used())
+        workers = std::make_unique<WorkerPool>(get_nr_threads_used());
+}
+
+int DimensionDropper::get_nr_threads_used() const {
+    if (nr_threads)
+        return nr_threads;
+    return (int)std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+void DimensionDropper::set_culling(bool culling) {
+    this->culling = culling;
+}
+
+bool DimensionDropper::get_culling() const {
+    return culling;
+}
+
+void DimensionDropper::set_kinetic(bool kinetic) {
+    this->kinetic = kinetic;
+}
+
+bool DimensionDropper::get_kinetic() const {
+    return kinetic;
+}
+
+void DimensionDropper::set_slice_mode(SliceMode slice_mode) {
+    this->slice_mode = slice_mode;
+}
+
+DimensionDropper::SliceMode DimensionDropper::get_slice_mode() const {
+    return slice_mode;
 }
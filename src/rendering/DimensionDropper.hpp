@@ -2,15 +2,243 @@
 #define DIMENSION_DROPPER_HPP
 
 #include <QObject>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
 #include "objects/Node.hpp"
+#include "Hyperplane4D.hpp"
+#include "BVH4D.hpp"
+#include "WorkerPool.hpp"
 
 class DimensionDropper : public QObject {
     Q_OBJECT;
 public:
-    DimensionDropper(QObject* parent=nullptr) : QObject(parent) {}
+    // How the cross section of a mesh's tetrahedra is found
+    enum class SliceMode {
+        PerFace,    // Intersects every face of every tetrahedron and welds the points afterwards
+        EdgeTable   // Intersects every edge once and triangulates each tetrahedron with a case table
+    };
+
+    // How intersection points that are (almost) the same are merged into one vertex with SliceMode::PerFace
+    // Both produce exactly the same meshes, Linear is only kept to benchmark against
+    enum class WeldMode {
+        Linear,         // Searches every vertex added so far, O(n^2)
+        SpatialHash     // Only searches the neighbouring cells of a grid, O(n)
+    };
+
+    // What normals the sliced meshes get, either way their vertices are shared between triangles
+    enum class NormalMode {
+        Flat,   // The meshes are marked with flat_normals so the ray tracer uses each triangle's own normal
+        Smooth  // Every vertex gets the area weighted average normal of its triangles
+    };
+
+    // The unique edges of a mesh's tetrahedra, so that slicing can intersect
+    // every edge once instead of once for every face it's part of
+    struct Topology {
+        // The vertices of each edge, the lower index first
+        std::vector<std::pair<Index, Index>> edges;
+        // The 6 edges of each tetrahedron, in the order (0,1), (0,2), (0,3), (1,2), (1,3), (2,3) of its vertices
+        std::vector<Index> tetrahedron_edges;
+        // The tetrahedra edge i is part of are edge_tetrahedra[edge_tetrahedra_offsets[i]] up to edge_tetrahedra[edge_tetrahedra_offsets[i+1]]
+        std::vector<Index> edge_tetrahedra_offsets;
+        std::vector<Index> edge_tetrahedra;
+        // The tetrahedra's 4D bounds, so slicing only has to visit the ones near the hyperplane
+        // Only built by prepare (not build_topology) since only culled slices use it
+        BVH4D bvh;
+    };
+
+    DimensionDropper(QObject* parent=nullptr) : QObject(parent), slice_mode(SliceMode::EdgeTable), weld_mode(WeldMode::SpatialHash), normal_mode(NormalMode::Flat), nr_threads(0), culling(true), kinetic(true), edge_vertices_cleared(true) { set_nr_threads(0); }
     virtual ~DimensionDropper() {}
 
+    // Slices every mesh of the node, the returned node has one DynamicMesh for every mesh even if it's empty
+    Node* drop(Node* node4d, const Hyperplane4D& hyperplane);
+    // Slices with the hyperplane w = slice
     Node* drop(Node* node4d, float slice);
+    // Slices every mesh of the node into the meshes of node3d, which must be a node an earlier drop
+    // of node4d returned, reusing their vertices and indices instead of making a new node
+    void drop(Node* node4d, const Hyperplane4D& hyperplane, Node* node3d);
+    // Slices every mesh of the node count times, with the hyperplane moved to offsets evenly spread from
+    // offset_begin to offset_end (slice i is at offset_begin + (offset_end - offset_begin) * i / (count - 1))
+    // Returns one node for every slice, each the same as drop would return for that offset with SliceMode::EdgeTable
+    // Every tetrahedron's range of heights along the normal is found and sorted once for all of the slices,
+    // which are then split between the threads and each thread sweeps through its slices from the lowest offset
+    // up, only visiting the tetrahedra that start or stop crossing between one slice and the next
+    std::vector<Node*> drop_sweep(Node* node4d, const Hyperplane4D& hyperplane, float offset_begin, float offset_end, int count);
+    // Sweeps the hyperplane w = offset from w_begin to w_end
+    std::vector<Node*> drop_sweep(Node* node4d, float w_begin, float w_end, int count);
+
+    // Builds (or rebuilds) the topology and BVH of every mesh in the node
+    // Should be called once when a model is loaded and again whenever its vertices or indices change,
+    // drop builds the topology of meshes that haven't been prepared the first time it sees them
+    void prepare(Node* node4d);
+    // Moves the topologies and BVHs another dropper prepared for the node's meshes into this one,
+    // so a model can be prepared on another thread (with a dropper of its own) without preparing it again
+    // Neither dropper may be slicing while they're moved
+    void take_prepared(DimensionDropper* other, Node* node4d);
+
+    // Finds the unique edges of a mesh's tetrahedra, the edges are numbered in the order they
+    // are first found in
+    static void build_topology(const AbstractMesh* mesh4d, Topology& topology);
+
+    void set_slice_mode(SliceMode slice_mode);
+    SliceMode get_slice_mode() const;
+
+    void set_weld_mode(WeldMode weld_mode);
+    WeldMode get_weld_mode() const;
+
+    void set_normal_mode(NormalMode normal_mode);
+    NormalMode get_normal_mode() const;
+
+    // How many threads slice the tetrahedra of a mesh, 0 uses one per hardware thread
+    // The result is the same for any number of threads
+    // The threads are started here and kept until the number changes, not started by every slice
+    void set_nr_threads(int nr_threads);
+    int get_nr_threads_used() const;
+
+    // When true (the default), only the tetrahedra whose bounds the hyperplane passes through
+    // are visited, found with each mesh's BVH, instead of every tetrahedron
+    // The result is exactly the same either way
+    void set_culling(bool culling);
+    bool get_culling() const;
+
+    // When true (the default) and a mesh is sliced with a hyperplane that only differs from the one
+    // it was last sliced with in its offset, the slice is updated from the last one instead of redone
+    // Only the tetrahedra with a vertex the hyperplane moved past are triangulated again, the other
+    // crossing edges only have their crossing moved, so scrubbing the offset costs about as much as the slice is big
+    // Only used with SliceMode::EdgeTable, the result is exactly the same either way
+    void set_kinetic(bool kinetic);
+    bool get_kinetic() const;
+
+private:
+    // Meshes with fewer tetrahedra (or edges) per thread than this use fewer threads
+    static constexpr size_t min_items_per_thread = 2048;
+    // Culled slices are only used when at most 1/max_candidates_fraction of the tetrahedra are candidates,
+    // they visit far fewer tetrahedra but read their vertices in a scattered order
+    static constexpr size_t max_candidates_fraction = 4;
+    // Kinetic slices that move past more than 1/max_moved_fraction of the vertices at once check everything again
+    static constexpr size_t max_moved_fraction = 4;
+
+    // A tetrahedron a culled slice crosses and which of its vertices are above the slice
+    struct CrossingTetrahedron {
+        Index tetrahedron;
+        unsigned char slice_case;
+    };
+
+    // An edge a kinetic slice crosses, with what's needed to find the crossing for any offset
+    // without reading the vertices again
+    struct CrossingEdge {
+        Index edge;
+        // dot(normal, vertex) and the vertex projected into the hyperplane for both of its vertices
+        float height_a;
+        float height_b;
+        glm::vec3 a;
+        glm::vec3 b;
+    };
+
+    // Everything a mesh's next slice needs to be updated from its last one
+    struct KineticSlice {
+        // The hyperplane the mesh was last sliced with, only its offset can change for the
+        // slice to be updated, anything else makes the next slice start over
+        Hyperplane4D hyperplane;
+        bool has_hyperplane = false;
+        // Whether the rest is up to date with the hyperplane, which is only the case once the
+        // mesh has been sliced with the same normal and basis twice in a row, so rotating
+        // (which changes them every time) never pays for sorting the vertices
+        bool valid = false;
+
+        // The tetrahedra and edges of each vertex, vertex i's are at [offsets[i], offsets[i+1])
+        std::vector<Index> vertex_tetrahedra_offsets;
+        std::vector<Index> vertex_tetrahedra;
+        std::vector<Index> vertex_edges_offsets;
+        std::vector<Index> vertex_edges;
+
+        // dot(normal, vertex) of each vertex, which is above the hyperplane when this is above its offset
+        std::vector<float> heights;
+        // The vertices sorted by height, the hyperplane moves past them in this order
+        std::vector<Index> events;
+        std::vector<float> event_heights;
+
+        // Everything the hyperplane crosses, in order
+        std::vector<CrossingTetrahedron> crossing_tetrahedra;
+        std::vector<CrossingEdge> crossing_edges;
+    };
+
+    // Replaces vertices and indices with the cross section of a mesh
+    void slice_mesh(const AbstractMesh* mesh4d, const Hyperplane4D& hyperplane, std::vector<Vertex>& vertices, std::vector<Index>& indices);
+    // Both output the triangles of a mesh's cross section as indices into mesh3d_vertices
+    // When culled, only the tetrahedra find_candidates found are sliced
+    void slice_per_face(const AbstractMesh* mesh4d, const Hyperplane4D& hyperplane, bool culled, std::vector<glm::vec3>& mesh3d_vertices, std::vector<Index>& mesh3d_indices);
+    void slice_edge_table(const AbstractMesh* mesh4d, const Hyperplane4D& hyperplane, std::vector<glm::vec3>& mesh3d_vertices, std::vector<Index>& mesh3d_indices);
+    // slice_edge_table for only the tetrahedra find_candidates found, the edges are only visited through them
+    void slice_edge_table_culled(const AbstractMesh* mesh4d, const Hyperplane4D& hyperplane, std::vector<glm::vec3>& mesh3d_vertices, std::vector<Index>& mesh3d_indices);
+    // Slices by updating the mesh's last slice, returns false without slicing if it can't be
+    bool slice_edge_table_kinetic(const AbstractMesh* mesh4d, const Hyperplane4D& hyperplane, std::vector<glm::vec3>& mesh3d_vertices, std::vector<Index>& mesh3d_indices);
+    // Finds every vertex's height and everything the hyperplane crosses from scratch
+    void build_kinetic_slice(const AbstractMesh* mesh4d, const Topology& topology, KineticSlice& kinetic_slice);
+    // Moves the hyperplane of a valid kinetic slice to a new offset
+    void update_kinetic_slice(const AbstractMesh* mesh4d, const Topology& topology, KineticSlice& kinetic_slice, float offset);
+    // Marks every tetrahedron and edge as moved
+    void recheck_everything(const Topology& topology);
+    // Replaces the moved tetrahedra and edges' crossings with whether they cross the kinetic slice's hyperplane now
+    void recheck_moved(const AbstractMesh* mesh4d, const Topology& topology, KineticSlice& kinetic_slice);
+    // Finds the tetrahedra the hyperplane could pass through (in no particular order) with the mesh's BVH
+    // Returns whether there are few enough of them that only slicing them is faster than slicing every tetrahedron
+    bool find_candidates(const AbstractMesh* mesh4d, const Hyperplane4D& hyperplane);
+
+    const Topology& get_topology(const AbstractMesh* mesh4d);
+    const Topology& prepare_mesh(const AbstractMesh* mesh4d);
+    // Erases the topology and kinetic slice of the mesh once it's destroyed
+    void forget_when_destroyed(const AbstractMesh* mesh4d);
+    // How many chunks nr_items tetrahedra or edges are split into to be processed in parallel
+    int get_nr_chunks(size_t nr_items) const;
+
+    SliceMode slice_mode;
+    WeldMode weld_mode;
+    NormalMode normal_mode;
+    int nr_threads;
+    // Has get_nr_threads_used threads, every parallel pass runs its chunks on it
+    std::unique_ptr<WorkerPool> workers;
+    bool culling;
+    bool kinetic;
+
+    std::unordered_map<const AbstractMesh*, Topology> topologies;
+    std::unordered_map<const AbstractMesh*, KineticSlice> kinetic_slices;
+
+    // Kept between drops so they don't have to be reallocated every frame
+    // Each chunk has its own buffers and they are concatenated in the order of the chunks
+    std::vector<std::vector<std::pair<glm::vec3, glm::vec3>>> chunk_lines;
+    std::vector<std::vector<unsigned char>> chunk_polygon_sizes;
+    std::vector<std::pair<glm::vec3, glm::vec3>> lines;
+    std::vector<unsigned char> polygon_sizes;
+    std::vector<std::vector<glm::vec3>> chunk_points;
+    std::vector<std::vector<Index>> chunk_indices;
+    // How far above the hyperplane each vertex of the mesh being sliced is
+    std::vector<float> vertex_distances;
+    // The index of the crossing of each edge of the mesh being sliced
+    // Culled slices only ever set the edges they visit, so they need every edge
+    // to start out without a crossing and reset the ones they set afterwards
+    std::vector<Index> edge_vertices;
+    bool edge_vertices_cleared;
+    // The tetrahedra of the mesh being sliced that the BVH found and the ones of those that cross
+    // the hyperplane, then the edges those cross the hyperplane with
+    std::vector<Index> candidate_tetrahedra;
+    std::vector<std::vector<CrossingTetrahedron>> chunk_crossing_tetrahedra;
+    std::vector<CrossingTetrahedron> crossing_tetrahedra;
+    std::vector<Index> crossing_edges;
+    // The tetrahedra and edges with a vertex a kinetic slice moved past, and which of them still cross
+    std::vector<Index> moved_tetrahedra;
+    std::vector<Index> moved_edges;
+    std::vector<CrossingTetrahedron> moved_crossing_tetrahedra;
+    std::vector<CrossingEdge> moved_crossing_edges;
+    std::vector<CrossingTetrahedron> kinetic_tetrahedra_scratch;
+    std::vector<CrossingEdge> kinetic_edges_scratch;
+    // The cross section of the mesh being sliced before it's given normals
+    std::vector<glm::vec3> slice_points;
+    std::vector<Index> slice_indices;
+    // The sum of the normals of each slice point's triangles with NormalMode::Smooth
+    std::vector<glm::vec3> slice_normals;
 };
 
 #endif
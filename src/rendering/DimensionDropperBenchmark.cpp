@@ -0,0 +1,151 @@
+#include "DimensionDropperBenchmark.hpp"
+#include <QDebug>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <map>
+
+DimensionDropperBenchmark::DimensionDropperBenchmark(QObject* parent) : QObject(parent) {
+    loader = new ModelLoader(this);
+    dropper = new DimensionDropper(this);
+}
+
+int DimensionDropperBenchmark::run(const QString& directory, int nr_slices) {
+    nr_slices = std::max(nr_slices, 1);
+    int nr_mismatches = 0;
+
+    // The first configuration of each slice mode is the reference the others with that mode are compared to
+    // (the slice modes triangulate differently, so only their timings can be compared)
+    dropper->set_nr_threads(0);
+    QString threads = QString(" on %1 threads").arg(dropper->get_nr_threads_used());
+    std::vector<Configuration> configurations {
+        {"per face linear", DimensionDropper::SliceMode::PerFace, DimensionDropper::WeldMode::Linear, 1, false, false},
+        {"per face spatial hash", DimensionDropper::SliceMode::PerFace, DimensionDropper::WeldMode::SpatialHash, 1, false, false},
+        {"per face spatial hash" + threads, DimensionDropper::SliceMode::PerFace, DimensionDropper::WeldMode::SpatialHash, 0, false, false},
+        {"per face spatial hash culled" + threads, DimensionDropper::SliceMode::PerFace, DimensionDropper::WeldMode::SpatialHash, 0, true, false},
+        {"edge table", DimensionDropper::SliceMode::EdgeTable, DimensionDropper::WeldMode::SpatialHash, 1, false, false},
+        {"edge table" + threads, DimensionDropper::SliceMode::EdgeTable, DimensionDropper::WeldMode::SpatialHash, 0, false, false},
+        {"edge table culled", DimensionDropper::SliceMode::EdgeTable, DimensionDropper::WeldMode::SpatialHash, 1, true, false},
+        {"edge table culled" + threads, DimensionDropper::SliceMode::EdgeTable, DimensionDropper::WeldMode::SpatialHash, 0, true, false},
+        {"edge table kinetic", DimensionDropper::SliceMode::EdgeTable, DimensionDropper::WeldMode::SpatialHash, 1, true, true},
+        {"edge table kinetic" + threads, DimensionDropper::SliceMode::EdgeTable, DimensionDropper::WeldMode::SpatialHash, 0, true, true}
+    };
+    std::vector<qint64> totals(configurations.size(), 0);
+
+    QStringList model_paths;
+    QDirIterator it(directory, QStringList() << "*.ob4", QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext())
+        model_paths.push_back(it.next());
+    model_paths.sort();
+
+    for (const auto& model_path : model_paths) {
+        Node* model4d = loader->load_model(model_path.toLocal8Bit());
+        if (!model4d) {
+            qWarning() << "Skipping" << model_path << "because it failed to load";
+            continue;
+        }
+
+        size_t nr_tetrahedra = 0;
+        for (const auto mesh4d : model4d->meshes)
+            nr_tetrahedra += mesh4d->size_indices() / 4;
+
+        // Like when a model is loaded, the edges are built before slicing
+        dropper->prepare(model4d);
+
+        QString line = QString("%1 (%2 tetrahedra):").arg(QDir(directory).relativeFilePath(model_path)).arg(nr_tetrahedra);
+        std::map<DimensionDropper::SliceMode, Result> references;
+        for (size_t i = 0; i < configurations.size(); i++) {
+            Result result = time_drops(model4d, configurations[i], nr_slices);
+            totals[i] += result.nanoseconds;
+            line += QString(" %1 %2 ms").arg(configurations[i].name).arg(result.nanoseconds / 1e6, 0, 'f', 3);
+
+            auto reference = references.find(configurations[i].slice_mode);
+            if (reference == references.end()) {
+                references.emplace(configurations[i].slice_mode, std::move(result));
+            } else if (!same_meshes(reference->second, result)) {
+                line += " (MESHES DIFFER)";
+                nr_mismatches++;
+            }
+            if (i + 1 < configurations.size())
+                line += ",";
+        }
+        qDebug().noquote() << line;
+
+        for (auto mesh4d : model4d->meshes)
+            delete mesh4d;
+        delete model4d;
+    }
+
+    QString line = QString("%1 models, %2 slices each:").arg(model_paths.size()).arg(nr_slices);
+    for (size_t i = 0; i < configurations.size(); i++)
+        line += QString(" %1 %2 ms,").arg(configurations[i].name).arg(totals[i] / 1e6, 0, 'f', 3);
+    line += QString(" %1 mismatches").arg(nr_mismatches);
+    qDebug().noquote() << line;
+    return nr_mismatches ? 1 : 0;
+}
+
+uint64_t DimensionDropperBenchmark::hash_meshes(const Node* sliced_node) {
+    // 64 bit FNV-1a over every value
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&hash](uint64_t value) {
+        hash = (hash ^ value) * 1099511628211ull;
+    };
+    // Normals aren't hashed since they're derived from the positions and are NaN for degenerate triangles
+    for (const auto mesh : sliced_node->meshes) {
+        add(mesh->size_vertices());
+        add(mesh->size_indices());
+        for (size_t i = 0; i < mesh->size_vertices(); i++) {
+            const glm::vec4& position = mesh->get_vertices()[i].position;
+            for (int j = 0; j < 4; j++) {
+                uint32_t bits;
+                std::memcpy(&bits, &position[j], sizeof(bits));
+                add(bits);
+            }
+        }
+        for (size_t i = 0; i < mesh->size_indices(); i++)
+            add(mesh->get_indices()[i]);
+    }
+    return hash;
+}
+
+bool DimensionDropperBenchmark::same_meshes(const Result& a, const Result& b) {
+    // Every weld mode welds to the first matching vertex and every chunk is merged in order,
+    // so every slice of one slice mode must be exactly the same
+    return a.slice_hashes == b.slice_hashes;
+}
+
+DimensionDropperBenchmark::Result DimensionDropperBenchmark::time_drops(Node* model4d, const Configuration& configuration, int nr_slices) {
+    float w_min = std::numeric_limits<float>::max();
+    float w_max = std::numeric_limits<float>::lowest();
+    for (const auto mesh4d : model4d->meshes) {
+        for (size_t i = 0; i < mesh4d->size_vertices(); i++) {
+            w_min = std::min(w_min, mesh4d->get_vertices()[i].position.w);
+            w_max = std::max(w_max, mesh4d->get_vertices()[i].position.w);
+        }
+    }
+
+    dropper->set_slice_mode(configuration.slice_mode);
+    dropper->set_weld_mode(configuration.weld_mode);
+    dropper->set_nr_threads(configuration.nr_threads);
+    dropper->set_culling(configuration.culling);
+    dropper->set_kinetic(configuration.kinetic);
+    Result result;
+    result.slice_hashes.reserve(nr_slices);
+    QElapsedTimer timer;
+    for (int i = 0; i < nr_slices; i++) {
+        // Slicing at the middle of each step never hits the (often shared) w of a vertex exactly
+        float slice = w_min + (w_max - w_min) * (i + 0.5f) / nr_slices;
+
+        timer.start();
+        Node* sliced_node = dropper->drop(model4d, slice);
+        result.nanoseconds += timer.nsecsElapsed();
+
+        result.slice_hashes.push_back(hash_meshes(sliced_node));
+        for (auto mesh : sliced_node->meshes)
+            delete mesh;
+        delete sliced_node;
+    }
+    return result;
+}
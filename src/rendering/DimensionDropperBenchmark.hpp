@@ -0,0 +1,52 @@
+#ifndef DIMENSION_DROPPER_BENCHMARK_HPP
+#define DIMENSION_DROPPER_BENCHMARK_HPP
+
+#include <QObject>
+#include <QString>
+#include "DimensionDropper.hpp"
+#include "ModelLoader.hpp"
+
+/*
+Slices every model in a directory (recursively) with several DimensionDropper configurations
+(slice modes, weld modes, numbers of threads, with or without culling and incremental slicing) and prints how long each took and
+whether the configurations with the same slice mode produced the same meshes
+
+Run with: NWAPW_RayTracer --benchmark-dropper [directory] [slices]
+*/
+class DimensionDropperBenchmark : public QObject {
+    Q_OBJECT;
+public:
+    DimensionDropperBenchmark(QObject* parent=nullptr);
+    virtual ~DimensionDropperBenchmark() {}
+
+    // Returns 0 if every slice mode's configurations produced the same meshes for every model
+    int run(const QString& directory, int nr_slices);
+
+private:
+    struct Configuration {
+        QString name;
+        DimensionDropper::SliceMode slice_mode;
+        DimensionDropper::WeldMode weld_mode;
+        int nr_threads;
+        bool culling;
+        bool kinetic;
+    };
+
+    struct Result {
+        qint64 nanoseconds = 0;
+        // A hash of every slice's meshes, in the order they were sliced
+        std::vector<uint64_t> slice_hashes;
+    };
+
+    // Slices the model nr_slices times evenly spread across its w range
+    Result time_drops(Node* model4d, const Configuration& configuration, int nr_slices);
+    // Hashes the positions and indices of every mesh of a slice, so every slice can be compared
+    // without keeping all of their meshes around
+    static uint64_t hash_meshes(const Node* sliced_node);
+    static bool same_meshes(const Result& a, const Result& b);
+
+    ModelLoader* loader;
+    DimensionDropper* dropper;
+};
+
+#endif
@@ -0,0 +1,98 @@
+#include "GPUBVHBuilder.hpp"
+#include "BVH.hpp"
+#include <algorithm>
+
+GPUBVHBuilder::GPUBVHBuilder(QObject* parent) : QObject(parent) {
+    triangle_capacity = -1;
+}
+
+GPUBVHBuilder::~GPUBVHBuilder() {}
+
+void GPUBVHBuilder::initialize() {
+    initializeOpenGLFunctions();
+
+    ShaderStage comp_shader{GL_COMPUTE_SHADER, "src/rendering/shaders/lbvh.glsl"};
+    lbvh_shader.load_shaders(&comp_shader, 1);
+    lbvh_shader.validate();
+
+    // The node buffer is also read by raytracer.glsl
+    // The scratch buffers are only used by lbvh.glsl so they go after every binding raytracer.glsl uses
+    glGenBuffers(1, &node_ssbo);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, node_ssbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, node_ssbo);
+    unsigned int* scratch_ssbos[5] = {&primitive_ssbo, &key_ssbo, &histogram_ssbo, &parent_ssbo, &flag_ssbo};
+    for (int i=0; i<5; i++) {
+        glGenBuffers(1, scratch_ssbos[i]);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, *scratch_ssbos[i]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 20+i, *scratch_ssbos[i]);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    reserve_buffers(0);
+}
+
+void GPUBVHBuilder::reserve_buffers(int nr_triangles) {
+    if (nr_triangles <= triangle_capacity)
+        return;
+    // Growing geometrically so a slice whose number of triangles changes every frame doesn't reallocate every frame
+    nr_triangles = std::max(nr_triangles, 2*triangle_capacity);
+    triangle_capacity = nr_triangles;
+
+    int nr_blocks = (nr_triangles + radix_block_size-1) / radix_block_size;
+    // The sort buffers have two halves to ping-pong between
+    std::pair<unsigned int, size_t> sizes[6] = {
+        {node_ssbo, nr_triangles*sizeof(BVHNode)},
+        {primitive_ssbo, 2*nr_triangles*sizeof(uint32_t)},
+        {key_ssbo, 2*nr_triangles*sizeof(uint32_t)},
+        {histogram_ssbo, nr_blocks*radix_nr_digits*sizeof(uint32_t)},
+        {parent_ssbo, 2*nr_triangles*sizeof(int32_t)},
+        {flag_ssbo, nr_triangles*sizeof(uint32_t)}
+    };
+    for (const auto& ssbo : sizes) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo.first);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, ssbo.second, nullptr, GL_DYNAMIC_COPY);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void GPUBVHBuilder::dispatch(const char* stage, int nr_threads) {
+    // Subroutine uniforms are reset by glUseProgram so they have to be set every dispatch
+    lbvh_shader.use_subroutine(GL_COMPUTE_SHADER, stage);
+    glDispatchCompute((nr_threads + radix_block_size-1) / radix_block_size, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void GPUBVHBuilder::build(const std::vector<AbstractMesh*>& meshes) {
+    int nr_total_triangles = 0;
+    for (auto mesh : meshes) {
+        mesh->bvh_node_offset = nr_total_triangles;
+        nr_total_triangles += (int)mesh->size_indices()/3;
+    }
+    reserve_buffers(nr_total_triangles);
+
+    glUseProgram(lbvh_shader.get_id());
+    lbvh_shader.set_int("nr_total_triangles", nr_total_triangles);
+    for (auto mesh : meshes) {
+        int nr_triangles = (int)mesh->size_indices()/3;
+        // A single triangle is intersected directly without a hierarchy
+        if (nr_triangles < 2)
+            continue;
+
+        lbvh_shader.set_int("first_triangle", mesh->bvh_node_offset);
+        lbvh_shader.set_int("first_index", mesh->index_offset);
+        lbvh_shader.set_int("base_vertex", mesh->vertex_offset);
+        lbvh_shader.set_int("nr_triangles", nr_triangles);
+        lbvh_shader.set_vec3("bounds_min", mesh->get_bounds().min);
+        lbvh_shader.set_vec3("bounds_max", mesh->get_bounds().max);
+
+        dispatch("morton_codes", nr_triangles);
+        for (int pass=0; pass<nr_radix_passes; pass++) {
+            lbvh_shader.set_int("sort_source", pass % 2);
+            lbvh_shader.set_int("radix_shift", pass*radix_bits);
+            dispatch("radix_histogram", nr_triangles);
+            dispatch("radix_scan", 1);
+            dispatch("radix_scatter", nr_triangles);
+        }
+        dispatch("build_hierarchy", nr_triangles-1);
+        dispatch("compute_bounds", nr_triangles);
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef GPU_BVH_BUILDER_HPP
+#define GPU_BVH_BUILDER_HPP
+
+#include <QObject>
+#include <QOpenGLFunctions_4_5_Core>
+#include <vector>
+
+#include "Shader.hpp"
+#include "objects/AbstractMesh.hpp"
+
+/*
+Builds a linear BVH (LBVH) per dynamic mesh on the GPU every frame using lbvh.glsl
+
+Triangles are sorted by the Morton code of their centroids, then the hierarchy is
+emitted directly from the sorted codes so the CPU never has to touch the triangles
+See lbvh.glsl for the stages and the layout of the buffers
+*/
+class GPUBVHBuilder : public QObject, protected QOpenGLFunctions_4_5_Core {
+    Q_OBJECT;
+public:
+    GPUBVHBuilder(QObject* parent=nullptr);
+    virtual ~GPUBVHBuilder();
+
+    // Must be called with a current context
+    void initialize();
+
+    // The meshes must already be in the dynamic vertex and index buffers with their
+    // vertex_offset and index_offset set, and their bounds must be up to date (AbstractMesh::update_bounds)
+    // Sets each mesh's bvh_node_offset to where its LBVH starts
+    void build(const std::vector<AbstractMesh*>& meshes);
+
+private:
+    // This MUST match RADIX_BLOCK_SIZE in lbvh.glsl
+    static constexpr int radix_block_size = 128;
+    static constexpr int radix_bits = 4;
+    static constexpr int radix_nr_digits = 1 << radix_bits;
+    // Morton codes are 30 bits so this sorts all of them in an even number of passes
+    // (the sorted result ends up back in the first half of the sort buffers)
+    static constexpr int nr_radix_passes = 32 / radix_bits;
+    static_assert(nr_radix_passes % 2 == 0, "The sorted result must end up in the first half of the sort buffers");
+
+    void dispatch(const char* stage, int nr_threads);
+    // Grows the buffers to fit at least nr_triangles triangles, they never shrink
+    void reserve_buffers(int nr_triangles);
+
+    Shader lbvh_shader;
+
+    // Sized for triangle_capacity triangles, the shaders only use the first nr_total_triangles of them
+    int triangle_capacity;
+    unsigned int node_ssbo;
+    unsigned int primitive_ssbo;
+    unsigned int key_ssbo;
+    unsigned int histogram_ssbo;
+    unsigned int parent_ssbo;
+    unsigned int flag_ssbo;
+};
+
+#endif
@@ -0,0 +1,169 @@
+#include "GPUDimensionDropper.hpp"
+#include "DimensionDropper.hpp"
+#include <algorithm>
+
+GPUDimensionDropper::GPUDimensionDropper(QObject* parent) : QObject(parent) {
+    counter_ssbo = 0;
+    counter_ssbo_capacity = 0;
+}
+
+GPUDimensionDropper::~GPUDimensionDropper() {}
+
+void GPUDimensionDropper::initialize() {
+    initializeOpenGLFunctions();
+
+    ShaderStage comp_shader{GL_COMPUTE_SHADER, "src/rendering/shaders/slicer.glsl"};
+    slicer_shader.load_shaders(&comp_shader, 1);
+    slicer_shader.validate();
+
+    // Only slicer.glsl uses these so they go after every binding raytracer.glsl and lbvh.glsl use
+    // The rotated positions and the crossings are never uploaded, they only share the ranges
+    vertex_heap.initialize({{25, (int)sizeof(glm::vec4)}, {30, (int)sizeof(glm::vec4)}});
+    edge_heap.initialize({{26, (int)sizeof(glm::uvec2)}, {29, (int)sizeof(glm::vec4)}});
+    tetrahedron_heap.initialize({{27, 4*(int)sizeof(Index)}, {28, 6*(int)sizeof(Index)}});
+    uploaded_meshes.clear();
+
+    glGenBuffers(1, &counter_ssbo);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, counter_ssbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 31, counter_ssbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, 0, nullptr, GL_DYNAMIC_READ);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    counter_ssbo_capacity = 0;
+}
+
+void GPUDimensionDropper::dispatch(const char* stage, int nr_threads) {
+    // Subroutine uniforms are reset by glUseProgram so they have to be set every dispatch
+    slicer_shader.use_subroutine(GL_COMPUTE_SHADER, stage);
+    slicer_shader.set_int("nr_items", nr_threads);
+    if (nr_threads > 0)
+        glDispatchCompute((nr_threads + slicer_block_size-1) / slicer_block_size, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+const GPUDimensionDropper::UploadedMesh& GPUDimensionDropper::upload(SlicedMesh* mesh) {
+    auto uploaded_mesh = uploaded_meshes.find(mesh);
+    if (uploaded_mesh != uploaded_meshes.end())
+        return uploaded_mesh->second;
+
+    const AbstractMesh* mesh4d = mesh->get_mesh4d();
+    DimensionDropper::Topology topology;
+    DimensionDropper::build_topology(mesh4d, topology);
+
+    UploadedMesh& uploaded = uploaded_meshes[mesh];
+    uploaded.nr_vertices = (int)mesh4d->size_vertices();
+    uploaded.nr_edges = (int)topology.edges.size();
+    uploaded.nr_tetrahedra = (int)mesh4d->size_indices()/4;
+    uploaded.first_vertex = vertex_heap.allocate(mesh, uploaded.nr_vertices);
+    uploaded.first_edge = edge_heap.allocate(mesh, uploaded.nr_edges);
+    uploaded.first_tetrahedron = tetrahedron_heap.allocate(mesh, uploaded.nr_tetrahedra);
+    // A destroyed mesh's address could be reused by a mesh slicing a different 4D mesh
+    connect(mesh, &QObject::destroyed, this, [this, mesh]() {
+        release(mesh);
+    });
+
+    std::vector<glm::vec4> positions(uploaded.nr_vertices);
+    for (int i=0; i<uploaded.nr_vertices; i++) {
+        positions[i] = mesh4d->get_vertices()[i].position;
+    }
+    std::vector<glm::uvec2> edges(uploaded.nr_edges);
+    for (int i=0; i<uploaded.nr_edges; i++) {
+        edges[i] = glm::uvec2(topology.edges[i].first, topology.edges[i].second);
+    }
+    vertex_heap.upload(0, uploaded.first_vertex, uploaded.nr_vertices, positions.data());
+    edge_heap.upload(0, uploaded.first_edge, uploaded.nr_edges, edges.data());
+    // A mesh's indices are already 4 per tetrahedron
+    tetrahedron_heap.upload(0, uploaded.first_tetrahedron, uploaded.nr_tetrahedra, mesh4d->get_indices());
+    tetrahedron_heap.upload(1, uploaded.first_tetrahedron, uploaded.nr_tetrahedra, topology.tetrahedron_edges.data());
+    return uploaded;
+}
+
+void GPUDimensionDropper::release(SlicedMesh* mesh) {
+    // Only bookkeeping so this doesn't need the context
+    if (uploaded_meshes.erase(mesh) == 0)
+        return;
+    vertex_heap.free(mesh);
+    edge_heap.free(mesh);
+    tetrahedron_heap.free(mesh);
+    disconnect(mesh, &QObject::destroyed, this, nullptr);
+}
+
+void GPUDimensionDropper::use_mesh(const UploadedMesh& uploaded, int counter_index) {
+    slicer_shader.set_int("first_vertex", uploaded.first_vertex);
+    slicer_shader.set_int("first_edge", uploaded.first_edge);
+    slicer_shader.set_int("first_tetrahedron", uploaded.first_tetrahedron);
+    slicer_shader.set_int("counter_index", counter_index);
+}
+
+void GPUDimensionDropper::count_triangles(const std::vector<SlicedMesh*>& meshes) {
+    // Close a few of the gaps released meshes left behind, everything in the ranges is
+    // relative to the start of the range so moving them is just a copy
+    for (const auto& relocation : vertex_heap.compact_step()) {
+        uploaded_meshes[static_cast<SlicedMesh*>(const_cast<void*>(relocation.owner))].first_vertex = relocation.new_offset;
+    }
+    for (const auto& relocation : edge_heap.compact_step()) {
+        uploaded_meshes[static_cast<SlicedMesh*>(const_cast<void*>(relocation.owner))].first_edge = relocation.new_offset;
+    }
+    for (const auto& relocation : tetrahedron_heap.compact_step()) {
+        uploaded_meshes[static_cast<SlicedMesh*>(const_cast<void*>(relocation.owner))].first_tetrahedron = relocation.new_offset;
+    }
+    for (auto mesh : meshes) {
+        upload(mesh);
+    }
+
+    counters.assign(2*meshes.size(), 0);
+    size_t counter_bytes = counters.size()*sizeof(uint32_t);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, counter_ssbo);
+    if (counter_bytes > counter_ssbo_capacity) {
+        counter_ssbo_capacity = std::max(counter_bytes, 2*counter_ssbo_capacity);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, counter_ssbo_capacity, nullptr, GL_DYNAMIC_READ);
+    }
+    if (counter_bytes > 0)
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, counter_bytes, counters.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glUseProgram(slicer_shader.get_id());
+    for (size_t i=0; i<meshes.size(); i++) {
+        const UploadedMesh& uploaded = uploaded_meshes[meshes[i]];
+        use_mesh(uploaded, (int)i);
+        const Hyperplane4D& hyperplane = meshes[i]->get_hyperplane();
+        slicer_shader.set_mat4("slice_space", hyperplane.get_slice_space());
+        slicer_shader.set_float("slice", hyperplane.offset);
+
+        dispatch("rotate_vertices", uploaded.nr_vertices);
+        dispatch("intersect_edges", uploaded.nr_edges);
+        dispatch("count_triangles", uploaded.nr_tetrahedra);
+    }
+    glUseProgram(0);
+
+    // The only thing that is read back, everything else stays on the GPU
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    if (counter_bytes > 0) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, counter_ssbo);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, counter_bytes, counters.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+    for (size_t i=0; i<meshes.size(); i++) {
+        meshes[i]->set_nr_triangles((int)counters[2*i]);
+    }
+}
+
+void GPUDimensionDropper::write_triangles(const std::vector<SlicedMesh*>& meshes) {
+    glUseProgram(slicer_shader.get_id());
+    for (size_t i=0; i<meshes.size(); i++) {
+        SlicedMesh* mesh = meshes[i];
+        int nr_triangles = (int)mesh->size_indices()/3;
+        if (nr_triangles == 0)
+            continue;
+
+        // The crossings and the rotated positions are still there from count_triangles
+        use_mesh(uploaded_meshes[mesh], (int)i);
+        slicer_shader.set_float("slice", mesh->get_hyperplane().offset);
+        slicer_shader.set_int("first_triangle", mesh->first_triangle);
+        slicer_shader.set_int("first_index", mesh->index_offset);
+        slicer_shader.set_int("base_vertex", mesh->vertex_offset);
+        slicer_shader.set_int("nr_triangles", nr_triangles);
+
+        dispatch("write_triangles", uploaded_meshes[mesh].nr_tetrahedra);
+    }
+    glUseProgram(0);
+}
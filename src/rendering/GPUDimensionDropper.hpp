@@ -0,0 +1,77 @@
+#ifndef GPU_DIMENSION_DROPPER_HPP
+#define GPU_DIMENSION_DROPPER_HPP
+
+#include <QObject>
+#include <QOpenGLFunctions_4_5_Core>
+#include <unordered_map>
+#include <vector>
+
+#include "Shader.hpp"
+#include "GPUHeap.hpp"
+#include "objects/SlicedMesh.hpp"
+
+/*
+Slices SlicedMeshes on the GPU with slicer.glsl, writing their triangles straight into the
+dynamic vertex, index and triangle buffers
+
+Each mesh's 4D vertices, edges and tetrahedra are uploaded once, the first time it is sliced
+Slicing is split in two so the renderer can allocate the dynamic buffers in between:
+count_triangles finds every crossing and counts the triangles, and only the counts are read back
+write_triangles then writes the triangles to wherever the renderer put the mesh
+*/
+class GPUDimensionDropper : public QObject, protected QOpenGLFunctions_4_5_Core {
+    Q_OBJECT;
+public:
+    GPUDimensionDropper(QObject* parent=nullptr);
+    virtual ~GPUDimensionDropper();
+
+    // Must be called with a current context
+    void initialize();
+
+    // Sets the number of triangles of every mesh (SlicedMesh::set_nr_triangles)
+    // Waits for the GPU to finish counting
+    void count_triangles(const std::vector<SlicedMesh*>& meshes);
+    // Must be called with the same meshes count_triangles was last called with
+    // The dynamic buffers must be bound and big enough, and the meshes' vertex_offset,
+    // index_offset and first_triangle must be set
+    void write_triangles(const std::vector<SlicedMesh*>& meshes);
+
+private:
+    // This MUST match SLICER_BLOCK_SIZE in slicer.glsl
+    static constexpr int slicer_block_size = 128;
+
+    // Where a mesh's ranges start in the heaps
+    struct UploadedMesh {
+        int first_vertex;
+        int first_edge;
+        int first_tetrahedron;
+        int nr_vertices;
+        int nr_edges;
+        int nr_tetrahedra;
+    };
+
+    void dispatch(const char* stage, int nr_threads);
+    const UploadedMesh& upload(SlicedMesh* mesh);
+    void release(SlicedMesh* mesh);
+    // Sets the uniforms that say which mesh the stages work on
+    void use_mesh(const UploadedMesh& uploaded, int counter_index);
+
+    Shader slicer_shader;
+
+    // Every sliced mesh has its own ranges, even if several slice the same 4D mesh,
+    // so their scratch buffers don't overwrite each other
+    // 4D positions (binding 25) and rotated positions (30)
+    GPUHeap vertex_heap;
+    // Edges (26) and where they cross the slice (29)
+    GPUHeap edge_heap;
+    // Vertices (27) and edges (28) of the tetrahedra
+    GPUHeap tetrahedron_heap;
+    std::unordered_map<SlicedMesh*, UploadedMesh> uploaded_meshes;
+
+    // Two counters per mesh (binding 31), see SliceCounterBuffer in slicer.glsl
+    unsigned int counter_ssbo;
+    size_t counter_ssbo_capacity;
+    std::vector<uint32_t> counters;
+};
+
+#endif
@@ -0,0 +1,192 @@
+#include "GPUHeap.hpp"
+#include <QtGlobal>
+#include <algorithm>
+#include <iterator>
+
+GPUHeap::GPUHeap(QObject* parent) : QObject(parent) {
+    capacity = 0;
+    size_allocated = 0;
+}
+
+GPUHeap::~GPUHeap() {}
+
+void GPUHeap::initialize(const std::vector<Buffer>& buffers, int initial_capacity) {
+    initializeOpenGLFunctions();
+
+    this->buffers = buffers;
+    ssbos.resize(buffers.size());
+    capacity = std::max(initial_capacity, 1);
+    for (size_t i=0; i<buffers.size(); i++) {
+        glGenBuffers(1, &ssbos[i]);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbos[i]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, buffers[i].binding, ssbos[i]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, (size_t)capacity*buffers[i].element_size, nullptr, GL_STATIC_DRAW);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    ranges.clear();
+    free_ranges.clear();
+    owner_offsets.clear();
+    size_allocated = 0;
+    free_ranges[0] = capacity;
+}
+
+int GPUHeap::allocate(const void* owner, int size) {
+    Q_ASSERT_X(!contains(owner), "GPUHeap::allocate", "Each owner can only have one range");
+    if (size <= 0)
+        return 0;
+
+    auto fit = std::find_if(free_ranges.begin(), free_ranges.end(), [size](const std::pair<const int, int>& free_range) {
+        return free_range.second >= size;
+    });
+    if (fit == free_ranges.end()) {
+        // The free range at the end of the buffers (if there is one) grows along with them
+        int tail_size = 0;
+        if (!free_ranges.empty()) {
+            auto last = std::prev(free_ranges.end());
+            if (last->first + last->second == capacity)
+                tail_size = last->second;
+        }
+        grow(capacity + size - tail_size);
+        fit = std::prev(free_ranges.end());
+    }
+
+    int offset = fit->first;
+    int remaining = fit->second - size;
+    free_ranges.erase(fit);
+    if (remaining > 0)
+        free_ranges[offset+size] = remaining;
+
+    ranges[offset] = Range{size, owner};
+    owner_offsets[owner] = offset;
+    size_allocated += size;
+    return offset;
+}
+
+void GPUHeap::free(const void* owner) {
+    auto owner_offset = owner_offsets.find(owner);
+    if (owner_offset == owner_offsets.end())
+        return;
+
+    int offset = owner_offset->second;
+    int size = ranges[offset].size;
+    owner_offsets.erase(owner_offset);
+    ranges.erase(offset);
+    size_allocated -= size;
+    add_free_range(offset, size);
+}
+
+bool GPUHeap::contains(const void* owner) const {
+    return owner_offsets.count(owner) > 0;
+}
+
+void GPUHeap::upload(int buffer_index, int offset, int size, const void* data) {
+    if (size <= 0)
+        return;
+    Q_ASSERT_X(offset+size <= capacity, "GPUHeap::upload", "Uploading outside of the buffer");
+    int element_size = buffers[buffer_index].element_size;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbos[buffer_index]);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, (size_t)offset*element_size, (size_t)size*element_size, data);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+std::vector<GPUHeap::Relocation> GPUHeap::compact_step(int max_moves) {
+    std::vector<Relocation> relocations;
+    for (int i=0; i<max_moves && !ranges.empty(); i++) {
+        int size_used = get_size_used();
+        int size_gaps = size_used - size_allocated;
+        if (size_gaps <= max_fragmentation*size_used)
+            break;
+
+        auto last = std::prev(ranges.end());
+        int old_offset = last->first;
+        Range range = last->second;
+        // If the last range doesn't fit in any gap, compacting stalls until something before it is freed
+        auto gap = std::find_if(free_ranges.begin(), free_ranges.end(), [&](const std::pair<const int, int>& free_range) {
+            return free_range.first < old_offset && free_range.second >= range.size;
+        });
+        if (gap == free_ranges.end())
+            break;
+
+        // The gap is entirely before the range so the copy never overlaps itself
+        int new_offset = gap->first;
+        for (size_t j=0; j<buffers.size(); j++) {
+            int element_size = buffers[j].element_size;
+            glBindBuffer(GL_COPY_READ_BUFFER, ssbos[j]);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, ssbos[j]);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (size_t)old_offset*element_size, (size_t)new_offset*element_size, (size_t)range.size*element_size);
+        }
+
+        int remaining = gap->second - range.size;
+        free_ranges.erase(gap);
+        if (remaining > 0)
+            free_ranges[new_offset+range.size] = remaining;
+        ranges.erase(last);
+        ranges[new_offset] = range;
+        owner_offsets[range.owner] = new_offset;
+        add_free_range(old_offset, range.size);
+
+        relocations.push_back(Relocation{range.owner, old_offset, new_offset});
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    return relocations;
+}
+
+int GPUHeap::get_capacity() const {
+    return capacity;
+}
+
+int GPUHeap::get_size_allocated() const {
+    return size_allocated;
+}
+
+int GPUHeap::get_size_used() const {
+    if (ranges.empty())
+        return 0;
+    auto last = std::prev(ranges.end());
+    return last->first + last->second.size;
+}
+
+void GPUHeap::grow(int min_capacity) {
+    int new_capacity = std::max(min_capacity, 2*capacity);
+    int size_used = get_size_used();
+    for (size_t i=0; i<buffers.size(); i++) {
+        // The old contents are copied on the GPU so nothing has to be uploaded again
+        int element_size = buffers[i].element_size;
+        unsigned int new_ssbo;
+        glGenBuffers(1, &new_ssbo);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, new_ssbo);
+        glBufferData(GL_COPY_WRITE_BUFFER, (size_t)new_capacity*element_size, nullptr, GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_READ_BUFFER, ssbos[i]);
+        if (size_used > 0)
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, (size_t)size_used*element_size);
+        glDeleteBuffers(1, &ssbos[i]);
+        ssbos[i] = new_ssbo;
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, buffers[i].binding, new_ssbo);
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    int old_capacity = capacity;
+    capacity = new_capacity;
+    add_free_range(old_capacity, new_capacity-old_capacity);
+}
+
+void GPUHeap::add_free_range(int offset, int size) {
+    auto inserted = free_ranges.emplace(offset, size).first;
+
+    auto next = std::next(inserted);
+    if (next != free_ranges.end() && offset+size == next->first) {
+        inserted->second += next->second;
+        free_ranges.erase(next);
+    }
+    if (inserted != free_ranges.begin()) {
+        auto previous = std::prev(inserted);
+        if (previous->first + previous->second == offset) {
+            previous->second += inserted->second;
+            free_ranges.erase(inserted);
+        }
+    }
+}
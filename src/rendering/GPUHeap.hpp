@@ -0,0 +1,85 @@
+#ifndef GPU_HEAP_HPP
+#define GPU_HEAP_HPP
+
+#include <QObject>
+#include <QOpenGLFunctions_4_5_Core>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+/*
+Hands out ranges of one or more SSBOs that all share the same ranges
+(e.g. a mesh's positions and attributes are always at the same vertex offset)
+
+Offsets and sizes are in elements, each buffer has its own element size
+The buffers grow geometrically and their contents are copied on the GPU when they do,
+so allocating or freeing a range never requires anything else to be uploaded again
+Freed ranges are reused and merged with their neighbours, and compact_step moves
+ranges from the end of the buffers into gaps a few at a time
+*/
+class GPUHeap : public QObject, protected QOpenGLFunctions_4_5_Core {
+    Q_OBJECT;
+public:
+    struct Buffer {
+        unsigned int binding;
+        int element_size;   // In bytes
+    };
+
+    // A range compact_step moved
+    struct Relocation {
+        const void* owner;
+        int old_offset;
+        int new_offset;
+    };
+
+    GPUHeap(QObject* parent=nullptr);
+    virtual ~GPUHeap();
+
+    // Must be called with a current context
+    // One SSBO is created and bound for every element of buffers
+    void initialize(const std::vector<Buffer>& buffers, int initial_capacity=1024);
+
+    // Each owner can have at most one range
+    // Empty ranges are never stored and always start at 0
+    int allocate(const void* owner, int size);
+    // Does nothing if the owner has no range
+    void free(const void* owner);
+    bool contains(const void* owner) const;
+
+    // Writes size elements to the buffer at buffer_index starting at offset
+    void upload(int buffer_index, int offset, int size, const void* data);
+
+    // Moves up to max_moves ranges from the end of the buffers into the first gap they fit in
+    // Only does anything once more than max_fragmentation of the used space is gaps
+    std::vector<Relocation> compact_step(int max_moves=4);
+
+    int get_capacity() const;
+    // Elements in ranges
+    int get_size_allocated() const;
+    // Elements between the start of the buffers and the end of the last range
+    int get_size_used() const;
+
+private:
+    static constexpr float max_fragmentation = 0.25f;
+
+    struct Range {
+        int size;
+        const void* owner;
+    };
+
+    void grow(int min_capacity);
+    // Adds a free range, merging it with the free ranges next to it
+    void add_free_range(int offset, int size);
+
+    std::vector<Buffer> buffers;
+    std::vector<unsigned int> ssbos;
+    int capacity;
+    int size_allocated;
+
+    // Both are keyed by offset
+    std::map<int, Range> ranges;
+    std::map<int, int> free_ranges;
+    std::unordered_map<const void*, int> owner_offsets;
+};
+
+#endif
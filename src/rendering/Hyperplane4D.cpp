@@ -0,0 +1,33 @@
+#include "Hyperplane4D.hpp"
+
+Hyperplane4D::Hyperplane4D(float offset) :
+    Hyperplane4D(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f), offset,
+                 glm::vec4(1.0f, 0.0f, 0.0f, 0.0f),
+                 glm::vec4(0.0f, 1.0f, 0.0f, 0.0f),
+                 glm::vec4(0.0f, 0.0f, 1.0f, 0.0f))
+{}
+
+Hyperplane4D::Hyperplane4D(const glm::vec4& normal, float offset, const glm::vec4& basis_x, const glm::vec4& basis_y, const glm::vec4& basis_z) :
+    normal(normal),
+    offset(offset),
+    basis{basis_x, basis_y, basis_z}
+{}
+
+Hyperplane4D Hyperplane4D::from_rotation(const glm::mat4& rotation, float offset) {
+    // Row i of the rotation is what a point is dotted with to get its rotated coordinate i,
+    // so the rows are the unrotated directions of the rotated axes
+    glm::mat4 rows = glm::transpose(rotation);
+    return Hyperplane4D(rows[3], offset, rows[0], rows[1], rows[2]);
+}
+
+float Hyperplane4D::distance(const glm::vec4& point) const {
+    return glm::dot(normal, point) - offset;
+}
+
+glm::vec3 Hyperplane4D::project(const glm::vec4& point) const {
+    return glm::vec3(glm::dot(basis[0], point), glm::dot(basis[1], point), glm::dot(basis[2], point));
+}
+
+glm::mat4 Hyperplane4D::get_slice_space() const {
+    return glm::transpose(glm::mat4(basis[0], basis[1], basis[2], normal));
+}
@@ -0,0 +1,36 @@
+#ifndef HYPERPLANE_4D_HPP
+#define HYPERPLANE_4D_HPP
+
+#include <glm/glm.hpp>
+
+/*
+The hyperplane a 4D mesh is sliced with, and the 3D space its cross section is put in
+
+Slicing a mesh after rotating it with a 4D rotation R at w = slice is the same as slicing the
+unrotated mesh with from_rotation(R, slice), so meshes never have to be rotated to be sliced
+*/
+struct Hyperplane4D {
+    // A point p is above the hyperplane when dot(normal, p) > offset
+    glm::vec4 normal;
+    float offset;
+    // The directions in the hyperplane that become the x, y and z of the cross section
+    // They and the normal should be orthonormal so the cross section isn't sheared or scaled
+    glm::vec4 basis[3];
+
+    // The hyperplane w = offset, with x, y and z as its basis
+    Hyperplane4D(float offset=0.0f);
+    Hyperplane4D(const glm::vec4& normal, float offset, const glm::vec4& basis_x, const glm::vec4& basis_y, const glm::vec4& basis_z);
+
+    // The hyperplane w = offset of a mesh rotated by rotation, in the unrotated mesh's space
+    // rotation must be a rotation (its inverse is its transpose)
+    static Hyperplane4D from_rotation(const glm::mat4& rotation, float offset);
+
+    // How far above (positive) or below (negative) the hyperplane a point is
+    float distance(const glm::vec4& point) const;
+    // Where a point in the hyperplane ends up in the cross section
+    glm::vec3 project(const glm::vec4& point) const;
+    // Takes points to (project(point), dot(normal, point)), so the hyperplane becomes w = offset
+    glm::mat4 get_slice_space() const;
+};
+
+#endif
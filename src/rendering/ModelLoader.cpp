@@ -1,191 +1,587 @@
 #include "ModelLoader.hpp"
-#include <fstream>
-#include <sstream>
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <string_view>
 #include <unordered_map>
+#include <QDateTime>
 #include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
 #include <glm/glm.hpp>
-#include <QRegularExpression>
 #include "objects/DynamicMesh.hpp"
 
-#define AddPrimitive(indices, vertexCount) primitives[#indices] = { indices, sizeof(indices) / sizeof(Index), vertexCount }
 #define LogError(error) { std::cerr << error; return nullptr; }
 
-Node* ModelLoader::load_model(const char* file_path) {
-    // Try to open the file
-    std::ifstream file(file_path);
-    if (!file.is_open()) {
-        qDebug() << "Failed to open file: " << file_path;
-        return nullptr;
-    } else {
-        std::vector<AbstractMesh*> meshes;
-        std::vector<Index> mesh4dIndices;
-        std::vector<Vertex> mesh4dVertices;
-
-        std::unordered_map<std::string, Primitive> primitives;
-        AddPrimitive(Tetrahedron,       4);
-        AddPrimitive(Hexahedron,        8);
-        AddPrimitive(Octahedron,        6);
-        AddPrimitive(Dodecahedron,     20);
-        AddPrimitive(Icosahedron,      12);
-        AddPrimitive(TriangularPrism,   6);
-        AddPrimitive(PentagonalPrism,  10);
-        AddPrimitive(TetragonalPyramid, 5);
-        AddPrimitive(PentagonalPyramid, 6);
-
-        const std::string Custom = "Custom";
-        primitives[Custom] = Primitive();
-        std::string type = "Tetrahedron";
-        size_t lineNumber = 1;
-
-        // Stuff to do with custom primitives
-        std::string customName;
-        Index customTetrahedronCount = 0;
-        // This primitive's data is overriden
-        // every time the file contains a
-        // nameless custom primitive
-        Primitive* const customPrimitive = &primitives[Custom];
-        Primitive* currentCustomPrimitive = customPrimitive;
-
-        try {
-            while (!file.eof()) {
-                // Get the whole line
-                std::string fileLine;
-                std::getline(file, fileLine);
-
-                // Remove comments
-                size_t commentIndex = fileLine.find_first_of('#');
-                if (commentIndex != std::string::npos)
-                    fileLine.erase(commentIndex);
-
-                // If the line has any characters
-                if (fileLine.size()) {
-                    // Convert the line to a std::stringstream
-                    std::stringstream line(std::move(fileLine));
-
-                    // Get the first token
-                    std::string token0;
-                    line >> token0;
-
-                    if (customTetrahedronCount && token0 != "ci")
-                        LogError("Incomplete custom type definition on line " << lineNumber << ".\n");
-
-                    if (token0 == "nm") {
-                        // If there's any mesh data
-                        if (mesh4dIndices.size()) {
-                            // Finish previous mesh
-                            meshes.push_back(new DynamicMesh(mesh4dVertices, mesh4dIndices));
-                            mesh4dVertices.clear();
-                            mesh4dIndices.clear();
-                        }
-                    } else if (token0 == "pt") {
-                        line >> type;
-
-                        if (type == "Custom") {
-                            Index vertexCount;
-                            line >> customTetrahedronCount >> vertexCount;
-                            bool failedToReadCounts = !line;
-
-                            std::string oldCustomName = customName;
-                            line >> customName;
-
-                            if (!line) {
-                                customName = Custom;
-                                if (oldCustomName != customName) {
-                                    if (failedToReadCounts) LogError("No tetrahedron count or vertex count specified on line " << lineNumber << ".\n");
-
-                                    currentCustomPrimitive = customPrimitive;
-                                    currentCustomPrimitive->indices.clear();
-                                    currentCustomPrimitive->indices.reserve(customTetrahedronCount * 4);
-                                    currentCustomPrimitive->vertexCount = vertexCount;
-                                }
-                            } else if (primitives.find(customName) == primitives.end()) {
-                                primitives[customName] = Primitive();
-                                currentCustomPrimitive = &primitives[customName];
+// The primitives every model can use without defining them, "pt" looks them up by name
+// They're compile time constants so loading a model never has to put them in a map
+struct BuiltinPrimitive {
+    std::string_view name;
+    const Index* indices;
+    Index indexCount;
+    Index vertexCount;
+};
+
+#define AddPrimitive(indices, vertexCount) BuiltinPrimitive{ #indices, indices, sizeof(indices) / sizeof(Index), vertexCount }
+static constexpr BuiltinPrimitive builtinPrimitives[] = {
+    AddPrimitive(Tetrahedron,       4),
+    AddPrimitive(Hexahedron,        8),
+    AddPrimitive(Octahedron,        6),
+    AddPrimitive(Dodecahedron,     20),
+    AddPrimitive(Icosahedron,      12),
+    AddPrimitive(TriangularPrism,   6),
+    AddPrimitive(PentagonalPrism,  10),
+    AddPrimitive(TetragonalPyramid, 5),
+    AddPrimitive(PentagonalPyramid, 6)
+};
+#undef AddPrimitive
+
+static const BuiltinPrimitive* findBuiltinPrimitive(std::string_view name) {
+    for (const auto& primitive : builtinPrimitives) {
+        if (primitive.name == name)
+            return &primitive;
+    }
+    return nullptr;
+}
+
+// Reads the whitespace separated tokens and numbers of a line in place, the same way
+// a std::stringstream of the line would: once a read fails, every read after it fails too
+class LineReader {
+public:
+    LineReader(const char* begin, const char* end) : position(begin), end(end) {}
+
+    explicit operator bool() const { return !failed; }
+    bool operator!() const { return failed; }
+
+    LineReader& operator>>(std::string_view& token) {
+        skipWhitespace();
+        if (failed || position == end) {
+            failed = true;
+            return *this;
+        }
+        const char* begin = position;
+        while (position != end && !isWhitespace(*position))
+            position++;
+        token = std::string_view(begin, position - begin);
+        return *this;
+    }
+
+    LineReader& operator>>(std::string& token) {
+        std::string_view view;
+        if (*this >> view)
+            token.assign(view);
+        return *this;
+    }
+
+    // Like a stream, a number ends at the first character that can't be part of it
+    // and a number that fails to parse is set to 0
+    template<typename T>
+    LineReader& operator>>(T& number) {
+        skipWhitespace();
+        if (failed || position == end) {
+            failed = true;
+            return *this;
+        }
+        // std::from_chars doesn't allow an explicit plus sign
+        const char* begin = position;
+        if (*begin == '+' && begin + 1 != end && *(begin + 1) != '-')
+            begin++;
+        auto [next, error] = std::from_chars(begin, end, number);
+        if (error != std::errc()) {
+            number = T();
+            failed = true;
+            return *this;
+        }
+        position = next;
+        return *this;
+    }
+
+private:
+    static bool isWhitespace(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f' || c == '\n';
+    }
+
+    void skipWhitespace() {
+        while (position != end && isWhitespace(*position))
+            position++;
+    }
+
+    const char* position;
+    const char* end;
+    bool failed = false;
+};
+
+Node* ModelLoader::parse_model(const char* fileData, size_t fileSize) {
+    const char* fileEnd = fileData + fileSize;
+
+    std::vector<AbstractMesh*> meshes;
+    std::vector<Index> mesh4dIndices;
+    std::vector<Vertex> mesh4dVertices;
+
+    // Custom primitives with a name, built in primitives are never in here
+    std::unordered_map<std::string, Primitive> primitives;
+
+    const std::string Custom = "Custom";
+    std::string type = "Tetrahedron";
+    // The primitive of type unless type is Custom, which uses currentCustomPrimitive
+    const Index* typeIndices = Tetrahedron;
+    Index typeIndexCount = sizeof(Tetrahedron) / sizeof(Index);
+    Index typeVertexCount = 4;
+    size_t lineNumber = 1;
+
+    // Stuff to do with custom primitives
+    std::string customName;
+    Index customTetrahedronCount = 0;
+    // This primitive's data is overriden
+    // every time the file contains a
+    // nameless custom primitive
+    Primitive customPrimitiveData;
+    Primitive* const customPrimitive = &customPrimitiveData;
+    Primitive* currentCustomPrimitive = customPrimitive;
+
+    // Reused by every face
+    std::vector<Index> faceIndices;
+
+    // Progress is only reported (and cancelling checked) every percent of the file
+    const size_t progressStep = std::max(fileSize / 100, (size_t)1);
+    const char* nextProgress = fileData + progressStep;
+
+    try {
+        for (const char* lineBegin = fileData;;) {
+            const char* lineEnd = static_cast<const char*>(std::memchr(lineBegin, '\n', fileEnd - lineBegin));
+            if (!lineEnd)
+                lineEnd = fileEnd;
 
+            if (lineBegin >= nextProgress) {
+                if (cancelled) {
+                    for (auto mesh : meshes)
+                        delete mesh;
+                    return nullptr;
+                }
+                emit load_progress((float)(lineBegin - fileData) / fileSize);
+                nextProgress = lineBegin + progressStep;
+            }
+
+            // Remove comments
+            const char* commentBegin = static_cast<const char*>(std::memchr(lineBegin, '#', lineEnd - lineBegin));
+            LineReader line(lineBegin, commentBegin ? commentBegin : lineEnd);
+
+            // Get the first token, lines without any are skipped
+            std::string_view token0;
+            if (line >> token0) {
+                if (customTetrahedronCount && token0 != "ci")
+                    LogError("Incomplete custom type definition on line " << lineNumber << ".\n");
+
+                if (token0 == "nm") {
+                    // If there's any mesh data
+                    if (mesh4dIndices.size()) {
+                        // Finish previous mesh
+                        meshes.push_back(new DynamicMesh(mesh4dVertices, mesh4dIndices));
+                        mesh4dVertices.clear();
+                        mesh4dIndices.clear();
+                    }
+                } else if (token0 == "pt") {
+                    line >> type;
+
+                    if (type == "Custom") {
+                        Index vertexCount = 0;
+                        line >> customTetrahedronCount >> vertexCount;
+                        bool failedToReadCounts = !line;
+
+                        std::string oldCustomName = customName;
+                        line >> customName;
+
+                        if (!line) {
+                            customName = Custom;
+                            if (oldCustomName != customName) {
+                                if (failedToReadCounts) LogError("No tetrahedron count or vertex count specified on line " << lineNumber << ".\n");
+
+                                currentCustomPrimitive = customPrimitive;
+                                currentCustomPrimitive->indices.clear();
                                 currentCustomPrimitive->indices.reserve(customTetrahedronCount * 4);
                                 currentCustomPrimitive->vertexCount = vertexCount;
                             }
-                            else
-                                LogError("Redeclared or reference to undeclared primitive \"" << customName << "\" on line " << lineNumber << ".\n");
+                        } else if (customName != Custom && !findBuiltinPrimitive(customName) && primitives.find(customName) == primitives.end()) {
+                            currentCustomPrimitive = &primitives[customName];
+
+                            currentCustomPrimitive->indices.reserve(customTetrahedronCount * 4);
+                            currentCustomPrimitive->vertexCount = vertexCount;
                         }
+                        else
+                            LogError("Redeclared or reference to undeclared primitive \"" << customName << "\" on line " << lineNumber << ".\n");
+                    } else if (const BuiltinPrimitive* builtin = findBuiltinPrimitive(type)) {
+                        typeIndices = builtin->indices;
+                        typeIndexCount = builtin->indexCount;
+                        typeVertexCount = builtin->vertexCount;
+                    } else {
+                        auto primitive = primitives.find(type);
                         // If the type was not found
-                        else if (primitives.find(type) == primitives.end())
+                        if (primitive == primitives.end())
                             LogError("Unknown primitive type: \"" << type << "\" on line " << lineNumber << ".\n");
-                    } else if (token0 == "ci") {
-                        // This is the "Custom Index" command
-                        // This supplies the parser with a custom index
-
-                        if (type != Custom)
-                            LogError("Cannot use ci for non-custom primitives on line " << lineNumber << ".\n");
-
-                        Index i0, i1, i2, i3;
-                        line >> i0 >> i1 >> i2 >> i3;
-                        currentCustomPrimitive->indices.push_back(i0 - 1);
-                        currentCustomPrimitive->indices.push_back(i1 - 1);
-                        currentCustomPrimitive->indices.push_back(i2 - 1);
-                        currentCustomPrimitive->indices.push_back(i3 - 1);
-
-                        customTetrahedronCount--;
-
-                        if ((int)customTetrahedronCount < 0)
-                            LogError("Too many custom indices on line " << lineNumber << ".\n");
-                    } else if (token0 == "v") {
-                        // Move the indices into the vector
-                        glm::vec4 vertex;
-                        line >> vertex.x;
-                        line >> vertex.y;
-                        line >> vertex.z;
-                        line >> vertex.w;
-
-                        // If there was an error converting from strings to vertices
-                        if (!line) LogError("Failed to parse vertex data on line " << lineNumber << ".\n");
-
-                        // Add the vertex to the mesh's vertices
-                        mesh4dVertices.emplace_back(vertex);
+                        typeIndices = primitive->second.indices.data();
+                        typeIndexCount = (Index)primitive->second.indices.size();
+                        typeVertexCount = primitive->second.vertexCount;
                     }
-                    else if (token0 == "f") {
-                        if (type == Custom && !currentCustomPrimitive->indices.size())
-                            LogError("No custom primitive data set on line " << lineNumber << ".\n");
-
-                        // Create a vector with a size equal to the
-                        // number of indices in this mesh's faces
-                        Index indexCount = (type == Custom ? *currentCustomPrimitive : primitives[type]).vertexCount;
-                        std::vector<Index> faceIndices(indexCount);
-
-                        // Move the indices into the vector
-                        for (auto& index : faceIndices)
-                            line >> index;
-
-                        // If there was an error converting from strings to indices
-                        if (!line) LogError("Failed to parse indices on line " << lineNumber << ".\n");
-
-                        // Handle the custom primitive case
-                        if (type == Custom) {
-                            for (Index i = 0; i < currentCustomPrimitive->indices.size(); i++)
-                                mesh4dIndices.push_back(faceIndices[currentCustomPrimitive->indices[i]] - 1);
-                        } else {
-                            // Tetrahedralize the primitive
-                            const auto& indices = primitives[type].indices;
-                            for (Index i = 0; i < indices.size(); i++)
-                                mesh4dIndices.push_back(faceIndices[indices[i]] - 1);
-                        }
-                    } else
-                        LogError("Unknown command: \"" << token0 << "\" on line " << lineNumber << ".\n");
+                } else if (token0 == "ci") {
+                    // This is the "Custom Index" command
+                    // This supplies the parser with a custom index
+
+                    if (type != Custom)
+                        LogError("Cannot use ci for non-custom primitives on line " << lineNumber << ".\n");
+
+                    Index i0 = 0, i1 = 0, i2 = 0, i3 = 0;
+                    line >> i0 >> i1 >> i2 >> i3;
+                    currentCustomPrimitive->indices.push_back(i0 - 1);
+                    currentCustomPrimitive->indices.push_back(i1 - 1);
+                    currentCustomPrimitive->indices.push_back(i2 - 1);
+                    currentCustomPrimitive->indices.push_back(i3 - 1);
+
+                    customTetrahedronCount--;
+
+                    if ((int)customTetrahedronCount < 0)
+                        LogError("Too many custom indices on line " << lineNumber << ".\n");
+                } else if (token0 == "v") {
+                    // Move the indices into the vector
+                    glm::vec4 vertex;
+                    line >> vertex.x;
+                    line >> vertex.y;
+                    line >> vertex.z;
+                    line >> vertex.w;
+
+                    // If there was an error converting from strings to vertices
+                    if (!line) LogError("Failed to parse vertex data on line " << lineNumber << ".\n");
+
+                    // Add the vertex to the mesh's vertices
+                    mesh4dVertices.emplace_back(vertex);
                 }
+                else if (token0 == "f") {
+                    if (type == Custom && !currentCustomPrimitive->indices.size())
+                        LogError("No custom primitive data set on line " << lineNumber << ".\n");
+
+                    // Resize the face's indices to the
+                    // number of indices in this mesh's faces
+                    const Index* indices = type == Custom ? currentCustomPrimitive->indices.data() : typeIndices;
+                    Index indexCount = type == Custom ? (Index)currentCustomPrimitive->indices.size() : typeIndexCount;
+                    faceIndices.resize(type == Custom ? currentCustomPrimitive->vertexCount : typeVertexCount);
+
+                    // Move the indices into the vector
+                    for (auto& index : faceIndices)
+                        line >> index;
+
+                    // If there was an error converting from strings to indices
+                    if (!line) LogError("Failed to parse indices on line " << lineNumber << ".\n");
 
-                lineNumber++;
+                    // Tetrahedralize the primitive
+                    for (Index i = 0; i < indexCount; i++)
+                        mesh4dIndices.push_back(faceIndices[indices[i]] - 1);
+                } else
+                    LogError("Unknown command: \"" << token0 << "\" on line " << lineNumber << ".\n");
             }
 
-            file.close();
-            meshes.push_back(new DynamicMesh(mesh4dVertices, mesh4dIndices));
-            return new Node(meshes, this);
-        } catch (...) {
-            file.close();
-            LogError("Failed parsing on line " << lineNumber << ".\n");
+            lineNumber++;
+            if (lineEnd == fileEnd)
+                break;
+            lineBegin = lineEnd + 1;
         }
+
+        meshes.push_back(new DynamicMesh(mesh4dVertices, mesh4dIndices));
+        return new Node(meshes, this);
+    } catch (...) {
+        LogError("Failed parsing on line " << lineNumber << ".\n");
     }
+}
 
-    // The file was not found
-    return nullptr;
+// Bumped every time the layout of a binary cache or the built in primitives change, so older caches are rewritten instead of misread
+// 2: the duplicate and overlapping tetrahedra of Dodecahedron and PentagonalPrism were removed
+static constexpr uint32_t binary_cache_version = 2;
+static constexpr char binaryCacheMagic[4] = { 'O', 'B', '4', 'B' };
+// Written in the cache's byte order so a cache written on a machine with a different one is never read
+static constexpr uint32_t binaryCacheByteOrder = 0x01020304;
+static constexpr uint32_t binaryCacheQuantized = 1;
+
+// A binary cache is the header, a table with an entry for every mesh, and then each mesh's positions and
+// indices starting at 16 byte aligned offsets. Everything is stored in the byte order of the machine that wrote it
+struct BinaryCacheHeader {
+                                // Size  // Offset
+    char magic[4];              // 4     // 0
+    uint32_t version;           // 4     // 4
+    uint32_t byte_order;        // 4     // 8
+    uint32_t flags;             // 4     // 12
+    // The model the cache was written from
+    int64_t source_size;        // 8     // 16
+    int64_t source_modified;    // 8     // 24  (milliseconds since the epoch)
+    uint64_t source_hash;       // 8     // 32
+    uint32_t nr_meshes;         // 4     // 40
+    uint32_t padding;           // 4     // 44
+    // Total Size: 48
+};
+
+struct BinaryCacheMesh {
+                                // Size  // Offset
+    // From the start of the cache, positions are vec4s or, when the cache is quantized,
+    // 4 uint16s in the range of the mesh's bounds
+    uint64_t positions_offset;  // 8     // 0
+    uint64_t nr_vertices;       // 8     // 8
+    uint64_t indices_offset;    // 8     // 16
+    uint64_t nr_indices;        // 8     // 24
+    glm::vec4 min;              // 16    // 32
+    glm::vec4 max;              // 16    // 48
+    // Total Size: 64
+};
+
+static_assert(sizeof(BinaryCacheHeader) == 48, "The binary cache header must be 48 bytes");
+static_assert(sizeof(BinaryCacheMesh) == 64, "A binary cache mesh must be 64 bytes");
+
+static constexpr uint64_t alignBinaryCacheOffset(uint64_t offset) {
+    return (offset + 15) & ~uint64_t(15);
+}
+
+// 64 bit FNV-1a over 8 bytes at a time, which is all a cache needs to notice a model changed
+static uint64_t hashBytes(const char* data, size_t size) {
+    uint64_t hash = 14695981039346656037ull;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    for (; i < size; i++)
+        hash = (hash ^ (unsigned char)data[i]) * 1099511628211ull;
+    return hash;
+}
+
+Node* ModelLoader::load_model(const char* file_path) {
+    cancelled = false;
+
+    // Try to open the file
+    QFile file(QString::fromLocal8Bit(file_path));
+    if (!file.open(QIODevice::ReadOnly)) {
+        qDebug() << "Failed to open file: " << file_path;
+        return nullptr;
+    }
+
+    // The file is parsed straight from its memory map without copying it
+    // Files that can't be mapped (and empty files, which can't be either) are read instead
+    size_t fileSize = (size_t)file.size();
+    const char* fileData = reinterpret_cast<const char*>(file.map(0, file.size()));
+    QByteArray fileContents;
+    if (!fileData) {
+        fileContents = file.readAll();
+        fileData = fileContents.constData();
+        fileSize = (size_t)fileContents.size();
+    }
+
+    if (!binary_cache_enabled) {
+        Node* model = parse_model(fileData, fileSize);
+        file.close();
+        return model;
+    }
+
+    QString cachePath = get_cache_path(file.fileName());
+    qint64 fileModified = QFileInfo(file).lastModified().toMSecsSinceEpoch();
+    Node* model = load_binary_cache(cachePath, (qint64)fileSize, fileModified, fileData);
+    if (!model) {
+        model = parse_model(fileData, fileSize);
+        if (model)
+            save_binary_cache(cachePath, model, (qint64)fileSize, fileModified, fileData);
+    }
+    file.close();
+    return model;
+}
+
+void ModelLoader::cancel() {
+    cancelled = true;
+}
+
+void ModelLoader::set_binary_cache_enabled(bool enabled) {
+    binary_cache_enabled = enabled;
+}
+
+bool ModelLoader::is_binary_cache_enabled() const {
+    return binary_cache_enabled;
+}
+
+void ModelLoader::set_cache_directory(const QString& directory) {
+    cache_directory = directory;
+}
+
+QString ModelLoader::get_cache_directory() const {
+    return cache_directory;
+}
+
+void ModelLoader::set_quantize_binary_cache(bool quantize) {
+    quantize_binary_cache = quantize;
+}
+
+bool ModelLoader::get_quantize_binary_cache() const {
+    return quantize_binary_cache;
+}
+
+QString ModelLoader::get_cache_path(const QString& model_path) const {
+    if (cache_directory.isEmpty())
+        return model_path + "b";
+
+    // Models with the same name in different directories mustn't share a cache
+    QFileInfo modelInfo(model_path);
+    QByteArray absolutePath = modelInfo.absoluteFilePath().toUtf8();
+    uint64_t pathHash = hashBytes(absolutePath.constData(), (size_t)absolutePath.size());
+    QString cacheName = modelInfo.completeBaseName() + "-" + QString::number(pathHash, 16) + ".ob4b";
+    return QDir(cache_directory).filePath(cacheName);
+}
+
+Node* ModelLoader::load_binary_cache(const QString& cache_path, qint64 source_size, qint64 source_modified, const char* source_data) {
+    QFile cache(cache_path);
+    if (!cache.open(QIODevice::ReadOnly))
+        return nullptr;
+    const uint64_t cacheSize = (uint64_t)cache.size();
+    if (cacheSize < sizeof(BinaryCacheHeader))
+        return nullptr;
+    const char* cacheData = reinterpret_cast<const char*>(cache.map(0, cache.size()));
+    if (!cacheData)
+        return nullptr;
+
+    BinaryCacheHeader header;
+    std::memcpy(&header, cacheData, sizeof(header));
+    const bool quantized = header.flags & binaryCacheQuantized;
+    if (std::memcmp(header.magic, binaryCacheMagic, sizeof(binaryCacheMagic)) ||
+        header.version != binary_cache_version ||
+        header.byte_order != binaryCacheByteOrder ||
+        quantized != quantize_binary_cache ||
+        header.source_size != source_size)
+        return nullptr;
+
+    // A model that was only touched (copied, checked out again) still has the same contents
+    const bool sourceTouched = header.source_modified != source_modified;
+    if (sourceTouched && header.source_hash != hashBytes(source_data, (size_t)source_size))
+        return nullptr;
+
+    if (header.nr_meshes > (cacheSize - sizeof(BinaryCacheHeader)) / sizeof(BinaryCacheMesh))
+        return nullptr;
+    const size_t positionSize = quantized ? 4 * sizeof(uint16_t) : sizeof(glm::vec4);
+
+    std::vector<AbstractMesh*> meshes;
+    std::vector<Vertex> vertices;
+    std::vector<Index> indices;
+    for (uint32_t i = 0; i < header.nr_meshes; i++) {
+        BinaryCacheMesh mesh;
+        std::memcpy(&mesh, cacheData + sizeof(BinaryCacheHeader) + i * sizeof(BinaryCacheMesh), sizeof(mesh));
+
+        // A cache that doesn't hold all of its meshes' data or whole tetrahedra is as good as not having one
+        if (mesh.positions_offset > cacheSize || mesh.nr_vertices > (cacheSize - mesh.positions_offset) / positionSize ||
+            mesh.indices_offset > cacheSize || mesh.nr_indices > (cacheSize - mesh.indices_offset) / sizeof(Index) ||
+            mesh.nr_indices % 4) {
+            for (auto mesh : meshes)
+                delete mesh;
+            return nullptr;
+        }
+
+        vertices.clear();
+        vertices.reserve(mesh.nr_vertices);
+        const char* positions = cacheData + mesh.positions_offset;
+        if (quantized) {
+            const glm::vec4 scale = (mesh.max - mesh.min) / 65535.0f;
+            for (uint64_t j = 0; j < mesh.nr_vertices; j++) {
+                uint16_t position[4];
+                std::memcpy(position, positions + j * positionSize, sizeof(position));
+                vertices.emplace_back(mesh.min + glm::vec4(position[0], position[1], position[2], position[3]) * scale);
+            }
+        } else {
+            for (uint64_t j = 0; j < mesh.nr_vertices; j++) {
+                glm::vec4 position;
+                std::memcpy(&position, positions + j * positionSize, sizeof(position));
+                vertices.emplace_back(position);
+            }
+        }
+
+        indices.resize(mesh.nr_indices);
+        std::memcpy(indices.data(), cacheData + mesh.indices_offset, mesh.nr_indices * sizeof(Index));
+        // Nor is a corrupt or edited one, which would have slicing read past the mesh's vertices
+        if (std::any_of(indices.begin(), indices.end(), [&](Index index) { return index >= mesh.nr_vertices; })) {
+            for (auto mesh : meshes)
+                delete mesh;
+            return nullptr;
+        }
+
+        meshes.push_back(new DynamicMesh(vertices, indices));
+    }
+    cache.close();
+
+    // Remember the new modification time so the model isn't hashed again next time
+    if (sourceTouched) {
+        header.source_modified = source_modified;
+        if (cache.open(QIODevice::ReadWrite))
+            cache.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+
+    return new Node(meshes, this);
+}
+
+void ModelLoader::save_binary_cache(const QString& cache_path, const Node* model, qint64 source_size, qint64 source_modified, const char* source_data) {
+    const size_t positionSize = quantize_binary_cache ? 4 * sizeof(uint16_t) : sizeof(glm::vec4);
+
+    BinaryCacheHeader header = {};
+    std::memcpy(header.magic, binaryCacheMagic, sizeof(binaryCacheMagic));
+    header.version = binary_cache_version;
+    header.byte_order = binaryCacheByteOrder;
+    header.flags = quantize_binary_cache ? binaryCacheQuantized : 0;
+    header.source_size = source_size;
+    header.source_modified = source_modified;
+    header.source_hash = hashBytes(source_data, (size_t)source_size);
+    header.nr_meshes = (uint32_t)model->meshes.size();
+
+    std::vector<BinaryCacheMesh> meshes(model->meshes.size());
+    uint64_t cacheSize = alignBinaryCacheOffset(sizeof(BinaryCacheHeader) + meshes.size() * sizeof(BinaryCacheMesh));
+    for (size_t i = 0; i < meshes.size(); i++) {
+        const AbstractMesh* mesh4d = model->meshes[i];
+        BinaryCacheMesh& mesh = meshes[i];
+        mesh.nr_vertices = mesh4d->size_vertices();
+        mesh.nr_indices = mesh4d->size_indices();
+        mesh.positions_offset = cacheSize;
+        cacheSize = alignBinaryCacheOffset(cacheSize + mesh.nr_vertices * positionSize);
+        mesh.indices_offset = cacheSize;
+        cacheSize = alignBinaryCacheOffset(cacheSize + mesh.nr_indices * sizeof(Index));
+
+        mesh.min = mesh.max = mesh.nr_vertices ? mesh4d->get_vertices()[0].position : glm::vec4(0.0f);
+        for (size_t j = 0; j < mesh.nr_vertices; j++) {
+            mesh.min = glm::min(mesh.min, mesh4d->get_vertices()[j].position);
+            mesh.max = glm::max(mesh.max, mesh4d->get_vertices()[j].position);
+        }
+    }
+
+    std::vector<char> cacheData(cacheSize, 0);
+    std::memcpy(cacheData.data(), &header, sizeof(header));
+    std::memcpy(cacheData.data() + sizeof(header), meshes.data(), meshes.size() * sizeof(BinaryCacheMesh));
+    for (size_t i = 0; i < meshes.size(); i++) {
+        const AbstractMesh* mesh4d = model->meshes[i];
+        const BinaryCacheMesh& mesh = meshes[i];
+        char* positions = cacheData.data() + mesh.positions_offset;
+        if (quantize_binary_cache) {
+            const glm::vec4 extent = mesh.max - mesh.min;
+            for (size_t j = 0; j < mesh.nr_vertices; j++) {
+                uint16_t position[4];
+                for (int k = 0; k < 4; k++) {
+                    float t = extent[k] > 0.0f ? (mesh4d->get_vertices()[j].position[k] - mesh.min[k]) / extent[k] : 0.0f;
+                    position[k] = (uint16_t)std::lround(glm::clamp(t, 0.0f, 1.0f) * 65535.0f);
+                }
+                std::memcpy(positions + j * positionSize, position, sizeof(position));
+            }
+        } else {
+            for (size_t j = 0; j < mesh.nr_vertices; j++)
+                std::memcpy(positions + j * positionSize, &mesh4d->get_vertices()[j].position, sizeof(glm::vec4));
+        }
+        std::memcpy(cacheData.data() + mesh.indices_offset, mesh4d->get_indices(), mesh.nr_indices * sizeof(Index));
+    }
+
+    // A failed or interrupted write leaves the old cache (if any) as it was
+    if (!cache_directory.isEmpty())
+        QDir().mkpath(cache_directory);
+    QSaveFile cache(cache_path);
+    if (!cache.open(QIODevice::WriteOnly) ||
+        cache.write(cacheData.data(), (qint64)cacheData.size()) != (qint64)cacheData.size() ||
+        !cache.commit())
+        qDebug() << "Failed to write binary cache: " << cache_path;
 }
@@ -2,6 +2,8 @@
 #define MODEL_LOADER_4D_HPP
 
 #include <QObject>
+#include <QString>
+#include <atomic>
 #include "objects/Node.hpp"
 #include "ModelLoaderData.hpp"
 
@@ -22,10 +24,46 @@ struct Primitive {
 class ModelLoader : public QObject {
     Q_OBJECT;
 public:
-    ModelLoader(QObject* parent=nullptr) : QObject(parent) {}
+    ModelLoader(QObject* parent=nullptr) : QObject(parent), binary_cache_enabled(true), quantize_binary_cache(false), cancelled(false) {}
     virtual ~ModelLoader() {}
 
+    // Loads an .ob4 model, from its binary cache when it has an up to date one
     Node* load_model(const char* file_path);
+    // Makes a load_model running on another thread stop parsing and return nullptr as soon as it can
+    // Safe to call from any thread, only a load that has already started is cancelled
+    void cancel();
+
+    // When enabled (the default), every model parsed from its .ob4 is also written to a binary .ob4b
+    // with its primitives already expanded into tetrahedra, which later loads map instead of parsing the text
+    // A cache is out of date once its model's size and modification time and then contents are different
+    void set_binary_cache_enabled(bool enabled);
+    bool is_binary_cache_enabled() const;
+    // Where the caches are written, an empty directory (the default) puts each one next to its model
+    void set_cache_directory(const QString& directory);
+    QString get_cache_directory() const;
+    // When true, caches are written with 16 bit fixed point positions relative to each mesh's bounds,
+    // which halves their positions but moves vertices by about 1/131070 of their mesh's bounds at most
+    void set_quantize_binary_cache(bool quantize);
+    bool get_quantize_binary_cache() const;
+
+signals:
+    // Emitted (on the thread loading) every percent of an .ob4 that's parsed, with how much of it has been
+    void load_progress(float fraction);
+
+private:
+    // Parses the text of an .ob4, returns nullptr (after printing why) if it's invalid or nullptr if the load was cancelled
+    Node* parse_model(const char* data, size_t size);
+
+    QString get_cache_path(const QString& model_path) const;
+    // Returns nullptr if the cache doesn't exist, is out of date or isn't valid
+    // source_data is only read (and hashed) when the source's modification time changed
+    Node* load_binary_cache(const QString& cache_path, qint64 source_size, qint64 source_modified, const char* source_data);
+    void save_binary_cache(const QString& cache_path, const Node* model, qint64 source_size, qint64 source_modified, const char* source_data);
+
+    bool binary_cache_enabled;
+    bool quantize_binary_cache;
+    QString cache_directory;
+    std::atomic<bool> cancelled;
 };
 
 #endif
@@ -63,14 +63,12 @@ constexpr Index Dodecahedron[]
      7, 11, 15, 19,
      6,  9, 15, 18,
      1,  4,  9, 15,
-     4,  6,  9, 15,
      4, 15, 18, 19,
      4,  9, 15, 18,
      1,  4,  5, 12,
      4,  5, 12, 13,
      1, 11, 15, 19,
      1,  4, 15, 19,
-     1,  4, 15, 19,
      1,  5, 10, 11,
      1,  5, 11, 19,
      1,  4,  5, 19
@@ -123,8 +121,7 @@ constexpr Index PentagonalPrism[]
      1,  3,  7,  9,
      0,  1,  3,  9,
      0,  1,  5,  9,
-     1,  5,  6,  9,
-     1,  3,  7,  9
+     1,  5,  6,  9
 };
 
 // ----------------------------- Pyramids ---------------------------- //
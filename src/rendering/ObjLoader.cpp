@@ -0,0 +1,507 @@
+#include "ObjLoader.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include "Texture.hpp"
+#include "objects/DynamicMesh.hpp"
+#include "objects/StaticVectorMesh.hpp"
+
+// A corner of a face, which is welded into a vertex
+struct ObjCorner {
+    // The 0 based indices of its position, texture coordinates and normal
+    // Indices that were negative in the file are relative to the start of the corner's chunk until they're resolved
+    int32_t indices[3];
+    // Bit i is set if indices[i] was given / is relative to its chunk
+    unsigned char given;
+    unsigned char relative;
+};
+
+// The lines of the file a thread parses
+struct ObjChunk {
+    const char* begin;
+    const char* end;
+
+    std::vector<glm::vec4> positions;
+    std::vector<glm::vec2> tex_coords;
+    std::vector<glm::vec4> normals;
+    // 3 for every triangle
+    std::vector<ObjCorner> corners;
+    // The corners from the first of each pair onwards use the material named by the second
+    std::vector<std::pair<size_t, std::string>> material_changes;
+    std::vector<std::string> material_libraries;
+
+    size_t nr_lines = 0;
+    // Parsing stops at the first error, its line is counted from the start of the chunk
+    std::string error;
+    size_t error_line = 0;
+};
+
+// The corners of every face that uses a material, in the order of the file
+struct ObjMeshCorners {
+    std::string material;
+    std::vector<std::pair<const ObjCorner*, const ObjCorner*>> ranges;
+    size_t nr_corners = 0;
+};
+
+static bool is_whitespace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f' || c == '\n';
+}
+
+static void skip_whitespace(const char*& position, const char* end) {
+    while (position != end && is_whitespace(*position))
+        position++;
+}
+
+// Returns an empty token at the end of the line
+static std::string_view read_token(const char*& position, const char* end) {
+    skip_whitespace(position, end);
+    const char* begin = position;
+    while (position != end && !is_whitespace(*position))
+        position++;
+    return std::string_view(begin, position - begin);
+}
+
+template<typename T>
+static bool read_number(const char*& position, const char* end, T& number) {
+    skip_whitespace(position, end);
+    // std::from_chars doesn't allow an explicit plus sign
+    if (position != end && *position == '+')
+        position++;
+    auto [next, error] = std::from_chars(position, end, number);
+    if (error != std::errc() || (next != end && !is_whitespace(*next)))
+        return false;
+    position = next;
+    return true;
+}
+
+// Reads a corner of a face: v, v/vt, v//vn or v/vt/vn
+static bool read_corner(const char*& position, const char* end, const ObjChunk& chunk, ObjCorner& corner) {
+    const size_t counts[3] = { chunk.positions.size(), chunk.tex_coords.size(), chunk.normals.size() };
+    corner = ObjCorner{ { -1, -1, -1 }, 0, 0 };
+    for (int i = 0; i < 3; i++) {
+        if (i > 0) {
+            if (position == end || *position != '/')
+                break;
+            position++;
+            // v//vn has no texture coordinates
+            if (i == 1 && position != end && *position == '/')
+                continue;
+        }
+
+        int64_t index;
+        auto [next, error] = std::from_chars(position, end, index);
+        if (error != std::errc() || index == 0 || index > INT32_MAX || index < INT32_MIN)
+            return false;
+        position = next;
+
+        if (index > 0) {
+            corner.indices[i] = (int32_t)(index - 1);
+        } else {
+            // Relative to the last element read before the face
+            corner.indices[i] = (int32_t)((int64_t)counts[i] + index);
+            corner.relative |= 1 << i;
+        }
+        corner.given |= 1 << i;
+    }
+    return position == end || is_whitespace(*position);
+}
+
+static void parse_chunk(ObjChunk& chunk) {
+    // Reused by every face
+    std::vector<ObjCorner> face;
+
+    size_t line_number = 0;
+    for (const char* line_begin = chunk.begin; line_begin != chunk.end;) {
+        const char* line_end = static_cast<const char*>(std::memchr(line_begin, '\n', chunk.end - line_begin));
+        line_end = line_end ? line_end + 1 : chunk.end;
+        line_number++;
+
+        // Remove comments
+        const char* end = static_cast<const char*>(std::memchr(line_begin, '#', line_end - line_begin));
+        if (!end)
+            end = line_end;
+        const char* position = line_begin;
+
+        std::string_view command = read_token(position, end);
+        const char* error = nullptr;
+        if (command == "v") {
+            // Positions can have a weight after them, which is ignored
+            glm::vec4 vertex(0.0f, 0.0f, 0.0f, 1.0f);
+            if (read_number(position, end, vertex.x) && read_number(position, end, vertex.y) && read_number(position, end, vertex.z))
+                chunk.positions.push_back(vertex);
+            else
+                error = "Failed to parse vertex data";
+        } else if (command == "vt") {
+            // v (and w, which is ignored) are optional
+            glm::vec2 tex_coords(0.0f);
+            bool parsed = read_number(position, end, tex_coords.x);
+            skip_whitespace(position, end);
+            if (parsed && position != end)
+                parsed = read_number(position, end, tex_coords.y);
+            if (parsed)
+                chunk.tex_coords.push_back(tex_coords);
+            else
+                error = "Failed to parse texture coordinates";
+        } else if (command == "vn") {
+            glm::vec4 normal(0.0f, 0.0f, 0.0f, 1.0f);
+            if (read_number(position, end, normal.x) && read_number(position, end, normal.y) && read_number(position, end, normal.z))
+                chunk.normals.push_back(normal);
+            else
+                error = "Failed to parse normal";
+        } else if (command == "f") {
+            face.clear();
+            ObjCorner corner;
+            for (skip_whitespace(position, end); position != end; skip_whitespace(position, end)) {
+                if (!read_corner(position, end, chunk, corner))
+                    break;
+                face.push_back(corner);
+            }
+
+            if (position != end || face.size() < 3) {
+                error = "Failed to parse face";
+            } else {
+                // Triangulate the face as a fan
+                for (size_t i = 1; i + 1 < face.size(); i++) {
+                    chunk.corners.push_back(face[0]);
+                    chunk.corners.push_back(face[i]);
+                    chunk.corners.push_back(face[i + 1]);
+                }
+            }
+        } else if (command == "usemtl") {
+            chunk.material_changes.emplace_back(chunk.corners.size(), std::string(read_token(position, end)));
+        } else if (command == "mtllib") {
+            for (std::string_view library = read_token(position, end); library.size(); library = read_token(position, end))
+                chunk.material_libraries.emplace_back(library);
+        }
+
+        if (error) {
+            chunk.error = error;
+            chunk.error_line = line_number;
+            return;
+        }
+        line_begin = line_end;
+    }
+    chunk.nr_lines = line_number;
+}
+
+// Welds the corners of a mesh into a vertex for every unique combination of position, texture coordinates and normal
+// flat_normals is set if any corner has no normal
+static void weld_corners(const ObjMeshCorners& mesh, const std::vector<glm::vec4>& positions, const std::vector<glm::vec2>& tex_coords,
+                         const std::vector<glm::vec4>& normals, std::vector<Vertex>& vertices, std::vector<Index>& indices, bool& flat_normals) {
+    // The vertices with the same position are chained together, starting from the last one made
+    // Faces mostly use positions close to each other in the file, so looking them up is mostly cache hits
+    // unlike with a hash table, and every position usually only has a few vertices
+    int32_t first_position = INT32_MAX;
+    int32_t last_position = -1;
+    for (const auto& range : mesh.ranges) {
+        for (const ObjCorner* corner = range.first; corner != range.second; corner++) {
+            first_position = std::min(first_position, corner->indices[0]);
+            last_position = std::max(last_position, corner->indices[0]);
+        }
+    }
+    constexpr Index no_vertex = ~Index(0);
+    std::vector<Index> last_vertices(std::max(last_position - first_position + 1, 0), no_vertex);
+    std::vector<Index> previous_vertices;
+    // The texture coordinates and normal indices of every vertex
+    std::vector<std::pair<int32_t, int32_t>> vertex_attributes;
+
+    vertices.clear();
+    indices.clear();
+    indices.reserve(mesh.nr_corners);
+    flat_normals = false;
+    for (const auto& range : mesh.ranges) {
+        for (const ObjCorner* corner = range.first; corner != range.second; corner++) {
+            std::pair<int32_t, int32_t> attributes(corner->indices[1], corner->indices[2]);
+            Index& last_vertex = last_vertices[corner->indices[0] - first_position];
+            Index vertex = last_vertex;
+            while (vertex != no_vertex && vertex_attributes[vertex] != attributes)
+                vertex = previous_vertices[vertex];
+
+            if (vertex == no_vertex) {
+                vertex = (Index)vertices.size();
+                bool has_tex_coords = corner->given & 2;
+                bool has_normal = corner->given & 4;
+                vertices.emplace_back(positions[corner->indices[0]],
+                                      has_normal ? normals[corner->indices[2]] : glm::vec4(0.0f),
+                                      has_tex_coords ? tex_coords[corner->indices[1]] : glm::vec2(0.0f));
+                flat_normals |= !has_normal;
+                previous_vertices.push_back(last_vertex);
+                vertex_attributes.push_back(attributes);
+                last_vertex = vertex;
+            }
+            indices.push_back(vertex);
+        }
+    }
+}
+
+Node* ObjLoader::load_model(const char* file_path, MaterialManager& material_manager, bool dynamic) {
+    QFile file(QString::fromLocal8Bit(file_path));
+    if (!file.open(QIODevice::ReadOnly)) {
+        qDebug() << "Failed to open file: " << file_path;
+        return nullptr;
+    }
+
+    // The chunks are parsed straight from the file's memory map
+    // Files that can't be mapped (and empty files, which can't be either) are read instead
+    size_t file_size = (size_t)file.size();
+    const char* file_data = reinterpret_cast<const char*>(file.map(0, file.size()));
+    QByteArray file_contents;
+    if (!file_data) {
+        file_contents = file.readAll();
+        file_data = file_contents.constData();
+        file_size = (size_t)file_contents.size();
+    }
+    const char* file_end = file_data + file_size;
+
+    // Every chunk ends after a line break (or at the end of the file) so each line is parsed by one thread
+    int nr_chunks = (int)std::clamp(file_size / min_bytes_per_thread, (size_t)1, (size_t)get_nr_threads_used());
+    std::vector<ObjChunk> chunks(nr_chunks);
+    const char* chunk_begin = file_data;
+    for (int i = 0; i < nr_chunks; i++) {
+        const char* chunk_end = file_end;
+        if (i + 1 < nr_chunks) {
+            const char* split = std::max(file_data + file_size * (i + 1) / nr_chunks, chunk_begin);
+            const char* line_break = static_cast<const char*>(std::memchr(split, '\n', file_end - split));
+            if (line_break)
+                chunk_end = line_break + 1;
+        }
+        chunks[i].begin = chunk_begin;
+        chunks[i].end = chunk_end;
+        chunk_begin = chunk_end;
+    }
+    workers->run(nr_chunks, [&](int chunk) {
+        parse_chunk(chunks[chunk]);
+    });
+
+    size_t nr_lines = 0;
+    for (const auto& chunk : chunks) {
+        if (!chunk.error.empty()) {
+            std::cerr << chunk.error << " on line " << nr_lines + chunk.error_line << ".\n";
+            return nullptr;
+        }
+        nr_lines += chunk.nr_lines;
+    }
+
+    // Every chunk's positions, texture coordinates and normals are concatenated, relative indices are made
+    // absolute with where their chunk's start ended up, and every index is checked
+    std::vector<glm::vec4> positions;
+    std::vector<glm::vec2> tex_coords;
+    std::vector<glm::vec4> normals;
+    std::vector<std::array<int64_t, 3>> chunk_offsets(nr_chunks);
+    for (int i = 0; i < nr_chunks; i++) {
+        chunk_offsets[i] = { (int64_t)positions.size(), (int64_t)tex_coords.size(), (int64_t)normals.size() };
+        positions.insert(positions.end(), chunks[i].positions.begin(), chunks[i].positions.end());
+        tex_coords.insert(tex_coords.end(), chunks[i].tex_coords.begin(), chunks[i].tex_coords.end());
+        normals.insert(normals.end(), chunks[i].normals.begin(), chunks[i].normals.end());
+        chunks[i].positions = std::vector<glm::vec4>();
+        chunks[i].tex_coords = std::vector<glm::vec2>();
+        chunks[i].normals = std::vector<glm::vec4>();
+    }
+    const int64_t counts[3] = { (int64_t)positions.size(), (int64_t)tex_coords.size(), (int64_t)normals.size() };
+    std::atomic<bool> out_of_range(false);
+    workers->run(nr_chunks, [&](int chunk) {
+        for (auto& corner : chunks[chunk].corners) {
+            for (int i = 0; i < 3; i++) {
+                if (!(corner.given & (1 << i)))
+                    continue;
+                int64_t index = corner.indices[i];
+                if (corner.relative & (1 << i))
+                    index += chunk_offsets[chunk][i];
+                if (index < 0 || index >= counts[i])
+                    out_of_range = true;
+                else
+                    corner.indices[i] = (int32_t)index;
+            }
+        }
+    });
+    if (out_of_range) {
+        std::cerr << "A face refers to a vertex, texture coordinate or normal that doesn't exist in " << file_path << ".\n";
+        return nullptr;
+    }
+
+    // Group the corners by material, in the order the materials are first used
+    // Faces before the first usemtl use the default material
+    std::vector<ObjMeshCorners> mesh_corners;
+    std::unordered_map<std::string, size_t> material_meshes;
+    std::string material;
+    auto add_corners = [&](const ObjCorner* begin, const ObjCorner* end) {
+        if (begin == end)
+            return;
+        auto mesh = material_meshes.find(material);
+        if (mesh == material_meshes.end()) {
+            mesh = material_meshes.emplace(material, mesh_corners.size()).first;
+            mesh_corners.emplace_back();
+            mesh_corners.back().material = material;
+        }
+        mesh_corners[mesh->second].ranges.emplace_back(begin, end);
+        mesh_corners[mesh->second].nr_corners += end - begin;
+    };
+    for (const auto& chunk : chunks) {
+        const ObjCorner* corners = chunk.corners.data();
+        size_t first_corner = 0;
+        for (const auto& material_change : chunk.material_changes) {
+            add_corners(corners + first_corner, corners + material_change.first);
+            first_corner = material_change.first;
+            material = material_change.second;
+        }
+        add_corners(corners + first_corner, corners + chunk.corners.size());
+    }
+
+    // Each mesh is welded on its own thread
+    size_t nr_meshes = mesh_corners.size();
+    std::vector<std::vector<Vertex>> mesh_vertices(nr_meshes);
+    std::vector<std::vector<Index>> mesh_indices(nr_meshes);
+    std::vector<char> mesh_flat_normals(nr_meshes);
+    std::atomic<size_t> next_mesh(0);
+    workers->run((int)std::clamp(nr_meshes, (size_t)1, (size_t)get_nr_threads_used()), [&](int) {
+        for (size_t i = next_mesh++; i < nr_meshes; i = next_mesh++) {
+            bool flat_normals;
+            weld_corners(mesh_corners[i], positions, tex_coords, normals, mesh_vertices[i], mesh_indices[i], flat_normals);
+            mesh_flat_normals[i] = flat_normals;
+        }
+    });
+
+    // Read every material library the file uses, relative to the file
+    QDir directory = QFileInfo(file.fileName()).path();
+    std::unordered_map<std::string, MaterialDefinition> materials;
+    std::unordered_set<std::string> material_libraries;
+    for (const auto& chunk : chunks) {
+        for (const auto& library : chunk.material_libraries) {
+            if (material_libraries.insert(library).second && !load_material_library(directory.filePath(QString::fromStdString(library)), materials))
+                qWarning() << "Failed to open material library" << QString::fromStdString(library);
+        }
+    }
+    file.close();
+
+    // Textures used by more than one material are only loaded once
+    std::unordered_map<std::string, int> textures;
+    auto load_texture = [&](const QString& path) {
+        if (path.isEmpty())
+            return -1;
+        auto texture = textures.find(path.toStdString());
+        if (texture != textures.end())
+            return texture->second;
+        int texture_index = -1;
+        if (QFile::exists(path)) {
+            Texture* new_texture = new Texture(&material_manager);
+            new_texture->load(path.toLocal8Bit());
+            texture_index = material_manager.add_texture(new_texture);
+        } else {
+            qWarning() << "Failed to find texture" << path;
+        }
+        textures.emplace(path.toStdString(), texture_index);
+        return texture_index;
+    };
+
+    std::vector<AbstractMesh*> meshes;
+    for (size_t i = 0; i < nr_meshes; i++) {
+        AbstractMesh* mesh;
+        if (dynamic)
+            mesh = new DynamicMesh(std::move(mesh_vertices[i]), std::move(mesh_indices[i]));
+        else
+            mesh = new StaticVectorMesh(std::move(mesh_vertices[i]), std::move(mesh_indices[i]));
+        mesh->flat_normals = mesh_flat_normals[i];
+
+        auto definition = materials.find(mesh_corners[i].material);
+        if (definition != materials.end()) {
+            Material material = definition->second.material;
+            material.albedo_ti = load_texture(definition->second.albedo_texture);
+            material.roughness_ti = load_texture(definition->second.roughness_texture);
+            material.metalness_ti = load_texture(definition->second.metalness_texture);
+            mesh->material_index = material_manager.add_material(material);
+        } else if (!mesh_corners[i].material.empty()) {
+            qWarning() << "Unknown material" << QString::fromStdString(mesh_corners[i].material) << "uses the default material";
+        }
+        meshes.push_back(mesh);
+    }
+    return new Node(meshes, this);
+}
+
+bool ObjLoader::load_material_library(const QString& file_path, std::unordered_map<std::string, MaterialDefinition>& materials) {
+    QFile file(file_path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QByteArray contents = file.readAll();
+    const char* data = contents.constData();
+    const char* data_end = data + contents.size();
+    QDir directory = QFileInfo(file_path).path();
+
+    MaterialDefinition* definition = nullptr;
+    // Pr takes precedence over Ns no matter which comes first
+    bool has_roughness = false;
+    for (const char* line_begin = data; line_begin != data_end;) {
+        const char* line_end = static_cast<const char*>(std::memchr(line_begin, '\n', data_end - line_begin));
+        line_end = line_end ? line_end + 1 : data_end;
+        const char* end = static_cast<const char*>(std::memchr(line_begin, '#', line_end - line_begin));
+        if (!end)
+            end = line_end;
+        const char* position = line_begin;
+        std::string_view command = read_token(position, end);
+        line_begin = line_end;
+
+        if (command == "newmtl") {
+            definition = &materials[std::string(read_token(position, end))];
+            *definition = MaterialDefinition();
+            has_roughness = false;
+            continue;
+        }
+        if (!definition || command.empty())
+            continue;
+
+        Material& material = definition->material;
+        float value;
+        if (command == "Kd") {
+            read_number(position, end, material.albedo.r) && read_number(position, end, material.albedo.g) && read_number(position, end, material.albedo.b);
+        } else if (command == "d") {
+            read_number(position, end, material.albedo.a);
+        } else if (command == "Tr") {
+            if (read_number(position, end, value))
+                material.albedo.a = 1.0f - value;
+        } else if (command == "Ns") {
+            // A Blinn-Phong exponent is about 2 / roughness^4 - 2
+            if (read_number(position, end, value) && !has_roughness)
+                material.roughness = std::pow(2.0f / (std::max(value, 0.0f) + 2.0f), 0.25f);
+        } else if (command == "Pr") {
+            has_roughness = read_number(position, end, material.roughness) || has_roughness;
+        } else if (command == "Pm") {
+            read_number(position, end, material.metalness);
+        } else if (command == "map_Kd" || command == "map_Pr" || command == "map_Pm") {
+            // The file name comes after any options
+            std::string_view name;
+            for (std::string_view token = read_token(position, end); token.size(); token = read_token(position, end))
+                name = token;
+            QString path = directory.filePath(QString::fromStdString(std::string(name)));
+            if (command == "map_Kd")
+                definition->albedo_texture = path;
+            else if (command == "map_Pr")
+                definition->roughness_texture = path;
+            else
+                definition->metalness_texture = path;
+        }
+    }
+    return true;
+}
+
+void ObjLoader::set_nr_threads(int nr_threads) {
+    this->nr_threads = std::max(nr_threads, 0);
+    if (!workers || workers->get_nr_threads() != get_nr_threads_used())
+        workers = std::make_unique<WorkerPool>(get_nr_threads_used());
+}
+
+int ObjLoader::get_nr_threads_used() const {
+    if (nr_threads > 0)
+        return nr_threads;
+    return (int)std::max(std::thread::hardware_concurrency(), 1u);
+}
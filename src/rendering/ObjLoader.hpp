@@ -0,0 +1,69 @@
+#ifndef OBJ_LOADER_HPP
+#define OBJ_LOADER_HPP
+
+#include <QObject>
+#include <QString>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include "WorkerPool.hpp"
+#include "objects/Node.hpp"
+#include "objects/Material.hpp"
+#include "objects/MaterialManager.hpp"
+
+/*
+Loads Wavefront OBJ files, meant for big static 3D meshes like environments
+
+The file is mapped and split into chunks at line boundaries which are parsed in parallel, then
+the corners of each material's faces are welded into shared vertices (one for every unique
+position/texture coordinate/normal combination), each material on its own thread
+
+Every material the faces use (with usemtl) gets a mesh of its own, which gets the material with that
+name from the file's material libraries (mtllib) added to the MaterialManager
+Faces with more than 3 corners are triangulated as fans, points, lines, groups, objects and
+smoothing groups are ignored
+*/
+class ObjLoader : public QObject {
+    Q_OBJECT;
+public:
+    ObjLoader(QObject* parent=nullptr) : QObject(parent), nr_threads(0) { set_nr_threads(0); }
+    virtual ~ObjLoader() {}
+
+    // Returns nullptr (after printing why) if the file can't be loaded
+    // The meshes are StaticVectorMeshes, which are only uploaded once, or DynamicMeshes if dynamic is true
+    // Materials with textures load them, which needs the OpenGL context to be current
+    Node* load_model(const char* file_path, MaterialManager& material_manager, bool dynamic=false);
+
+    // How many threads parse and weld, 0 uses one per hardware thread
+    // The threads are started here and kept for every load until the number changes
+    void set_nr_threads(int nr_threads);
+    int get_nr_threads_used() const;
+
+    // How a material library's materials are read into Materials
+    //   Kd              albedo
+    //   d / Tr          albedo's alpha (Tr is 1 - d)
+    //   Ns              roughness, converted from a Blinn-Phong exponent unless Pr is given
+    //   Pr / Pm         roughness / metalness (from the PBR extension)
+    //   map_Kd          albedo texture
+    //   map_Pr / map_Pm roughness / metalness texture
+    // Ks isn't used since the materials are metal/roughness, everything else is ignored
+    struct MaterialDefinition {
+        Material material = Material(glm::vec4(1.0f));
+        // Paths to the textures, resolved against the material library's directory
+        QString albedo_texture;
+        QString roughness_texture;
+        QString metalness_texture;
+    };
+    // Adds the materials of a .mtl to materials (replacing the ones with the same name), returns false if it can't be opened
+    static bool load_material_library(const QString& file_path, std::unordered_map<std::string, MaterialDefinition>& materials);
+
+private:
+    // Files smaller than this are parsed by fewer threads
+    static constexpr size_t min_bytes_per_thread = 1 << 20;
+
+    int nr_threads;
+    // Has get_nr_threads_used threads, parsing and welding run their chunks on it
+    std::unique_ptr<WorkerPool> workers;
+};
+
+#endif
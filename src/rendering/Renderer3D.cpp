@@ -1,5 +1,6 @@
 #include "Renderer3D.hpp"
 #include <QDebug>
+#include <QElapsedTimer>
 #include <glm/gtc/type_ptr.hpp>
 #include <string>
 
@@ -10,6 +11,12 @@ Renderer3D::Renderer3D(QObject* parent) : QObject(parent) {
     surface = nullptr;
     camera = nullptr;
     scene = nullptr;
+    bvh_enabled = true;
+    gpu_bvh_enabled = true;
+    bvh_build_time = 0.0f;
+    bvh_refit_count = 0;
+    bvh_rebuild_count = 0;
+    render_time = 0.0f;
     options = new Renderer3DOptions(this, this);
 }
 
@@ -42,56 +49,47 @@ Texture* Renderer3D::initialize(int width, int height, QOpenGLContext* opengl_co
     direct_illumination.create(width, height);
     indirect_illumination.create(width, height);
 
-    // Setup the vertex shader
-    ShaderStage vert_shader{GL_COMPUTE_SHADER, "src/rendering/shaders/vertex_shader.glsl"};
-
-    vertex_shader.load_shaders(&vert_shader, 1);
-    vertex_shader.validate();
-
-    glGetProgramiv(vertex_shader.get_id(), GL_COMPUTE_WORK_GROUP_SIZE, vertex_shader_work_group_size);
-
     // Set up the SSBOs
-    glGenBuffers(1, &vertex_ssbo);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, vertex_ssbo);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, vertex_ssbo);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, 0, nullptr, GL_DYNAMIC_DRAW);
-    vertex_ssbo_size = 0;
-
-    glGenBuffers(1, &static_vertex_ssbo);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, static_vertex_ssbo);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, static_vertex_ssbo);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, 0, nullptr, GL_STATIC_DRAW);
-    static_vertex_ssbo_size = 0;
-
-    glGenBuffers(1, &static_index_ssbo);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, static_index_ssbo);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, static_index_ssbo);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, 0, nullptr, GL_STATIC_DRAW);
-    static_index_ssbo_size = 0;
-    
-    glGenBuffers(1, &dynamic_vertex_ssbo);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, dynamic_vertex_ssbo);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, dynamic_vertex_ssbo);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, 0, nullptr, GL_DYNAMIC_DRAW);
-    dynamic_vertex_ssbo_size = 0;
-
-    glGenBuffers(1, &dynamic_index_ssbo);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, dynamic_index_ssbo);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, dynamic_index_ssbo);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, 0, nullptr, GL_DYNAMIC_DRAW);
-    dynamic_index_ssbo_size = 0;
+    int static_position_size = quantized_static_positions ? quantized_vertex_position_size_in_opengl : vertex_position_size_in_opengl;
+    static_vertex_heap.initialize({{3, static_position_size}, {18, vertex_attributes_size_in_opengl}});
+    static_triangle_heap.initialize({{1, 3*(int)sizeof(Index)}, {14, (int)sizeof(TriangleRecord)}});
+    static_bvh_heap.initialize({{8, (int)sizeof(BVHNode)}});
+    uploaded_static_meshes.clear();
+    resync_static_meshes = true;
 
     glGenBuffers(1, &mesh_ssbo);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, mesh_ssbo);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, mesh_ssbo);
     glBufferData(GL_SHADER_STORAGE_BUFFER, 0, nullptr, GL_DYNAMIC_DRAW);
     mesh_ssbo_size = 0;
+    mesh_ssbo_capacity = 0;
 
     glGenBuffers(1, &material_ssbo);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, material_ssbo);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, material_ssbo);
     glBufferData(GL_SHADER_STORAGE_BUFFER, 0, nullptr, GL_DYNAMIC_DRAW);
-    material_ssbo_size = 0;
+    material_ssbo_capacity = 0;
+
+    glGenBuffers(1, &tlas_node_ssbo);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, tlas_node_ssbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, tlas_node_ssbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, 0, nullptr, GL_DYNAMIC_DRAW);
+    tlas_node_ssbo_capacity = 0;
+
+    glGenBuffers(1, &tlas_primitive_ssbo);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, tlas_primitive_ssbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, tlas_primitive_ssbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, 0, nullptr, GL_DYNAMIC_DRAW);
+    tlas_primitive_ssbo_capacity = 0;
+
+    // Bound to 2, 4, 9, 15 and 19 every frame (see add_dynamic_meshes_to_buffer)
+    dynamic_stream.initialize();
+
+    gpu_bvh_builder.initialize();
+    gpu_dimension_dropper.initialize();
+
+    glGenQueries(1, &render_time_query);
+    render_time_query_pending = false;
 
     // Initialized to the size of the render_texture for per-pixel mesh index results form render
     glGenBuffers(1, &mesh_indices_ssbo);
@@ -141,15 +139,28 @@ Texture* Renderer3D::render() {
     Q_ASSERT_X(scene, "Renderer3D::render", "Scene must be set before rendering");
     add_meshes_to_buffer();
     add_materials_to_buffer();
-    glUseProgram(vertex_shader.get_id());
-    unsigned int vertex_shader_worksize_x = round_up_to_pow_2(vertex_ssbo_size) / Y_SIZE + 1;
-    unsigned int vertex_shader_worksize_y = Y_SIZE;
-    glDispatchCompute(vertex_shader_worksize_x, vertex_shader_worksize_y, 1);
-    // Make sure the vertex shader has finished writing
-    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    // Read the previous frame's timing result if its ready
+    if (render_time_query_pending) {
+        int available = 0;
+        glGetQueryObjectiv(render_time_query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint64 elapsed_ns;
+            glGetQueryObjectui64v(render_time_query, GL_QUERY_RESULT, &elapsed_ns);
+            render_time = elapsed_ns / 1000000.0f;
+            render_time_query_pending = false;
+        }
+    }
+    bool time_render = !render_time_query_pending;
+    if (time_render) {
+        glBeginQuery(GL_TIME_ELAPSED, render_time_query);
+    }
 
     glUseProgram(render_shader.get_id());
     render_shader.use_subroutine(GL_COMPUTE_SHADER, "realtime_trace");
+    render_shader.set_bool("use_bvh", bvh_enabled);
+    // The mesh buffer can be bigger than the number of meshes
+    render_shader.set_int("nr_meshes", mesh_ssbo_size);
     render_shader.set_vec3("eye", camera->position);
     render_shader.set_vec3("ray00", eye_rays.r00);
     render_shader.set_vec3("ray10", eye_rays.r10);
@@ -171,6 +182,12 @@ Texture* Renderer3D::render() {
     unsigned int worksize_y = round_up_to_pow_2(height);
     glDispatchCompute(worksize_x/work_group_size[0], worksize_y/work_group_size[1], 1);
 
+    if (time_render) {
+        glEndQuery(GL_TIME_ELAPSED);
+        render_time_query_pending = true;
+    }
+    dynamic_stream.fence();
+
     // Clean up & make sure the shader has finished writing to the image
     glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
     glBindImageTexture(1, 0, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
@@ -198,6 +215,8 @@ Texture* Renderer3D::iterative_render() {
     unsigned int worksize_x = round_up_to_pow_2(width);
     unsigned int worksize_y = round_up_to_pow_2(height);
     glDispatchCompute(worksize_x/work_group_size[0], worksize_y/work_group_size[1], 1);
+    // Still reads the dynamic meshes of the last frame rendered with render
+    dynamic_stream.fence();
 
     // Clean up & make sure the shader has finished writing to the image
     glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
@@ -277,133 +296,373 @@ MeshIndex Renderer3D::get_mesh_index_at(int x, int y) {
     return -1;
 }
 
-void Renderer3D::add_meshes_to_buffer() {
-    int nr_static_vertices = scene->get_nr_static_vertices();
-    int nr_static_indices = scene->get_nr_static_indices();
-    int nr_dynamic_vertices = scene->get_nr_dynamic_vertices();
-    int nr_dynamic_indices = scene->get_nr_dynamic_indices();
-
-    bool re_add_static_meshes = scene->static_meshes_modified(true);
-
-    if (nr_static_vertices != static_vertex_ssbo_size) {
-        static_vertex_ssbo_size = nr_static_vertices;
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, static_vertex_ssbo);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, nr_static_vertices*sizeof(Vertex), nullptr, GL_STATIC_DRAW);
-        re_add_static_meshes = true;
-//        qDebug() << "static_vertex_ssbo_size" << static_vertex_ssbo_size;
-    }
-    if (nr_static_indices != static_index_ssbo_size) {
-        static_index_ssbo_size = nr_static_indices;
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, static_index_ssbo);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, nr_static_indices*sizeof(Index), nullptr, GL_STATIC_DRAW);
-        re_add_static_meshes = true;
-//        qDebug() << "static_index_ssbo_size" << static_index_ssbo_size;
-    }
-    if (nr_dynamic_vertices != dynamic_vertex_ssbo_size) {
-        dynamic_vertex_ssbo_size = nr_dynamic_vertices;
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, dynamic_vertex_ssbo);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, nr_dynamic_vertices*sizeof(Vertex), nullptr, GL_DYNAMIC_DRAW);
-//        qDebug() << "dynamic_vertex_ssbo_size" << dynamic_vertex_ssbo_size;
-    }
-    if (nr_dynamic_indices != dynamic_index_ssbo_size) {
-        dynamic_index_ssbo_size = nr_dynamic_indices;
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, dynamic_index_ssbo);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, nr_dynamic_indices*sizeof(Index), nullptr, GL_DYNAMIC_DRAW);
-//        qDebug() << "dynamic_index_ssbo_size" << dynamic_index_ssbo_size;
-    }
-    if(nr_dynamic_vertices+nr_static_vertices != vertex_ssbo_size) {
-        vertex_ssbo_size = nr_dynamic_vertices+nr_static_vertices;
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, vertex_ssbo);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, vertex_ssbo_size*sizeof(Vertex), nullptr, GL_DYNAMIC_DRAW);
-//        qDebug() << "vertex_ssbo_size" << vertex_ssbo_size;
-    }
+void Renderer3D::set_bvh_enabled(bool enabled) {
+    bvh_enabled = enabled;
+}
+
+bool Renderer3D::is_bvh_enabled() const {
+    return bvh_enabled;
+}
+
+void Renderer3D::set_gpu_bvh_enabled(bool enabled) {
+    gpu_bvh_enabled = enabled;
+}
+
+bool Renderer3D::is_gpu_bvh_enabled() const {
+    return gpu_bvh_enabled;
+}
 
+float Renderer3D::get_render_time() const {
+    return render_time;
+}
+
+float Renderer3D::get_bvh_build_time() const {
+    return bvh_build_time;
+}
+
+int Renderer3D::get_bvh_refit_count() const {
+    return bvh_refit_count;
+}
+
+int Renderer3D::get_bvh_rebuild_count() const {
+    return bvh_rebuild_count;
+}
+
+void Renderer3D::add_meshes_to_buffer() {
     const std::vector<AbstractMesh*>& static_meshes = scene->get_static_meshes();
-    if (re_add_static_meshes) {
-        add_mesh_vertices_to_buffer(static_meshes, static_vertex_ssbo);
-        add_mesh_indices_to_buffer(static_meshes, static_index_ssbo);
+    const std::vector<AbstractMesh*>& dynamic_meshes = scene->get_dynamic_meshes();
+
+    QElapsedTimer build_timer;
+    build_timer.start();
+    // Static meshes only build their BVHs once
+    for (auto mesh : static_meshes) {
+        count_bvh_update(mesh->update_bvh());
+    }
+    for (auto mesh : dynamic_meshes) {
+        if (gpu_bvh_enabled) {
+            // Only needed for the TLAS and to quantize the Morton codes
+            mesh->update_bounds();
+        } else {
+            count_bvh_update(mesh->update_bvh());
+        }
     }
 
-    const std::vector<AbstractMesh*>& dynamic_meshes = scene->get_dynamic_meshes();
-    add_mesh_vertices_to_buffer(dynamic_meshes, dynamic_vertex_ssbo, (int)static_meshes.size());
-    add_mesh_indices_to_buffer(dynamic_meshes, dynamic_index_ssbo);
+    add_static_meshes_to_buffer(static_meshes);
+    add_dynamic_meshes_to_buffer(dynamic_meshes, (int)static_meshes.size());
 
     // Send mesh data to shaders
     // Get mesh data into opengl_mesh_data
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mesh_ssbo);
-    if (static_meshes.size()+dynamic_meshes.size() != (unsigned int)mesh_ssbo_size) {
-        mesh_ssbo_size = (int)(static_meshes.size()+dynamic_meshes.size());
+    mesh_ssbo_size = (int)(static_meshes.size()+dynamic_meshes.size());
+    opengl_mesh_data.resize(mesh_ssbo_size*mesh_size_in_opengl, 0);
+    for (auto node : scene->get_root_nodes()) {
+        node->add_mesh_data(opengl_mesh_data);
+    }
+    upload_to_growing_buffer(mesh_ssbo, mesh_ssbo_capacity, opengl_mesh_data.data(), opengl_mesh_data.size());
 
-        opengl_mesh_data.resize(mesh_ssbo_size*mesh_size_in_opengl, 0);
-        for (auto node : scene->get_root_nodes()) {
-            node->add_mesh_data(opengl_mesh_data);
+    // Must happen after the mesh data has been added so the mesh transformations are up to date
+    build_tlas();
+    bvh_build_time = build_timer.nsecsElapsed() / 1000000.0f;
+
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void Renderer3D::add_static_meshes_to_buffer(const std::vector<AbstractMesh*>& meshes) {
+    // Mesh indices are just positions in the scene's list so they change whenever any mesh is removed
+    for (size_t i=0; i<meshes.size(); i++) {
+        meshes[i]->set_mesh_index((int)i);
+    }
+
+    if (scene->static_meshes_modified(true) || resync_static_meshes) {
+        resync_static_meshes = false;
+        std::unordered_set<AbstractMesh*> scene_meshes(meshes.begin(), meshes.end());
+        std::vector<AbstractMesh*> removed_meshes;
+        for (auto mesh : uploaded_static_meshes) {
+            if (scene_meshes.count(mesh) == 0)
+                removed_meshes.push_back(mesh);
         }
-        glBufferData(GL_SHADER_STORAGE_BUFFER, mesh_ssbo_size*mesh_size_in_opengl, opengl_mesh_data.data(), GL_DYNAMIC_DRAW);
-    } else {
-        for (auto node : scene->get_root_nodes()) {
-            node->add_mesh_data(opengl_mesh_data);
+        for (auto mesh : removed_meshes) {
+            release_static_mesh(mesh);
+        }
+        for (auto mesh : meshes) {
+            if (uploaded_static_meshes.count(mesh) == 0)
+                upload_static_mesh(mesh);
         }
-        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, mesh_ssbo_size*mesh_size_in_opengl, opengl_mesh_data.data());
     }
 
-    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    // Close a few of the gaps removed meshes left behind every frame
+    // Everything in the ranges is relative to the start of the range so moving them is just a copy
+    for (const auto& relocation : static_vertex_heap.compact_step()) {
+        static_cast<AbstractMesh*>(const_cast<void*>(relocation.owner))->vertex_offset = relocation.new_offset;
+    }
+    for (const auto& relocation : static_triangle_heap.compact_step()) {
+        AbstractMesh* mesh = static_cast<AbstractMesh*>(const_cast<void*>(relocation.owner));
+        mesh->first_triangle = relocation.new_offset;
+        mesh->index_offset = 3*relocation.new_offset;
+    }
+    for (const auto& relocation : static_bvh_heap.compact_step()) {
+        static_cast<AbstractMesh*>(const_cast<void*>(relocation.owner))->bvh_node_offset = relocation.new_offset;
+    }
+}
+
+void Renderer3D::upload_static_mesh(AbstractMesh* mesh) {
+    int nr_vertices = (int)mesh->size_vertices();
+    int nr_triangles = (int)mesh->size_indices()/3;
+    int nr_bvh_nodes = (int)mesh->get_bvh().get_nodes().size();
+
+    mesh->vertex_offset = static_vertex_heap.allocate(mesh, nr_vertices);
+    mesh->first_triangle = static_triangle_heap.allocate(mesh, nr_triangles);
+    mesh->index_offset = 3*mesh->first_triangle;
+    mesh->bvh_node_offset = static_bvh_heap.allocate(mesh, nr_bvh_nodes);
+    uploaded_static_meshes.insert(mesh);
+    // A destroyed mesh can't be removed from the scene first, and its address could be reused
+    connect(mesh, &QObject::destroyed, this, [this, mesh]() {
+        release_static_mesh(mesh);
+    });
+
+    int position_size = quantized_static_positions ? quantized_vertex_position_size_in_opengl : vertex_position_size_in_opengl;
+    static_position_data.resize(nr_vertices*position_size);
+    static_attribute_data.resize(nr_vertices*vertex_attributes_size_in_opengl);
+    static_index_data.resize(nr_triangles*3);
+    static_triangle_data.resize(nr_triangles);
+    write_mesh_vertices(mesh, static_position_data.data(), static_attribute_data.data(), quantized_static_positions);
+    write_mesh_indices(mesh, static_index_data.data(), static_triangle_data.data());
+
+    static_vertex_heap.upload(0, mesh->vertex_offset, nr_vertices, static_position_data.data());
+    static_vertex_heap.upload(1, mesh->vertex_offset, nr_vertices, static_attribute_data.data());
+    static_triangle_heap.upload(0, mesh->first_triangle, nr_triangles, static_index_data.data());
+    static_triangle_heap.upload(1, mesh->first_triangle, nr_triangles, static_triangle_data.data());
+    static_assert(bvh_node_is_opengl_compatible, "BVHNode must match the memory layout of BVHNode in raytracer.glsl");
+    Q_ASSERT_X(mesh->get_bvh().get_depth() < bvh_stack_size, "Renderer3D::upload_static_mesh", "The BVH is too deep for the shader's traversal stack");
+    static_bvh_heap.upload(0, mesh->bvh_node_offset, nr_bvh_nodes, mesh->get_bvh().get_nodes().data());
+}
+
+void Renderer3D::release_static_mesh(AbstractMesh* mesh) {
+    // Only bookkeeping so this doesn't need the context
+    if (uploaded_static_meshes.erase(mesh) == 0)
+        return;
+    static_vertex_heap.free(mesh);
+    static_triangle_heap.free(mesh);
+    static_bvh_heap.free(mesh);
+    disconnect(mesh, &QObject::destroyed, this, nullptr);
 }
 
-void Renderer3D::add_mesh_vertices_to_buffer(const std::vector<AbstractMesh*>& meshes, unsigned int vert_ssbo, int mesh_index_offset) {
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, vert_ssbo);
+void Renderer3D::add_dynamic_meshes_to_buffer(const std::vector<AbstractMesh*>& meshes, int mesh_index_offset) {
+    // A sliced mesh's size is only known once the GPU has counted its triangles
+    sliced_meshes.clear();
+    for (auto mesh : meshes) {
+        if (SlicedMesh* sliced_mesh = dynamic_cast<SlicedMesh*>(mesh))
+            sliced_meshes.push_back(sliced_mesh);
+    }
+    if (!sliced_meshes.empty())
+        gpu_dimension_dropper.count_triangles(sliced_meshes);
+
+    size_t nr_vertices = scene->get_nr_dynamic_vertices();
+    size_t nr_triangles = get_nr_triangles(meshes);
+    size_t nr_bvh_nodes = gpu_bvh_enabled ? 0 : get_nr_bvh_nodes(meshes);
+
+    size_t position_bytes = nr_vertices*vertex_position_size_in_opengl;
+    size_t attribute_bytes = nr_vertices*vertex_attributes_size_in_opengl;
+    size_t index_bytes = nr_triangles*3*sizeof(Index);
+    size_t triangle_bytes = nr_triangles*sizeof(TriangleRecord);
+    size_t bvh_bytes = nr_bvh_nodes*sizeof(BVHNode);
+    dynamic_stream.begin_frame(
+        dynamic_stream.aligned_size(position_bytes) +
+        dynamic_stream.aligned_size(attribute_bytes) +
+        dynamic_stream.aligned_size(index_bytes) +
+        dynamic_stream.aligned_size(triangle_bytes) +
+        dynamic_stream.aligned_size(bvh_bytes)
+    );
+    StreamingBuffer::Allocation positions = dynamic_stream.allocate(position_bytes);
+    StreamingBuffer::Allocation attributes = dynamic_stream.allocate(attribute_bytes);
+    StreamingBuffer::Allocation indices = dynamic_stream.allocate(index_bytes);
+    StreamingBuffer::Allocation triangles = dynamic_stream.allocate(triangle_bytes);
+    StreamingBuffer::Allocation bvh_nodes = dynamic_stream.allocate(bvh_bytes);
+
+    // Dynamic meshes are simply packed one after the other every frame
     int vertex_offset = 0;
+    int triangle_offset = 0;
+    int bvh_node_offset = 0;
     int mesh_index = mesh_index_offset;
     for (auto mesh : meshes) {
         mesh->vertex_offset = vertex_offset;
+        mesh->first_triangle = triangle_offset;
+        mesh->index_offset = 3*triangle_offset;
         mesh->set_mesh_index(mesh_index);
         mesh_index++;
-        int nr_mesh_vertices = (int)mesh->size_vertices();
-        if (vertex_is_opengl_compatible) {
-            glBufferSubData(GL_SHADER_STORAGE_BUFFER, vertex_offset*sizeof(Vertex), nr_mesh_vertices*sizeof(Vertex), mesh->get_vertices());
+
+        // Sliced meshes are written by the slicer once the buffers are bound
+        bool sliced = dynamic_cast<SlicedMesh*>(mesh) != nullptr;
+        mesh->gpu_bvh = gpu_bvh_enabled || sliced;
+        if (!sliced) {
+            write_mesh_vertices(
+                mesh,
+                positions.data + vertex_offset*vertex_position_size_in_opengl,
+                attributes.data + vertex_offset*vertex_attributes_size_in_opengl,
+                false
+            );
+            write_mesh_indices(
+                mesh,
+                reinterpret_cast<Index*>(indices.data) + mesh->index_offset,
+                reinterpret_cast<TriangleRecord*>(triangles.data) + triangle_offset,
+                !mesh->gpu_bvh
+            );
+        }
+        if (!mesh->gpu_bvh) {
+            mesh->bvh_node_offset = bvh_node_offset;
+            write_mesh_bvh(mesh, reinterpret_cast<BVHNode*>(bvh_nodes.data) + bvh_node_offset);
+            bvh_node_offset += (int)mesh->get_bvh().get_nodes().size();
+        }
+        vertex_offset += (int)mesh->size_vertices();
+        triangle_offset += (int)mesh->size_indices()/3;
+    }
+
+    dynamic_stream.bind(4, positions);
+    dynamic_stream.bind(19, attributes);
+    dynamic_stream.bind(2, indices);
+    dynamic_stream.bind(15, triangles);
+    dynamic_stream.bind(9, bvh_nodes);
+
+    if (!sliced_meshes.empty())
+        gpu_dimension_dropper.write_triangles(sliced_meshes);
+
+    if (gpu_bvh_enabled) {
+        gpu_bvh_builder.build(meshes);
+    } else if (!sliced_meshes.empty()) {
+        gpu_bvh_builder.build(std::vector<AbstractMesh*>(sliced_meshes.begin(), sliced_meshes.end()));
+    }
+}
+
+void Renderer3D::write_mesh_vertices(const AbstractMesh* mesh, unsigned char* positions, unsigned char* attributes, bool quantize_positions) {
+    int position_size = quantize_positions ? quantized_vertex_position_size_in_opengl : vertex_position_size_in_opengl;
+    const Vertex* mesh_vertices = mesh->get_vertices();
+    int nr_mesh_vertices = (int)mesh->size_vertices();
+    // Has to be the same range AbstractMesh::as_byte_array gives the shader
+    glm::vec3 range_min, range_extent;
+    mesh->get_quantization_range(range_min, range_extent);
+    for (int i=0; i<nr_mesh_vertices; i++) {
+        if (quantize_positions) {
+            mesh_vertices[i].quantized_position_as_byte_array(positions + i*position_size, range_min, range_extent);
         } else {
-            std::vector<unsigned char> vertex_data(vertex_struct_size_in_opengl*nr_mesh_vertices);
-            const Vertex* mesh_vertices = mesh->get_vertices();
-            for (int i=0; i<nr_mesh_vertices; i++) {
-                mesh_vertices[i].as_byte_array(&vertex_data[i*vertex_struct_size_in_opengl]);
-            }
-            glBufferSubData(GL_SHADER_STORAGE_BUFFER, vertex_offset*vertex_struct_size_in_opengl, nr_mesh_vertices*vertex_struct_size_in_opengl, vertex_data.data());
+            mesh_vertices[i].position_as_byte_array(positions + i*position_size);
         }
-        vertex_offset += nr_mesh_vertices;
+        mesh_vertices[i].attributes_as_byte_array(attributes + i*vertex_attributes_size_in_opengl);
+    }
+}
+
+void Renderer3D::write_mesh_indices(const AbstractMesh* mesh, Index* indices, TriangleRecord* triangles, bool in_bvh_order) {
+    static_assert(triangle_record_is_opengl_compatible, "TriangleRecord must match the memory layout of TriangleRecord in raytracer.glsl");
+    int nr_mesh_triangles = (int)mesh->size_indices()/3;
+    const Index* mesh_indices = mesh->get_indices();
+    const Vertex* mesh_vertices = mesh->get_vertices();
+    // The triangles are stored in the order of the mesh's BVH leaves so the leaves can
+    // reference the triangles directly
+    // The rest of the triangles (all of them if the triangles aren't reordered) are left in place
+    const std::vector<unsigned int>& triangle_order = mesh->get_bvh().get_primitive_indices();
+    int nr_reordered = in_bvh_order ? (int)triangle_order.size() : 0;
+    // Indices are copied unmodified since the shaders add the mesh's base vertex
+    for (int i=0; i<nr_mesh_triangles; i++) {
+        unsigned int triangle = i < nr_reordered ? triangle_order[i] : (unsigned int)i;
+        const Index* triangle_indices = mesh_indices + triangle*3;
+        std::copy(triangle_indices, triangle_indices+3, indices + i*3);
+        // Precompute everything the intersection test needs in the same order as the indices
+        triangles[i] = TriangleRecord(
+            mesh_vertices[triangle_indices[0]].position,
+            mesh_vertices[triangle_indices[1]].position,
+            mesh_vertices[triangle_indices[2]].position
+        );
+    }
+}
+
+void Renderer3D::write_mesh_bvh(const AbstractMesh* mesh, BVHNode* nodes) {
+    static_assert(bvh_node_is_opengl_compatible, "BVHNode must match the memory layout of BVHNode in raytracer.glsl");
+    Q_ASSERT_X(mesh->get_bvh().get_depth() < bvh_stack_size, "Renderer3D::write_mesh_bvh", "The BVH is too deep for the shader's traversal stack");
+    const std::vector<BVHNode>& mesh_nodes = mesh->get_bvh().get_nodes();
+    std::copy(mesh_nodes.begin(), mesh_nodes.end(), nodes);
+}
+
+void Renderer3D::upload_to_growing_buffer(unsigned int ssbo, size_t& capacity, const void* data, size_t size) {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+    if (size > capacity) {
+        capacity = std::max(size, 2*capacity);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, capacity, nullptr, GL_DYNAMIC_DRAW);
     }
+    if (size > 0)
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, data);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 }
 
-void Renderer3D::add_mesh_indices_to_buffer(const std::vector<AbstractMesh*>& meshes, unsigned int ind_ssbo) {
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ind_ssbo);
-    int index_offset = 0;
+void Renderer3D::count_bvh_update(BVHUpdate update) {
+    if (update == BVHUpdate::Refit)
+        bvh_refit_count++;
+    else if (update == BVHUpdate::Rebuild)
+        bvh_rebuild_count++;
+}
+
+int Renderer3D::get_nr_triangles(const std::vector<AbstractMesh*>& meshes) {
+    int nr_triangles = 0;
     for (auto mesh : meshes) {
-        int nr_mesh_indices = (int)mesh->size_indices();
-        const Index* mesh_indices = mesh->get_indices();
-        Index* indices = new Index[nr_mesh_indices];
-        for (int i=0; i<nr_mesh_indices; i++) {
-            indices[i] = mesh_indices[i] + mesh->vertex_offset;
+        nr_triangles += (int)mesh->size_indices()/3;
+    }
+    return nr_triangles;
+}
+
+int Renderer3D::get_nr_bvh_nodes(const std::vector<AbstractMesh*>& meshes) {
+    int nr_bvh_nodes = 0;
+    for (auto mesh : meshes) {
+        nr_bvh_nodes += (int)mesh->get_bvh().get_nodes().size();
+    }
+    return nr_bvh_nodes;
+}
+
+void Renderer3D::build_tlas() {
+    mesh_bounds.clear();
+    tlas_mesh_indices.clear();
+    add_mesh_bounds(scene->get_static_meshes());
+    add_mesh_bounds(scene->get_dynamic_meshes());
+    // There are only ever a handful of meshes so the TLAS is simply rebuilt every frame
+    // Its traversal stack is smaller than a mesh's, and SAH can make a deep hierarchy out of just a few meshes
+    tlas.build(mesh_bounds, tlas_stack_size-1);
+    Q_ASSERT_X(tlas.get_depth() < tlas_stack_size, "Renderer3D::build_tlas", "The TLAS is too deep for the shader's traversal stack");
+
+    const std::vector<BVHNode>& nodes = tlas.get_nodes();
+    upload_to_growing_buffer(tlas_node_ssbo, tlas_node_ssbo_capacity, nodes.data(), nodes.size()*sizeof(BVHNode));
+
+    // Convert the TLAS's primitive indices into mesh indices
+    const std::vector<unsigned int>& primitive_indices = tlas.get_primitive_indices();
+    tlas_primitives.resize(primitive_indices.size());
+    for (size_t i=0; i<primitive_indices.size(); i++) {
+        tlas_primitives[i] = tlas_mesh_indices[primitive_indices[i]];
+    }
+    upload_to_growing_buffer(tlas_primitive_ssbo, tlas_primitive_ssbo_capacity, tlas_primitives.data(), tlas_primitives.size()*sizeof(int));
+}
+
+void Renderer3D::add_mesh_bounds(const std::vector<AbstractMesh*>& meshes) {
+    for (auto mesh : meshes) {
+        const AABB& local_bounds = mesh->get_bounds();
+        // Meshes without any triangles can never be hit
+        if (local_bounds.empty())
+            continue;
+
+        // Transform all 8 corners of the mesh space bounds into world space
+        AABB world_bounds;
+        for (int i=0; i<8; i++) {
+            glm::vec3 corner(
+                (i & 1) ? local_bounds.max.x : local_bounds.min.x,
+                (i & 2) ? local_bounds.max.y : local_bounds.min.y,
+                (i & 4) ? local_bounds.max.z : local_bounds.min.z
+            );
+            world_bounds.grow(glm::vec3(mesh->transformation * glm::vec4(corner, 1.0f)));
         }
-        glBufferSubData(GL_SHADER_STORAGE_BUFFER, index_offset*sizeof(Index), nr_mesh_indices*sizeof(Index), indices);
-        delete[] indices;
-        index_offset += nr_mesh_indices;
+        mesh_bounds.push_back(world_bounds);
+        tlas_mesh_indices.push_back(mesh->get_mesh_index());
     }
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 }
 
 void Renderer3D::add_materials_to_buffer() {
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, material_ssbo);
     MaterialManager& material_manager = scene->get_material_manager();
     const std::vector<Material>& materials = material_manager.get_materials();
-
-    if ((int)materials.size() != material_ssbo_size) {
-        material_ssbo_size = (int)materials.size();
-        glBufferData(GL_SHADER_STORAGE_BUFFER, material_ssbo_size*sizeof(Material), materials.data(), GL_DYNAMIC_DRAW);
-    } else {
-        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, material_ssbo_size*sizeof(Material), materials.data());
-    }
-
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    upload_to_growing_buffer(material_ssbo, material_ssbo_capacity, materials.data(), materials.size()*sizeof(Material));
 }
 
 void Renderer3D::set_textures() {
@@ -419,6 +678,11 @@ void Renderer3D::set_textures() {
 }
 
 void Renderer3D::set_scene(Scene* scene) {
+    // The new scene's meshes are uploaded the next time it's rendered
+    for (auto mesh : std::vector<AbstractMesh*>(uploaded_static_meshes.begin(), uploaded_static_meshes.end())) {
+        release_static_mesh(mesh);
+    }
+    resync_static_meshes = true;
     this->scene = scene;
 }
 
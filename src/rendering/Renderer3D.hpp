@@ -4,12 +4,19 @@
 #include <QObject>
 #include <QOpenGLFunctions_4_5_Core>
 #include <vector>
+#include <unordered_set>
 
 #include "Shader.hpp"
 #include "Camera3D.hpp"
 #include "Texture.hpp"
+#include "BVH.hpp"
+#include "GPUBVHBuilder.hpp"
+#include "GPUDimensionDropper.hpp"
+#include "StreamingBuffer.hpp"
+#include "GPUHeap.hpp"
 #include "objects/Vertex.hpp"
 #include "objects/Scene.hpp"
+#include "objects/SlicedMesh.hpp"
 
 #include "Renderer3DOptions.hpp"
 
@@ -60,6 +67,24 @@ public:
     // If opengl_context or surface is null, returns -1 (no mesh) by default
     MeshIndex get_mesh_index_at(int x, int y);
 
+    // When disabled, every ray is tested against every triangle in the scene
+    // Useful for comparing against the BVH
+    void set_bvh_enabled(bool enabled);
+    bool is_bvh_enabled() const;
+    // When enabled, the BVHs of dynamic meshes are built on the GPU every frame
+    // (see GPUBVHBuilder) instead of being refit or rebuilt on the CPU
+    // SlicedMeshes always have their BVHs built on the GPU
+    void set_gpu_bvh_enabled(bool enabled);
+    bool is_gpu_bvh_enabled() const;
+
+    // Time (in ms) the GPU spent ray tracing the most recently measured frame
+    float get_render_time() const;
+    // Time (in ms) the CPU spent building BVHs for the last frame
+    float get_bvh_build_time() const;
+    // How many times a mesh's BVH has been refit or rebuilt since the renderer was created
+    int get_bvh_refit_count() const;
+    int get_bvh_rebuild_count() const;
+
 private:
     // Used pretty much only to set context
     // Can be null; if so, functions that need this will return their defaults
@@ -72,36 +97,79 @@ private:
     int work_group_size[3];
     Texture render_result;
 
-    // Note: not a "real" opengl vertex shader; rather, this is a compute
-    // shader carrying out the function of a vertex shader
-    Shader vertex_shader;
-    int vertex_shader_work_group_size[3];
-    // This MUST match the Y_SIZE in vertex_shader.glsl
-    // See definition there for explanation
-    static const int Y_SIZE = 64;
-
     std::vector<Vertex> vertices;
     std::vector<unsigned int> indices;
 
-    unsigned int vertex_ssbo;
-    int vertex_ssbo_size;
-
-    unsigned int static_vertex_ssbo;
-    int static_vertex_ssbo_size;
-    unsigned int static_index_ssbo;
-    int static_index_ssbo_size;
-
-    unsigned int dynamic_vertex_ssbo;
-    int dynamic_vertex_ssbo_size;
-    unsigned int dynamic_index_ssbo;
-    int dynamic_index_ssbo_size;
-
+    // Vertices are uploaded in mesh space and are never transformed
+    // Instead, rays are transformed into mesh space when they are traced against a mesh
+    // Positions and the rest of the vertex attributes are in separate buffers because traversal
+    // only needs positions, attributes are only read for the closest hit
+    // Every triangle has three indices and one TriangleRecord, in the same order
+
+    // Every static mesh has its own range of these so adding or removing a mesh only
+    // uploads that mesh and never reallocates the others
+    // Positions (binding 3) and attributes (18), indexed by vertex
+    GPUHeap static_vertex_heap;
+    // Indices (binding 1, three per element) and triangle records (14), indexed by triangle
+    GPUHeap static_triangle_heap;
+    // BVH nodes (binding 8)
+    GPUHeap static_bvh_heap;
+    // The meshes that currently have ranges in the static heaps
+    std::unordered_set<AbstractMesh*> uploaded_static_meshes;
+    // Set when the scene changes so every mesh is checked against the heaps
+    bool resync_static_meshes;
+
+    // A static mesh is written here first and then uploaded with a single call per buffer
+    std::vector<unsigned char> static_position_data;
+    std::vector<unsigned char> static_attribute_data;
+    std::vector<Index> static_index_data;
+    std::vector<TriangleRecord> static_triangle_data;
+
+    // Every dynamic buffer (positions, attributes, indices, triangle records and CPU built BVHs)
+    // is a range of this, written directly every frame and bound to the same bindings the
+    // static buffers' dynamic counterparts use in raytracer.glsl
+    StreamingBuffer dynamic_stream;
+
+    // These are rewritten whenever they change so they only ever grow (geometrically)
+    // Capacities are in bytes
     std::vector<unsigned char> opengl_mesh_data;
     unsigned int mesh_ssbo;
     int mesh_ssbo_size;
+    size_t mesh_ssbo_capacity;
 
     unsigned int material_ssbo;
-    int material_ssbo_size;
+    size_t material_ssbo_capacity;
+
+    // Top level BVH over the world space bounds of every mesh
+    // Moving a node only requires the TLAS to be rebuilt
+    BVH tlas;
+    std::vector<AABB> mesh_bounds;
+    std::vector<int> tlas_mesh_indices; // The mesh index of every element in mesh_bounds
+    std::vector<int> tlas_primitives;
+    unsigned int tlas_node_ssbo;
+    size_t tlas_node_ssbo_capacity;
+    unsigned int tlas_primitive_ssbo;
+    size_t tlas_primitive_ssbo_capacity;
+
+    GPUBVHBuilder gpu_bvh_builder;
+
+    // Slices the scene's SlicedMeshes straight into the dynamic buffers
+    GPUDimensionDropper gpu_dimension_dropper;
+    // The dynamic meshes sliced this frame
+    std::vector<SlicedMesh*> sliced_meshes;
+
+    bool bvh_enabled;
+    bool gpu_bvh_enabled;
+    float bvh_build_time;
+    int bvh_refit_count;
+    int bvh_rebuild_count;
+
+    // GL_TIME_ELAPSED query around the ray trace dispatch
+    // A new query is only started once the previous result has been read so the
+    // CPU never has to wait for the GPU
+    unsigned int render_time_query;
+    bool render_time_query_pending;
+    float render_time;
 
     int width;
     int height;
@@ -124,11 +192,31 @@ private:
 
     Scene* scene;
     void add_meshes_to_buffer();
-    void add_mesh_vertices_to_buffer(const std::vector<AbstractMesh*>& meshes, unsigned int vert_ssbo, int mesh_index_offset=0);
-    void add_mesh_indices_to_buffer(const std::vector<AbstractMesh*>& meshes, unsigned int ind_ssbo);
+    void add_static_meshes_to_buffer(const std::vector<AbstractMesh*>& meshes);
+    void upload_static_mesh(AbstractMesh* mesh);
+    void release_static_mesh(AbstractMesh* mesh);
+    void add_dynamic_meshes_to_buffer(const std::vector<AbstractMesh*>& meshes, int mesh_index_offset);
+    // The write functions fill memory that is already big enough for the mesh (either a staging
+    // vector or a mapped range of dynamic_stream)
+    // Mapped memory is write only so they never read back what they wrote
+    // Positions are only ever quantized for static meshes (see quantized_static_positions)
+    void write_mesh_vertices(const AbstractMesh* mesh, unsigned char* positions, unsigned char* attributes, bool quantize_positions);
+    // Writes three indices and a triangle record per triangle
+    // The triangles are reordered to match the mesh's BVH's leaves if in_bvh_order is true
+    void write_mesh_indices(const AbstractMesh* mesh, Index* indices, TriangleRecord* triangles, bool in_bvh_order=true);
+    void write_mesh_bvh(const AbstractMesh* mesh, BVHNode* nodes);
+    int get_nr_triangles(const std::vector<AbstractMesh*>& meshes);
+    // Reallocates the buffer if size bytes don't fit in capacity, then uploads data
+    void upload_to_growing_buffer(unsigned int ssbo, size_t& capacity, const void* data, size_t size);
 
     void add_materials_to_buffer();
 
+    int get_nr_bvh_nodes(const std::vector<AbstractMesh*>& meshes);
+    void count_bvh_update(BVHUpdate update);
+
+    void build_tlas();
+    void add_mesh_bounds(const std::vector<AbstractMesh*>& meshes);
+
     void set_textures();
 
     Camera3D* camera;
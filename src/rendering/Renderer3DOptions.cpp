@@ -19,4 +19,36 @@ bool Renderer3DOptions::modify_sunlight(const glm::vec3& direction, const glm::v
 
 MeshIndex Renderer3DOptions::get_mesh_index_at(int x, int y) {
     return renderer_3D->get_mesh_index_at(x, y);
+}
+
+void Renderer3DOptions::set_bvh_enabled(bool enabled) {
+    renderer_3D->set_bvh_enabled(enabled);
+}
+
+bool Renderer3DOptions::is_bvh_enabled() const {
+    return renderer_3D->is_bvh_enabled();
+}
+
+void Renderer3DOptions::set_gpu_bvh_enabled(bool enabled) {
+    renderer_3D->set_gpu_bvh_enabled(enabled);
+}
+
+bool Renderer3DOptions::is_gpu_bvh_enabled() const {
+    return renderer_3D->is_gpu_bvh_enabled();
+}
+
+float Renderer3DOptions::get_render_time() const {
+    return renderer_3D->get_render_time();
+}
+
+float Renderer3DOptions::get_bvh_build_time() const {
+    return renderer_3D->get_bvh_build_time();
+}
+
+int Renderer3DOptions::get_bvh_refit_count() const {
+    return renderer_3D->get_bvh_refit_count();
+}
+
+int Renderer3DOptions::get_bvh_rebuild_count() const {
+    return renderer_3D->get_bvh_rebuild_count();
 }
\ No newline at end of file
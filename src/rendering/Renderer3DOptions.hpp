@@ -21,6 +21,16 @@ public:
     bool modify_sunlight(const glm::vec3& direction, const glm::vec3& radiance, float ambient_multiplier=0.0f);
     MeshIndex get_mesh_index_at(int x, int y);
 
+    void set_bvh_enabled(bool enabled);
+    bool is_bvh_enabled() const;
+    void set_gpu_bvh_enabled(bool enabled);
+    bool is_gpu_bvh_enabled() const;
+
+    float get_render_time() const;
+    float get_bvh_build_time() const;
+    int get_bvh_refit_count() const;
+    int get_bvh_rebuild_count() const;
+
 private:
     friend class Renderer3D;
     // Parent should be the same as renderer_3D but its clearer to
@@ -0,0 +1,147 @@
+#include "SliceCache.hpp"
+#include <cmath>
+#include "objects/DynamicMesh.hpp"
+
+bool SliceCache::Key::operator==(const Key& other) const {
+    return model == other.model &&
+           rotation_xw == other.rotation_xw &&
+           rotation_yw == other.rotation_yw &&
+           rotation_zw == other.rotation_zw &&
+           position_w == other.position_w;
+}
+
+size_t SliceCache::KeyHash::operator()(const Key& key) const {
+    size_t hash = std::hash<const Node*>()(key.model);
+    for (int value : {key.rotation_xw, key.rotation_yw, key.rotation_zw, key.position_w})
+        hash = hash * 31 + std::hash<int>()(value);
+    return hash;
+}
+
+SliceCache::SliceCache(DimensionDropper* dropper, QObject* parent) :
+    QObject(parent),
+    dropper(dropper),
+    max_bytes(default_max_bytes),
+    rotation_step(0.1f),
+    position_step(1.0f / 5000.0f)
+{}
+
+SliceCache::Key SliceCache::make_key(const Node* model, float rotation_xw, float rotation_yw, float rotation_zw, float position_w) const {
+    return {
+        model,
+        (int)std::lround(rotation_xw / rotation_step),
+        (int)std::lround(rotation_yw / rotation_step),
+        (int)std::lround(rotation_zw / rotation_step),
+        (int)std::lround(position_w / position_step)
+    };
+}
+
+bool SliceCache::drop(Node* node4d, const Key& key, const Hyperplane4D& hyperplane, Node* node3d) {
+    auto cached = slice_map.find(key);
+    if (cached != slice_map.end()) {
+        statistics.hits++;
+        // Move it to the front since it's now the most recently used
+        slices.splice(slices.begin(), slices, cached->second);
+        const Slice& slice = *cached->second;
+        for (size_t i = 0; i < node3d->meshes.size(); i++) {
+            DynamicMesh* mesh3d = static_cast<DynamicMesh*>(node3d->meshes[i]);
+            // Assigning reuses the meshes' memory
+            mesh3d->modify_vertices() = slice.vertices[i];
+            mesh3d->modify_indices() = slice.indices[i];
+            mesh3d->flat_normals = slice.flat_normals[i];
+        }
+        return true;
+    }
+
+    statistics.misses++;
+    dropper->drop(node4d, hyperplane, node3d);
+    insert(key, node3d);
+    return false;
+}
+
+void SliceCache::insert(const Key& key, const Node* node3d) {
+    auto cached = slice_map.find(key);
+    if (cached != slice_map.end())
+        erase(cached->second);
+
+    Slice slice;
+    slice.key = key;
+    for (const auto mesh : node3d->meshes) {
+        slice.vertices.emplace_back(mesh->get_vertices(), mesh->get_vertices() + mesh->size_vertices());
+        slice.indices.emplace_back(mesh->get_indices(), mesh->get_indices() + mesh->size_indices());
+        slice.flat_normals.push_back(mesh->flat_normals);
+        slice.bytes += mesh->size_vertices()*sizeof(Vertex) + mesh->size_indices()*sizeof(Index);
+    }
+    if (slice.bytes > max_bytes)
+        return;
+
+    // Make room for it before it's added so it's never the one evicted
+    evict(max_bytes - slice.bytes);
+    statistics.nr_slices++;
+    statistics.bytes += slice.bytes;
+    slices.push_front(std::move(slice));
+    slice_map.emplace(key, slices.begin());
+
+    if (watched_models.insert(key.model).second) {
+        // A destroyed model's address could be reused by a different model
+        connect(key.model, &QObject::destroyed, this, [this, model = key.model]() {
+            remove(model);
+            watched_models.erase(model);
+        });
+    }
+}
+
+void SliceCache::clear() {
+    slices.clear();
+    slice_map.clear();
+    statistics.nr_slices = 0;
+    statistics.bytes = 0;
+}
+
+void SliceCache::remove(const Node* model) {
+    for (auto slice = slices.begin(); slice != slices.end();) {
+        auto next = std::next(slice);
+        if (slice->key.model == model)
+            erase(slice);
+        slice = next;
+    }
+}
+
+void SliceCache::set_max_bytes(size_t max_bytes) {
+    this->max_bytes = max_bytes;
+    evict(max_bytes);
+}
+
+size_t SliceCache::get_max_bytes() const {
+    return max_bytes;
+}
+
+void SliceCache::set_steps(float rotation_step, float position_step) {
+    // The keys of the cached slices were made with the old steps
+    clear();
+    this->rotation_step = rotation_step;
+    this->position_step = position_step;
+}
+
+const SliceCache::Statistics& SliceCache::get_statistics() const {
+    return statistics;
+}
+
+void SliceCache::reset_statistics() {
+    statistics.hits = 0;
+    statistics.misses = 0;
+    statistics.evictions = 0;
+}
+
+void SliceCache::evict(size_t max_bytes) {
+    while (statistics.bytes > max_bytes) {
+        erase(std::prev(slices.end()));
+        statistics.evictions++;
+    }
+}
+
+void SliceCache::erase(std::list<Slice>::iterator slice) {
+    statistics.nr_slices--;
+    statistics.bytes -= slice->bytes;
+    slice_map.erase(slice->key);
+    slices.erase(slice);
+}
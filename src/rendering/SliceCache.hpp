@@ -0,0 +1,106 @@
+#ifndef SLICE_CACHE_HPP
+#define SLICE_CACHE_HPP
+
+#include <QObject>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "DimensionDropper.hpp"
+
+/*
+A least recently used cache of the slices a DimensionDropper made, so slicing a model with a
+rotation and w it was sliced with recently (animations going back and forth, sliders jittering,
+frames where nothing changed) copies the old slice instead of slicing again
+
+Slices are keyed by the model and its 4D rotation angles and w, quantized so values closer than
+a step apart share a slice. A cached slice is whatever the first slice with its key was, which
+is at most half a step of rotation or w off
+*/
+class SliceCache : public QObject {
+    Q_OBJECT;
+public:
+    struct Key {
+        const Node* model;
+        // The angles (in degrees) and w divided by their step, rounded
+        int rotation_xw;
+        int rotation_yw;
+        int rotation_zw;
+        int position_w;
+
+        bool operator==(const Key& other) const;
+    };
+
+    struct Statistics {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evictions = 0;
+        // What's cached right now
+        size_t nr_slices = 0;
+        size_t bytes = 0;
+    };
+
+    SliceCache(DimensionDropper* dropper, QObject* parent=nullptr);
+    virtual ~SliceCache() {}
+
+    Key make_key(const Node* model, float rotation_xw, float rotation_yw, float rotation_zw, float position_w) const;
+
+    // Replaces the meshes of node3d (which must be a node dropper->drop returned for node4d) with the
+    // cached slice of the key, or slices node4d with the hyperplane into them and caches that if it isn't cached
+    // The hyperplane must be the one the key's rotation and w give
+    // Returns true if the slice was cached
+    bool drop(Node* node4d, const Key& key, const Hyperplane4D& hyperplane, Node* node3d);
+    // Caches the meshes of node3d as the slice of the key, replacing the slice it had (if any)
+    // For slices made somewhere else, like the first slice of a model loaded on another thread
+    void insert(const Key& key, const Node* node3d);
+
+    // Forgets every slice (of a model), which must be done when a model's meshes or the dropper's settings change
+    // The slices of a destroyed model are forgotten automatically
+    void clear();
+    void remove(const Node* model);
+
+    // The least recently used slices are evicted when the cached slices take up more than max_bytes,
+    // a slice bigger than max_bytes on its own is never cached
+    void set_max_bytes(size_t max_bytes);
+    size_t get_max_bytes() const;
+
+    // The defaults are the resolutions of the rotation and w sliders, so they never share slices
+    void set_steps(float rotation_step, float position_step);
+
+    const Statistics& get_statistics() const;
+    // Only resets the hits, misses and evictions
+    void reset_statistics();
+
+private:
+    struct KeyHash {
+        size_t operator()(const Key& key) const;
+    };
+
+    struct Slice {
+        Key key;
+        // One of each for every mesh of the sliced node
+        std::vector<std::vector<Vertex>> vertices;
+        std::vector<std::vector<Index>> indices;
+        std::vector<bool> flat_normals;
+        size_t bytes = 0;
+    };
+
+    static constexpr size_t default_max_bytes = 64 << 20;
+
+    void evict(size_t max_bytes);
+    void erase(std::list<Slice>::iterator slice);
+
+    DimensionDropper* dropper;
+    size_t max_bytes;
+    float rotation_step;
+    float position_step;
+    Statistics statistics;
+
+    // The most recently used slice first
+    std::list<Slice> slices;
+    std::unordered_map<Key, std::list<Slice>::iterator, KeyHash> slice_map;
+    // The models whose destroyed signal is connected, so it's only connected once
+    std::unordered_set<const Node*> watched_models;
+};
+
+#endif
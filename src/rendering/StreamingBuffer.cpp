@@ -0,0 +1,97 @@
+#include "StreamingBuffer.hpp"
+#include <QtGlobal>
+#include <algorithm>
+
+StreamingBuffer::StreamingBuffer(QObject* parent) : QObject(parent) {
+    buffer = 0;
+    mapped = nullptr;
+    region_size = 0;
+    alignment = 1;
+    region = 0;
+    region_used = 0;
+    std::fill(fences, fences+nr_regions, nullptr);
+}
+
+StreamingBuffer::~StreamingBuffer() {}
+
+void StreamingBuffer::initialize() {
+    initializeOpenGLFunctions();
+
+    int offset_alignment = 1;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &offset_alignment);
+    alignment = (size_t)std::max(offset_alignment, 1);
+
+    reallocate(min_region_size);
+}
+
+void StreamingBuffer::begin_frame(size_t frame_size) {
+    if (frame_size > region_size) {
+        // Growing geometrically so a mesh growing a bit every frame doesn't reallocate every frame
+        reallocate(std::max(frame_size, 2*region_size));
+    }
+    region = (region+1) % nr_regions;
+    region_used = 0;
+    wait(region);
+}
+
+size_t StreamingBuffer::aligned_size(size_t size) const {
+    // Empty ranges can't be bound so every allocation takes up at least one unit
+    size = std::max(size, (size_t)1);
+    return (size + alignment-1) / alignment * alignment;
+}
+
+StreamingBuffer::Allocation StreamingBuffer::allocate(size_t size) {
+    size_t allocated_size = aligned_size(size);
+    Q_ASSERT_X(region_used+allocated_size <= region_size, "StreamingBuffer::allocate", "The frame is bigger than the size given to begin_frame");
+
+    size_t offset = region*region_size + region_used;
+    region_used += allocated_size;
+    return Allocation{mapped+offset, offset, allocated_size};
+}
+
+void StreamingBuffer::bind(GLuint binding, const Allocation& allocation) {
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, buffer, allocation.offset, allocation.size);
+}
+
+void StreamingBuffer::fence() {
+    if (fences[region])
+        glDeleteSync(fences[region]);
+    fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+size_t StreamingBuffer::get_region_size() const {
+    return region_size;
+}
+
+void StreamingBuffer::wait(int region_index) {
+    if (!fences[region_index])
+        return;
+    // Flushing on the first wait so the fence is guaranteed to signal eventually
+    GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    while (glClientWaitSync(fences[region_index], flags, 1000000) == GL_TIMEOUT_EXPIRED) {
+        flags = 0;
+    }
+    glDeleteSync(fences[region_index]);
+    fences[region_index] = nullptr;
+}
+
+void StreamingBuffer::reallocate(size_t size) {
+    // The old buffer can only be deleted once the GPU is done with all of it
+    for (int i=0; i<nr_regions; i++) {
+        wait(i);
+    }
+    if (buffer) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+        glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+        glDeleteBuffers(1, &buffer);
+    }
+
+    region_size = aligned_size(size);
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, nr_regions*region_size, nullptr, flags);
+    mapped = static_cast<unsigned char*>(glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, nr_regions*region_size, flags));
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    region_used = 0;
+}
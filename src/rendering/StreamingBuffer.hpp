@@ -0,0 +1,63 @@
+#ifndef STREAMING_BUFFER_HPP
+#define STREAMING_BUFFER_HPP
+
+#include <QObject>
+#include <QOpenGLFunctions_4_5_Core>
+
+/*
+A persistently mapped ring of buffer regions for data that is rewritten every frame
+
+Each frame writes straight into the next region, which the GPU stopped reading at least
+nr_regions-1 frames ago, so uploading never has to wait for the previous frame to finish
+A fence placed after the last command that read a region guards it from being overwritten
+early (see fence)
+*/
+class StreamingBuffer : public QObject, protected QOpenGLFunctions_4_5_Core {
+    Q_OBJECT;
+public:
+    struct Allocation {
+        unsigned char* data;
+        size_t offset;
+        size_t size;
+    };
+
+    StreamingBuffer(QObject* parent=nullptr);
+    virtual ~StreamingBuffer();
+
+    // Must be called with a current context
+    void initialize();
+
+    // Moves on to the next region, waiting for the GPU to finish with it if needed
+    // frame_size must be the sum of the aligned_size of everything allocated this frame
+    // If it doesn't fit, every region is reallocated to fit it (which waits for all of them)
+    void begin_frame(size_t frame_size);
+    // The space an allocation of size bytes takes up in a region
+    size_t aligned_size(size_t size) const;
+    // Returns size bytes of the current region that can be written to until the next begin_frame
+    // Writes are visible to the GPU without flushing (the buffer is coherent)
+    Allocation allocate(size_t size);
+    void bind(GLuint binding, const Allocation& allocation);
+    // Must be called after the last command reading the current region
+    // Calling it again (e.g. for another dispatch using the same data) replaces the fence
+    void fence();
+
+    size_t get_region_size() const;
+
+private:
+    static constexpr int nr_regions = 3;
+    static constexpr size_t min_region_size = 1 << 16;
+
+    void wait(int region_index);
+    void reallocate(size_t size);
+
+    unsigned int buffer;
+    unsigned char* mapped;
+    size_t region_size;
+    size_t alignment;
+
+    int region;
+    size_t region_used;
+    GLsync fences[nr_regions];
+};
+
+#endif
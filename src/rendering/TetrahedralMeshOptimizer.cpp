@@ -0,0 +1,276 @@
+#include "TetrahedralMeshOptimizer.hpp"
+#include <QElapsedTimer>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include "objects/DynamicMesh.hpp"
+
+// Spreads the lower 16 bits of bits out to every 4th bit
+static uint64_t spread_bits(uint64_t bits) {
+    bits &= 0xFFFF;
+    bits = (bits | bits << 24) & 0x000000FF000000FFull;
+    bits = (bits | bits << 12) & 0x000F000F000F000Full;
+    bits = (bits | bits << 6)  & 0x0303030303030303ull;
+    bits = (bits | bits << 3)  & 0x1111111111111111ull;
+    return bits;
+}
+
+// Interleaves 4 16 bit coordinates into a 64 bit key, with the bits of x the most significant of each 4
+static uint64_t interleave(const std::array<uint32_t, 4>& coordinates) {
+    return spread_bits(coordinates[0]) << 3 | spread_bits(coordinates[1]) << 2 |
+           spread_bits(coordinates[2]) << 1 | spread_bits(coordinates[3]);
+}
+
+// Where 4 16 bit coordinates are along a 4D Hilbert curve, from John Skilling's "Programming the Hilbert curve"
+static uint64_t hilbert_key(std::array<uint32_t, 4> coordinates) {
+    constexpr uint32_t highest_bit = 1u << 15;
+    // Undo the rotations and reflections of every level
+    for (uint32_t bit = highest_bit; bit > 1; bit >>= 1) {
+        uint32_t lower_bits = bit - 1;
+        for (int i = 0; i < 4; i++) {
+            if (coordinates[i] & bit) {
+                coordinates[0] ^= lower_bits;
+            } else {
+                uint32_t swapped = (coordinates[0] ^ coordinates[i]) & lower_bits;
+                coordinates[0] ^= swapped;
+                coordinates[i] ^= swapped;
+            }
+        }
+    }
+    // Gray encode
+    for (int i = 1; i < 4; i++)
+        coordinates[i] ^= coordinates[i - 1];
+    uint32_t flips = 0;
+    for (uint32_t bit = highest_bit; bit > 1; bit >>= 1) {
+        if (coordinates[3] & bit)
+            flips ^= bit - 1;
+    }
+    for (auto& coordinate : coordinates)
+        coordinate ^= flips;
+    return interleave(coordinates);
+}
+
+// The 4D volume of a tetrahedron, from the Gram determinant of its edges from a
+static double tetrahedron_volume(const glm::dvec4& a, const glm::dvec4& b, const glm::dvec4& c, const glm::dvec4& d) {
+    const glm::dvec4 edges[3] = { b - a, c - a, d - a };
+    glm::dmat3 gram;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++)
+            gram[i][j] = glm::dot(edges[i], edges[j]);
+    }
+    return std::sqrt(std::max(glm::determinant(gram), 0.0)) / 6.0;
+}
+
+// Positions are compared by their bits, with -0 the same as 0
+static std::array<uint32_t, 4> position_bits(const glm::vec4& position) {
+    std::array<uint32_t, 4> bits;
+    for (int i = 0; i < 4; i++) {
+        float coordinate = position[i] == 0.0f ? 0.0f : position[i];
+        std::memcpy(&bits[i], &coordinate, sizeof(float));
+    }
+    return bits;
+}
+
+static void optimize_mesh(DynamicMesh* mesh, TetrahedralMeshOptimizer::Order order, double degenerate_ratio, TetrahedralMeshOptimizer::Report& report) {
+    // Only replaced once everything is done
+    const Vertex* vertices = mesh->get_vertices();
+    const size_t nr_vertices = mesh->size_vertices();
+    std::vector<Index> indices(mesh->get_indices(), mesh->get_indices() + mesh->size_indices());
+    // Meshes with a partial tetrahedron at the end or indices out of range aren't from ModelLoader
+    if (indices.size() % 4 || std::any_of(indices.begin(), indices.end(), [&](Index index) { return index >= nr_vertices; }))
+        return;
+    const size_t nr_tetrahedra = indices.size() / 4;
+
+    // Merge the vertices with the same position into the first of them
+    std::vector<Index> sorted_vertices(nr_vertices);
+    std::iota(sorted_vertices.begin(), sorted_vertices.end(), 0);
+    std::vector<std::array<uint32_t, 4>> bits(nr_vertices);
+    for (size_t i = 0; i < nr_vertices; i++)
+        bits[i] = position_bits(vertices[i].position);
+    std::sort(sorted_vertices.begin(), sorted_vertices.end(), [&](Index a, Index b) {
+        return bits[a] != bits[b] ? bits[a] < bits[b] : a < b;
+    });
+    std::vector<Index> merged_into(nr_vertices);
+    for (size_t i = 0; i < sorted_vertices.size(); i++) {
+        Index vertex = sorted_vertices[i];
+        if (i > 0 && bits[vertex] == bits[sorted_vertices[i - 1]]) {
+            merged_into[vertex] = merged_into[sorted_vertices[i - 1]];
+            report.merged_vertices++;
+        } else {
+            merged_into[vertex] = vertex;
+        }
+    }
+    for (auto& index : indices)
+        index = merged_into[index];
+
+    // Remove the tetrahedra without volume, then the ones with the same vertices as one before them
+    std::vector<char> removed(nr_tetrahedra, false);
+    for (size_t i = 0; i < nr_tetrahedra; i++) {
+        const Index* tetrahedron = &indices[i * 4];
+        glm::dvec4 positions[4];
+        for (int j = 0; j < 4; j++)
+            positions[j] = glm::dvec4(vertices[tetrahedron[j]].position);
+        double longest_edge = 0.0;
+        for (int j = 0; j < 4; j++) {
+            for (int k = j + 1; k < 4; k++)
+                longest_edge = std::max(longest_edge, glm::distance(positions[j], positions[k]));
+        }
+        // Tetrahedra that lost a vertex to merging have no volume either
+        double volume = tetrahedron_volume(positions[0], positions[1], positions[2], positions[3]);
+        if (volume <= degenerate_ratio * longest_edge * longest_edge * longest_edge) {
+            removed[i] = true;
+            report.degenerate_tetrahedra++;
+        }
+    }
+    std::vector<std::array<Index, 4>> sorted_tetrahedra(nr_tetrahedra);
+    std::vector<Index> tetrahedron_order(nr_tetrahedra);
+    std::iota(tetrahedron_order.begin(), tetrahedron_order.end(), 0);
+    for (size_t i = 0; i < nr_tetrahedra; i++) {
+        std::copy(&indices[i * 4], &indices[i * 4] + 4, sorted_tetrahedra[i].begin());
+        std::sort(sorted_tetrahedra[i].begin(), sorted_tetrahedra[i].end());
+    }
+    std::sort(tetrahedron_order.begin(), tetrahedron_order.end(), [&](Index a, Index b) {
+        return sorted_tetrahedra[a] != sorted_tetrahedra[b] ? sorted_tetrahedra[a] < sorted_tetrahedra[b] : a < b;
+    });
+    for (size_t i = 1; i < nr_tetrahedra; i++) {
+        Index tetrahedron = tetrahedron_order[i];
+        if (!removed[tetrahedron] && sorted_tetrahedra[tetrahedron] == sorted_tetrahedra[tetrahedron_order[i - 1]]) {
+            removed[tetrahedron] = true;
+            report.duplicate_tetrahedra++;
+        }
+    }
+
+    // The vertices the remaining tetrahedra use
+    std::vector<char> used(nr_vertices, false);
+    std::vector<Index> kept_tetrahedra;
+    kept_tetrahedra.reserve(nr_tetrahedra);
+    for (size_t i = 0; i < nr_tetrahedra; i++) {
+        if (removed[i])
+            continue;
+        kept_tetrahedra.push_back((Index)i);
+        for (int j = 0; j < 4; j++)
+            used[indices[i * 4 + j]] = true;
+    }
+    std::vector<Index> kept_vertices;
+    for (size_t i = 0; i < nr_vertices; i++) {
+        if (used[i])
+            kept_vertices.push_back((Index)i);
+        else if (merged_into[i] == i)
+            report.unused_vertices++;
+    }
+
+    // Sort along the curve, everything with the same key keeps its order
+    if (order != TetrahedralMeshOptimizer::Order::Unchanged && kept_vertices.size()) {
+        glm::vec4 min = vertices[kept_vertices[0]].position;
+        glm::vec4 max = min;
+        for (auto vertex : kept_vertices) {
+            min = glm::min(min, vertices[vertex].position);
+            max = glm::max(max, vertices[vertex].position);
+        }
+        glm::vec4 extent = max - min;
+        auto curve_key = [&](const glm::vec4& position) {
+            std::array<uint32_t, 4> coordinates;
+            for (int i = 0; i < 4; i++)
+                coordinates[i] = extent[i] > 0.0f ? (uint32_t)std::clamp((position[i] - min[i]) / extent[i] * 65535.0f, 0.0f, 65535.0f) : 0;
+            return order == TetrahedralMeshOptimizer::Order::Hilbert ? hilbert_key(coordinates) : interleave(coordinates);
+        };
+
+        std::vector<uint64_t> vertex_keys(nr_vertices);
+        for (auto vertex : kept_vertices)
+            vertex_keys[vertex] = curve_key(vertices[vertex].position);
+        std::stable_sort(kept_vertices.begin(), kept_vertices.end(), [&](Index a, Index b) {
+            return vertex_keys[a] < vertex_keys[b];
+        });
+
+        // Tetrahedra are sorted by where their centroids are
+        std::vector<uint64_t> tetrahedron_keys(nr_tetrahedra);
+        for (auto tetrahedron : kept_tetrahedra) {
+            glm::vec4 centroid(0.0f);
+            for (int j = 0; j < 4; j++)
+                centroid += vertices[indices[tetrahedron * 4 + j]].position;
+            tetrahedron_keys[tetrahedron] = curve_key(centroid * 0.25f);
+        }
+        std::stable_sort(kept_tetrahedra.begin(), kept_tetrahedra.end(), [&](Index a, Index b) {
+            return tetrahedron_keys[a] < tetrahedron_keys[b];
+        });
+    }
+
+    std::vector<Index> new_indices_of(nr_vertices);
+    std::vector<Vertex> new_vertices;
+    new_vertices.reserve(kept_vertices.size());
+    for (auto vertex : kept_vertices) {
+        new_indices_of[vertex] = (Index)new_vertices.size();
+        new_vertices.push_back(vertices[vertex]);
+    }
+    std::vector<Index> new_indices;
+    new_indices.reserve(kept_tetrahedra.size() * 4);
+    for (auto tetrahedron : kept_tetrahedra) {
+        for (int j = 0; j < 4; j++)
+            new_indices.push_back(new_indices_of[indices[tetrahedron * 4 + j]]);
+    }
+    mesh->modify_vertices() = std::move(new_vertices);
+    mesh->modify_indices() = std::move(new_indices);
+}
+
+TetrahedralMeshOptimizer::TetrahedralMeshOptimizer(QObject* parent) :
+    QObject(parent),
+    order(Order::Hilbert),
+    degenerate_ratio(1e-6)
+{}
+
+TetrahedralMeshOptimizer::Report TetrahedralMeshOptimizer::optimize(Node* model4d) const {
+    QElapsedTimer timer;
+    timer.start();
+    Report report;
+    report.before = statistics(model4d);
+    for (auto mesh : model4d->meshes) {
+        if (DynamicMesh* dynamic_mesh = dynamic_cast<DynamicMesh*>(mesh))
+            optimize_mesh(dynamic_mesh, order, degenerate_ratio, report);
+    }
+    report.after = statistics(model4d);
+    report.nanoseconds = timer.nsecsElapsed();
+    return report;
+}
+
+TetrahedralMeshOptimizer::ModelStatistics TetrahedralMeshOptimizer::statistics(const Node* model4d) {
+    ModelStatistics statistics;
+    double total_index_span = 0.0;
+    for (const auto mesh : model4d->meshes) {
+        statistics.nr_vertices += mesh->size_vertices();
+        statistics.nr_tetrahedra += mesh->size_indices() / 4;
+        const Index* indices = mesh->get_indices();
+        for (size_t i = 0; i + 4 <= mesh->size_indices(); i += 4) {
+            auto [min, max] = std::minmax({ indices[i], indices[i + 1], indices[i + 2], indices[i + 3] });
+            total_index_span += max - min;
+        }
+    }
+    if (statistics.nr_tetrahedra)
+        statistics.mean_index_span = total_index_span / statistics.nr_tetrahedra;
+    return statistics;
+}
+
+QString TetrahedralMeshOptimizer::Report::to_string() const {
+    return QString("%1 -> %2 vertices (%3 merged, %4 unused), %5 -> %6 tetrahedra (%7 degenerate, %8 duplicates), "
+                   "mean index span %9 -> %10 in %11 ms")
+        .arg(before.nr_vertices).arg(after.nr_vertices).arg(merged_vertices).arg(unused_vertices)
+        .arg(before.nr_tetrahedra).arg(after.nr_tetrahedra).arg(degenerate_tetrahedra).arg(duplicate_tetrahedra)
+        .arg(before.mean_index_span, 0, 'f', 1).arg(after.mean_index_span, 0, 'f', 1).arg(nanoseconds / 1e6, 0, 'f', 3);
+}
+
+void TetrahedralMeshOptimizer::set_order(Order order) {
+    this->order = order;
+}
+
+TetrahedralMeshOptimizer::Order TetrahedralMeshOptimizer::get_order() const {
+    return order;
+}
+
+void TetrahedralMeshOptimizer::set_degenerate_ratio(double ratio) {
+    degenerate_ratio = ratio;
+}
+
+double TetrahedralMeshOptimizer::get_degenerate_ratio() const {
+    return degenerate_ratio;
+}
@@ -0,0 +1,71 @@
+#ifndef TETRAHEDRAL_MESH_OPTIMIZER_HPP
+#define TETRAHEDRAL_MESH_OPTIMIZER_HPP
+
+#include <QObject>
+#include <QString>
+#include "objects/Node.hpp"
+
+/*
+Cleans up and reorders the tetrahedral meshes of a model loaded by ModelLoader before it's prepared for slicing
+
+Each mesh's vertices with exactly the same position are merged, then its tetrahedra that have no volume
+(including the ones that lost a vertex to merging) and the ones with the same vertices as an earlier one are
+removed along with the vertices nothing uses anymore. Both would only slice into zero area or overlapping triangles
+
+Finally the vertices and the tetrahedra are sorted along a space filling curve through the mesh's bounds, so
+tetrahedra next to each other in space are next to each other in memory and use vertices that are too
+The order of each tetrahedron's vertices is kept
+*/
+class TetrahedralMeshOptimizer : public QObject {
+    Q_OBJECT;
+public:
+    enum class Order {
+        // Keeps the order of the file
+        Unchanged,
+        Morton,
+        // Slower to compute than Morton, but never jumps across the bounds
+        Hilbert
+    };
+
+    struct ModelStatistics {
+        size_t nr_vertices = 0;
+        size_t nr_tetrahedra = 0;
+        // The mean of the difference between each tetrahedron's largest and smallest vertex index, lower
+        // means the vertices of a tetrahedron are more likely to share cache lines
+        double mean_index_span = 0.0;
+    };
+
+    struct Report {
+        ModelStatistics before;
+        ModelStatistics after;
+        size_t merged_vertices = 0;
+        size_t unused_vertices = 0;
+        size_t degenerate_tetrahedra = 0;
+        size_t duplicate_tetrahedra = 0;
+        qint64 nanoseconds = 0;
+
+        QString to_string() const;
+    };
+
+    TetrahedralMeshOptimizer(QObject* parent=nullptr);
+    virtual ~TetrahedralMeshOptimizer() {}
+
+    // Optimizes every DynamicMesh of model4d in place, other meshes are skipped
+    // Must run before the model is prepared by a DimensionDropper, since it changes the meshes' indices
+    Report optimize(Node* model4d) const;
+
+    void set_order(Order order);
+    Order get_order() const;
+    // A tetrahedron is degenerate if its volume is at most this times its longest edge cubed
+    // A regular tetrahedron's is about 0.118
+    void set_degenerate_ratio(double ratio);
+    double get_degenerate_ratio() const;
+
+private:
+    static ModelStatistics statistics(const Node* model4d);
+
+    Order order;
+    double degenerate_ratio;
+};
+
+#endif
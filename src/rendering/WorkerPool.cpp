@@ -0,0 +1,77 @@
+#include "WorkerPool.hpp"
+#include <algorithm>
+
+WorkerPool::WorkerPool(int nr_threads) : next_chunk(0), running(false) {
+    nr_threads = std::max(nr_threads, 1);
+    threads.reserve(nr_threads - 1);
+    for (int i = 1; i < nr_threads; i++)
+        threads.emplace_back(&WorkerPool::work, this);
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    run_started.notify_all();
+    for (auto& thread : threads)
+        thread.join();
+}
+
+int WorkerPool::get_nr_threads() const {
+    return (int)threads.size() + 1;
+}
+
+void WorkerPool::run(int nr_chunks, const std::function<void(int)>& function) {
+    if (nr_chunks <= 0)
+        return;
+    // Nothing to split, or the pool is busy with a run this one may be a part of
+    if (nr_chunks == 1 || threads.empty() || running.exchange(true)) {
+        for (int chunk = 0; chunk < nr_chunks; chunk++)
+            function(chunk);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->function = &function;
+        this->nr_chunks = nr_chunks;
+        next_chunk = 0;
+        nr_working_threads = (int)threads.size();
+        generation++;
+    }
+    run_started.notify_all();
+    run_chunks();
+
+    // Every thread has to be done with this run before the next one can change function and nr_chunks
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        run_finished.wait(lock, [this]() { return nr_working_threads == 0; });
+        this->function = nullptr;
+    }
+    running = false;
+}
+
+void WorkerPool::work() {
+    unsigned int last_generation = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            run_started.wait(lock, [&]() { return stopping || generation != last_generation; });
+            if (stopping)
+                return;
+            last_generation = generation;
+        }
+        run_chunks();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            nr_working_threads--;
+        }
+        run_finished.notify_one();
+    }
+}
+
+void WorkerPool::run_chunks() {
+    for (int chunk = next_chunk++; chunk < nr_chunks; chunk = next_chunk++)
+        (*function)(chunk);
+}
@@ -0,0 +1,58 @@
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+A fixed set of threads that's kept around to run chunks of work on, so work split across threads
+many times a frame doesn't pay for creating and joining threads every time
+
+The thread calling run works on the chunks too, so a pool of n threads only starts n - 1 of its own
+Chunks are handed out in order to whichever thread is free, so which thread runs a chunk isn't fixed
+*/
+class WorkerPool {
+public:
+    // nr_threads includes the thread calling run, a pool of 1 thread runs everything on the calling thread
+    explicit WorkerPool(int nr_threads);
+    // Waits for the threads to finish
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    int get_nr_threads() const;
+
+    // Runs function(chunk) for every chunk in [0, nr_chunks) and returns once every chunk is done
+    // A run started while another one is running (from one of its chunks or from another thread)
+    // runs all of its chunks on the calling thread instead of waiting
+    void run(int nr_chunks, const std::function<void(int)>& function);
+
+private:
+    void work();
+    // Runs chunks of the current run until there are none left
+    void run_chunks();
+
+    std::vector<std::thread> threads;
+
+    std::mutex mutex;
+    std::condition_variable run_started;
+    std::condition_variable run_finished;
+    // Incremented by every run, a thread works on a run once it sees a generation it hasn't worked on yet
+    unsigned int generation = 0;
+    // The threads that haven't finished working on the current run
+    int nr_working_threads = 0;
+    bool stopping = false;
+
+    // The current run
+    const std::function<void(int)>* function = nullptr;
+    int nr_chunks = 0;
+    std::atomic<int> next_chunk;
+    std::atomic<bool> running;
+};
+
+#endif
@@ -3,7 +3,13 @@
 #include <algorithm>
 #include <QDebug>
 
-AbstractMesh::AbstractMesh(QObject* parent) : QObject(parent) {
+AbstractMesh::AbstractMesh(QObject* parent) : QObject(parent), transformation(1.0f) {
+    vertex_offset = 0;
+    index_offset = 0;
+    bvh_node_offset = 0;
+    first_triangle = 0;
+    gpu_bvh = false;
+    flat_normals = false;
     material_index = 0;
 }
 
@@ -11,7 +17,108 @@ void AbstractMesh::as_byte_array(unsigned char byte_array[mesh_size_in_opengl],
     unsigned char const* tmp = reinterpret_cast<unsigned char const*>(glm::value_ptr(transformation));
     std::copy(tmp, tmp+64, byte_array);
 
-    uint32_t mat_ind = (uint32_t) material_index;
-    tmp = reinterpret_cast<unsigned char const*>(&mat_ind);
-    std::copy(tmp, tmp+4, byte_array+64);
+    glm::mat4 inverse_transformation = glm::inverse(transformation);
+    tmp = reinterpret_cast<unsigned char const*>(glm::value_ptr(inverse_transformation));
+    std::copy(tmp, tmp+64, byte_array+64);
+
+    int32_t ints[8] = {
+        (int32_t) material_index,
+        (int32_t) is_dynamic(),
+        (int32_t) index_offset,
+        (int32_t) size_indices(),
+        (int32_t) bvh_node_offset,
+        (int32_t) first_triangle,
+        (int32_t) vertex_offset,
+        (int32_t) gpu_bvh
+    };
+    tmp = reinterpret_cast<unsigned char const*>(ints);
+    std::copy(tmp, tmp+sizeof(ints), byte_array+128);
+
+    glm::vec3 position_min, position_extent;
+    get_quantization_range(position_min, position_extent);
+    tmp = reinterpret_cast<unsigned char const*>(glm::value_ptr(position_min));
+    std::copy(tmp, tmp+12, byte_array+160);
+    tmp = reinterpret_cast<unsigned char const*>(glm::value_ptr(position_extent));
+    std::copy(tmp, tmp+12, byte_array+176);
+
+    int32_t flat = (int32_t) flat_normals;
+    tmp = reinterpret_cast<unsigned char const*>(&flat);
+    std::copy(tmp, tmp+4, byte_array+188);
+}
+
+bool AbstractMesh::is_dynamic() const {
+    return false;
+}
+
+BVHUpdate AbstractMesh::update_bvh() {
+    if (!bvh_outdated)
+        return BVHUpdate::None;
+    bvh_outdated = false;
+
+    calculate_triangle_bounds();
+    BVHUpdate update = BVHUpdate::Rebuild;
+    if (same_triangles_as_bvh()) {
+        bvh.refit(triangle_bounds);
+        if (bvh.sah_cost() <= max_bvh_degradation*built_bvh_cost)
+            update = BVHUpdate::Refit;
+    }
+    if (update == BVHUpdate::Rebuild) {
+        bvh.build(triangle_bounds);
+        built_bvh_cost = bvh.sah_cost();
+        bvh_indices.assign(get_indices(), get_indices()+size_indices());
+    }
+
+    const BVHNode& root = bvh.get_nodes()[0];
+    bounds = AABB(root.aabb_min, root.aabb_max);
+    return update;
+}
+
+void AbstractMesh::update_bounds() {
+    const Vertex* vertices = get_vertices();
+    const Index* indices = get_indices();
+    bounds = AABB();
+    for (size_t i=0; i+2<size_indices(); i+=3) {
+        bounds.grow(glm::vec3(vertices[indices[i  ]].position));
+        bounds.grow(glm::vec3(vertices[indices[i+1]].position));
+        bounds.grow(glm::vec3(vertices[indices[i+2]].position));
+    }
+}
+
+const AABB& AbstractMesh::get_bounds() const {
+    return bounds;
+}
+
+void AbstractMesh::get_quantization_range(glm::vec3& min, glm::vec3& extent) const {
+    if (bounds.empty()) {
+        min = glm::vec3(0.0f);
+        extent = glm::vec3(0.0f);
+        return;
+    }
+    min = bounds.min;
+    extent = bounds.max - bounds.min;
+}
+
+void AbstractMesh::calculate_triangle_bounds() {
+    const Vertex* vertices = get_vertices();
+    const Index* indices = get_indices();
+    triangle_bounds.clear();
+    triangle_bounds.reserve(size_indices()/3);
+    for (size_t i=0; i+2<size_indices(); i+=3) {
+        triangle_bounds.push_back(BVH::triangle_bounds(
+            glm::vec3(vertices[indices[i  ]].position),
+            glm::vec3(vertices[indices[i+1]].position),
+            glm::vec3(vertices[indices[i+2]].position)
+        ));
+    }
+}
+
+bool AbstractMesh::same_triangles_as_bvh() const {
+    // A BVH can only be refit if every triangle is still made up of the same vertices
+    return !bvh.get_nodes().empty() &&
+           size_indices() == bvh_indices.size() &&
+           std::equal(bvh_indices.begin(), bvh_indices.end(), get_indices());
+}
+
+const BVH& AbstractMesh::get_bvh() const {
+    return bvh;
 }
@@ -5,21 +5,43 @@
 #include <glm/glm.hpp>
 #include "Vertex.hpp"
 #include "Material.hpp"
+#include "../BVH.hpp"
 
 class Node;
 
-constexpr int mesh_size_in_opengl = 80;
+constexpr int mesh_size_in_opengl = 192;
 
 typedef int32_t MeshIndex;
 
+enum class BVHUpdate {
+    None,
+    Refit,
+    Rebuild
+};
+
 class AbstractMesh : public QObject {
     Q_OBJECT;
 public:
     AbstractMesh(QObject* parent=nullptr);
     virtual ~AbstractMesh() {}
 
+    // Where the mesh's data starts in the renderer's buffers
+    // Set by the renderer every time the mesh is uploaded
+    // vertex_offset is also the base vertex the shaders add to the mesh's indices
     int vertex_offset;
+    int index_offset;
+    int bvh_node_offset;
+    int first_triangle;
+    // Whether bvh_node_offset indexes the BVH nodes GPUBVHBuilder built instead of the mesh's own BVH
+    bool gpu_bvh;
+    // Whether the ray tracer shades the mesh with each triangle's own normal instead of
+    // interpolating its vertices' normals, so flat shaded meshes can share their vertices
+    bool flat_normals;
+
     int material_index;
+    // The combined transformation of all of the mesh's parent nodes
+    // Updated every time Node::add_mesh_data is called
+    glm::mat4 transformation;
 
     virtual void set_mesh_index(int mesh_index) = 0;
     virtual int get_mesh_index() const = 0;
@@ -29,6 +51,26 @@ public:
     virtual const Vertex* get_vertices() const = 0;
     virtual const Index* get_indices() const = 0;
 
+    // Dynamic meshes are uploaded to separate buffers every frame
+    virtual bool is_dynamic() const;
+
+    // The BVH is over the mesh's triangles in mesh space (before any node transformations
+    // are applied) so moving the mesh doesn't require it to be rebuilt
+    // If the mesh has been modified since the BVH was last updated, the BVH is refit when
+    // the triangles are the same (only the vertices moved) and rebuilt otherwise
+    // Returns what was done so the renderer can keep count
+    virtual BVHUpdate update_bvh();
+    const BVH& get_bvh() const;
+
+    // Only recalculates the mesh space bounds of the mesh's triangles, leaving the BVH outdated
+    // For meshes whose BVH is built on the GPU instead
+    virtual void update_bounds();
+    // Updated by both update_bvh and update_bounds
+    const AABB& get_bounds() const;
+    // The range static positions are quantized to when quantized_static_positions is true
+    // A mesh without triangles gets an empty range
+    void get_quantization_range(glm::vec3& min, glm::vec3& extent) const;
+
     void as_byte_array(unsigned char byte_array[mesh_size_in_opengl], const glm::mat4& transformation) const;
 
     inline void set_node_parent(Node* parent) { node_parent = parent; }
@@ -36,6 +78,23 @@ public:
 protected:
     MeshIndex mesh_index;
     Node* node_parent = nullptr;
+
+    BVH bvh;
+    bool bvh_outdated = true;
+    // Mesh space bounds of the mesh's triangles
+    AABB bounds;
+
+private:
+    // A refit BVH is rebuilt once its SAH cost is this many times the cost it was built with
+    static constexpr float max_bvh_degradation = 2.0f;
+
+    void calculate_triangle_bounds();
+    bool same_triangles_as_bvh() const;
+
+    std::vector<AABB> triangle_bounds;
+    // The indices the BVH was last built with
+    std::vector<Index> bvh_indices;
+    float built_bvh_cost = 0.0f;
 };
 
 #endif
@@ -6,6 +6,12 @@ DynamicMesh::DynamicMesh(const std::vector<Vertex>& vertices, const std::vector<
     indices(indices)
 {}
 
+DynamicMesh::DynamicMesh(std::vector<Vertex>&& vertices, std::vector<Index>&& indices, QObject* parent) :
+    AbstractMesh(parent),
+    vertices(std::move(vertices)),
+    indices(std::move(indices))
+{}
+
 void DynamicMesh::set_mesh_index(int mesh_index) {
     this->mesh_index = mesh_index;
     for (unsigned int i=0; i<vertices.size(); i++) {
@@ -33,10 +39,16 @@ const Index* DynamicMesh::get_indices() const {
     return indices.data();
 }
 
+bool DynamicMesh::is_dynamic() const {
+    return true;
+}
+
 std::vector<Vertex>& DynamicMesh::modify_vertices() {
+    bvh_outdated = true;
     return vertices;
 }
 
 std::vector<Index>& DynamicMesh::modify_indices() {
+    bvh_outdated = true;
     return indices;
 }
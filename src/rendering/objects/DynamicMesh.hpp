@@ -13,6 +13,8 @@ A dynamic mesh can change its number of vertices and modify their positions
 class DynamicMesh : public AbstractMesh {
 public:
     DynamicMesh(const std::vector<Vertex>& vertices, const std::vector<Index>& indices, QObject* parent=nullptr);
+    // Moves the vertices and indices into the mesh instead of copying them
+    DynamicMesh(std::vector<Vertex>&& vertices, std::vector<Index>&& indices, QObject* parent=nullptr);
 
     void set_mesh_index(int mesh_index) override;
     int get_mesh_index() const override;
@@ -23,6 +25,10 @@ public:
     const Vertex* get_vertices() const override;
     const Index* get_indices() const override;
 
+    bool is_dynamic() const override;
+
+    // Both of these mark the mesh's BVH as outdated
+    // If only the vertices change, the BVH is refit instead of rebuilt
     std::vector<Vertex>& modify_vertices();
     std::vector<Index>& modify_indices();
 private:
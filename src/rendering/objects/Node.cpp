@@ -23,6 +23,7 @@ void Node::add_mesh_data(std::vector<unsigned char>& resulting_mesh_data, glm::m
     parent_transformation *= transformation;
 
     for (auto mesh : meshes) {
+        mesh->transformation = parent_transformation;
         mesh->as_byte_array(resulting_mesh_data.data()+mesh->get_mesh_index()*mesh_size_in_opengl, parent_transformation);
     }
 
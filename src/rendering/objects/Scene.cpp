@@ -40,13 +40,35 @@ bool Scene::remove_root_node(Node* root_node) {
     return true;
 }
 
+bool Scene::replace_root_node(Node* old_root_node, Node* new_root_node) {
+    auto root_node_it = std::find(root_nodes.begin(), root_nodes.end(), old_root_node);
+    if (root_node_it == root_nodes.end()) {
+        add_root_node(new_root_node);
+        return false;
+    }
+
+    remove_node_meshes(old_root_node);
+    QList<Node*> old_child_nodes = old_root_node->findChildren<Node*>();
+    for (auto node : old_child_nodes) {
+        remove_node_meshes(node);
+    }
+
+    *root_node_it = new_root_node;
+    add_node_meshes(new_root_node);
+    QList<Node*> new_child_nodes = new_root_node->findChildren<Node*>();
+    for (auto node : new_child_nodes) {
+        add_node_meshes(node);
+    }
+    return true;
+}
+
 const std::vector<Node*>& Scene::get_root_nodes() {
     return root_nodes;
 }
 
 void Scene::add_node_meshes(Node* node) {
     for (auto mesh : node->meshes) {
-        if (dynamic_cast<DynamicMesh*>(mesh)) {
+        if (mesh && mesh->is_dynamic()) {
             add_dynamic_mesh(mesh, false);
         } else if (mesh) {
             add_static_mesh(mesh, false);
@@ -56,7 +78,7 @@ void Scene::add_node_meshes(Node* node) {
 
 void Scene::remove_node_meshes(Node* node) {
     for (auto mesh : node->meshes) {
-        if (dynamic_cast<DynamicMesh*>(mesh)) {
+        if (mesh && mesh->is_dynamic()) {
             remove_dynamic_mesh(mesh);
         } else if (mesh) {
             remove_static_mesh(mesh);
@@ -17,6 +17,9 @@ public:
     // returns true if root_node is in root_nodes
     // returns false if root_node was not found in root_nodes
     bool remove_root_node(Node* root_node);
+    // Swaps old_root_node's meshes for new_root_node's in one step, keeping its place in root_nodes
+    // returns false (after adding new_root_node like add_root_node) if old_root_node was not found in root_nodes
+    bool replace_root_node(Node* old_root_node, Node* new_root_node);
     const std::vector<Node*>& get_root_nodes();
 
     // Orphaned is true if the mesh is not a part of a node
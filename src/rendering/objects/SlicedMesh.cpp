@@ -0,0 +1,66 @@
+#include "SlicedMesh.hpp"
+
+SlicedMesh::SlicedMesh(const AbstractMesh* mesh4d, QObject* parent) :
+    AbstractMesh(parent),
+    mesh4d(mesh4d),
+    hyperplane(0.0f),
+    nr_triangles(0)
+{}
+
+void SlicedMesh::set_mesh_index(int mesh_index) {
+    // The slicer writes the vertices, they never store their mesh index
+    this->mesh_index = mesh_index;
+}
+
+int SlicedMesh::get_mesh_index() const {
+    return mesh_index;
+}
+
+size_t SlicedMesh::size_vertices() const {
+    // Every triangle has its own vertices so it can have a flat normal
+    return 3*nr_triangles;
+}
+
+size_t SlicedMesh::size_indices() const {
+    return 3*nr_triangles;
+}
+
+const Vertex* SlicedMesh::get_vertices() const {
+    return nullptr;
+}
+
+const Index* SlicedMesh::get_indices() const {
+    return nullptr;
+}
+
+bool SlicedMesh::is_dynamic() const {
+    return true;
+}
+
+BVHUpdate SlicedMesh::update_bvh() {
+    update_bounds();
+    return BVHUpdate::None;
+}
+
+void SlicedMesh::update_bounds() {
+    const Vertex* vertices4d = mesh4d->get_vertices();
+    bounds = AABB();
+    for (size_t i = 0; i < mesh4d->size_vertices(); i++)
+        bounds.grow(hyperplane.project(vertices4d[i].position));
+}
+
+void SlicedMesh::set_hyperplane(const Hyperplane4D& hyperplane) {
+    this->hyperplane = hyperplane;
+}
+
+const Hyperplane4D& SlicedMesh::get_hyperplane() const {
+    return hyperplane;
+}
+
+const AbstractMesh* SlicedMesh::get_mesh4d() const {
+    return mesh4d;
+}
+
+void SlicedMesh::set_nr_triangles(int nr_triangles) {
+    this->nr_triangles = nr_triangles;
+}
@@ -0,0 +1,52 @@
+#ifndef SLICED_MESH_HPP
+#define SLICED_MESH_HPP
+
+#include <QObject>
+#include <glm/glm.hpp>
+
+#include "AbstractMesh.hpp"
+#include "../Hyperplane4D.hpp"
+
+/*
+A dynamic mesh that is the cross section of a 4D mesh, sliced on the GPU by the renderer every
+frame (see GPUDimensionDropper) so its triangles never exist on the CPU
+
+get_vertices and get_indices return nothing, size_vertices and size_indices are the size of
+the most recent slice
+Its BVH is always built on the GPU, update_bvh and update_bounds only update its bounds
+*/
+class SlicedMesh : public AbstractMesh {
+public:
+    // mesh4d must outlive the sliced mesh and its tetrahedra must not change
+    SlicedMesh(const AbstractMesh* mesh4d, QObject* parent=nullptr);
+
+    void set_mesh_index(int mesh_index) override;
+    int get_mesh_index() const override;
+
+    size_t size_vertices() const override;
+    size_t size_indices() const override;
+
+    const Vertex* get_vertices() const override;
+    const Index* get_indices() const override;
+
+    bool is_dynamic() const override;
+
+    BVHUpdate update_bvh() override;
+    // The bounds of the 4D mesh projected into the hyperplane, which always contain the slice
+    void update_bounds() override;
+
+    void set_hyperplane(const Hyperplane4D& hyperplane);
+    const Hyperplane4D& get_hyperplane() const;
+
+    const AbstractMesh* get_mesh4d() const;
+
+    // Set by the renderer once the slicer has counted the triangles
+    void set_nr_triangles(int nr_triangles);
+
+private:
+    const AbstractMesh* mesh4d;
+    Hyperplane4D hyperplane;
+    int nr_triangles;
+};
+
+#endif
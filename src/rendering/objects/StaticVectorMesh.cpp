@@ -0,0 +1,33 @@
+#include "StaticVectorMesh.hpp"
+
+StaticVectorMesh::StaticVectorMesh(std::vector<Vertex>&& vertices, std::vector<Index>&& indices, QObject* parent) :
+    AbstractMesh(parent),
+    vertices(std::move(vertices)),
+    indices(std::move(indices))
+{}
+
+void StaticVectorMesh::set_mesh_index(int mesh_index) {
+    this->mesh_index = mesh_index;
+    for (auto& vertex : vertices)
+        vertex.mesh_index = mesh_index;
+}
+
+int StaticVectorMesh::get_mesh_index() const {
+    return mesh_index;
+}
+
+size_t StaticVectorMesh::size_vertices() const {
+    return vertices.size();
+}
+
+size_t StaticVectorMesh::size_indices() const {
+    return indices.size();
+}
+
+const Vertex* StaticVectorMesh::get_vertices() const {
+    return vertices.data();
+}
+
+const Index* StaticVectorMesh::get_indices() const {
+    return indices.data();
+}
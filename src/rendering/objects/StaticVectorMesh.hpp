@@ -0,0 +1,32 @@
+#ifndef STATIC_VECTOR_MESH_HPP
+#define STATIC_VECTOR_MESH_HPP
+
+#include <QObject>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "AbstractMesh.hpp"
+
+/*
+A static mesh whose number of vertices is only known at runtime, like a mesh loaded from a file
+Like a StaticMesh, its vertices can't change so it's only uploaded to the GPU once
+*/
+class StaticVectorMesh : public AbstractMesh {
+public:
+    // The vertices and indices are moved into the mesh
+    StaticVectorMesh(std::vector<Vertex>&& vertices, std::vector<Index>&& indices, QObject* parent=nullptr);
+
+    void set_mesh_index(int mesh_index) override;
+    int get_mesh_index() const override;
+
+    size_t size_vertices() const override;
+    size_t size_indices() const override;
+
+    const Vertex* get_vertices() const override;
+    const Index* get_indices() const override;
+private:
+    std::vector<Vertex> vertices;
+    std::vector<Index> indices;
+};
+
+#endif
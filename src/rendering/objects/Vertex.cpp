@@ -1,5 +1,22 @@
 #include "Vertex.hpp"
 #include <algorithm>
+#include <glm/packing.hpp>
+
+// Projects the normal onto the octahedron |x|+|y|+|z| = 1 and folds the lower half over
+// the upper half so it can be stored as two snorm16s
+// Must be the inverse of decode_octahedral in raytracer.glsl
+static uint32_t encode_octahedral(const glm::vec3& normal) {
+    float l1_norm = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+    if (l1_norm == 0.0f)
+        return glm::packSnorm2x16(glm::vec2(0.0f));
+
+    glm::vec2 encoded = glm::vec2(normal) / l1_norm;
+    if (normal.z < 0.0f) {
+        glm::vec2 sign(encoded.x >= 0.0f ? 1.0f : -1.0f, encoded.y >= 0.0f ? 1.0f : -1.0f);
+        encoded = (1.0f - glm::abs(glm::vec2(encoded.y, encoded.x))) * sign;
+    }
+    return glm::packSnorm2x16(encoded);
+}
 
 Vertex::Vertex(glm::vec4 position, glm::vec4 normal, glm::vec2 tex_coords, int mesh_index) : 
     position(position),
@@ -8,19 +25,55 @@ Vertex::Vertex(glm::vec4 position, glm::vec4 normal, glm::vec2 tex_coords, int m
     mesh_index(mesh_index)
 {}
 
-void Vertex::as_byte_array(unsigned char byte_array[vertex_struct_size_in_opengl]) const {
+void Vertex::position_as_byte_array(unsigned char byte_array[vertex_position_size_in_opengl]) const {
     static_assert(sizeof(glm::vec4) == 16, "Vertex overflow");
-    static_assert(sizeof(glm::vec2) == 8, "Vertex overflow");
 
     unsigned char const* tmp = reinterpret_cast<unsigned char const*>(&position);
     std::copy(tmp, tmp+16, byte_array);
+}
 
-    tmp = reinterpret_cast<unsigned char const*>(&normal);
-    std::copy(tmp, tmp+16, byte_array+16);
+void Vertex::quantized_position_as_byte_array(unsigned char byte_array[quantized_vertex_position_size_in_opengl], const glm::vec3& bounds_min, const glm::vec3& bounds_extent) const {
+    glm::vec3 relative(0.0f);
+    for (int i=0; i<3; i++) {
+        if (bounds_extent[i] > 0.0f)
+            relative[i] = glm::clamp((position[i] - bounds_min[i]) / bounds_extent[i], 0.0f, 1.0f);
+    }
+    uint32_t quantized[2] = {
+        glm::packUnorm2x16(glm::vec2(relative.x, relative.y)),
+        glm::packUnorm2x16(glm::vec2(relative.z, 0.0f))
+    };
+    unsigned char const* tmp = reinterpret_cast<unsigned char const*>(quantized);
+    std::copy(tmp, tmp+8, byte_array);
+}
+
+void Vertex::attributes_as_byte_array(unsigned char byte_array[vertex_attributes_size_in_opengl]) const {
+    static_assert(sizeof(glm::vec4) == 16, "Vertex overflow");
+    static_assert(sizeof(glm::vec2) == 8, "Vertex overflow");
+
+    if (compressed_vertex_attributes) {
+        uint32_t packed[2] = {
+            encode_octahedral(glm::vec3(normal)),
+            glm::packHalf2x16(tex_coords)
+        };
+        unsigned char const* tmp = reinterpret_cast<unsigned char const*>(packed);
+        std::copy(tmp, tmp+8, byte_array);
+        return;
+    }
+
+    unsigned char const* tmp = reinterpret_cast<unsigned char const*>(&normal);
+    std::copy(tmp, tmp+16, byte_array);
 
     tmp = reinterpret_cast<unsigned char const*>(&tex_coords);
-    std::copy(tmp, tmp+8, byte_array+32);
+    std::copy(tmp, tmp+8, byte_array+16);
 
     tmp = reinterpret_cast<unsigned char const*>(&mesh_index);
-    std::copy(tmp, tmp+4, byte_array+40);
+    std::copy(tmp, tmp+4, byte_array+24);
+
+    std::fill(byte_array+28, byte_array+32, 0);
 }
+
+TriangleRecord::TriangleRecord(const glm::vec4& v0, const glm::vec4& v1, const glm::vec4& v2) :
+    v0(glm::vec3(v0), 0.0f),
+    edge1(glm::vec3(v1-v0), 0.0f),
+    edge2(glm::vec3(v2-v0), 0.0f)
+{}
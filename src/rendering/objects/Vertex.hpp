@@ -3,7 +3,18 @@
 
 #include <glm/glm.hpp>
 
-constexpr int vertex_struct_size_in_opengl = 48;
+// When true, normals are octahedral encoded into 32 bits and texture coordinates are stored as half floats
+// MUST match COMPRESSED_VERTEX_ATTRIBUTES in raytracer.glsl
+constexpr bool compressed_vertex_attributes = true;
+// When true, static positions are stored as 16 bit fixed point relative to their mesh's bounds
+// MUST match QUANTIZED_STATIC_POSITIONS in raytracer.glsl
+constexpr bool quantized_static_positions = false;
+
+// On the GPU, vertices are split into a position stream and an attribute stream
+// so ray traversal only ever has to read positions
+constexpr int vertex_position_size_in_opengl = 16;
+constexpr int quantized_vertex_position_size_in_opengl = 8;
+constexpr int vertex_attributes_size_in_opengl = compressed_vertex_attributes ? 8 : 32;
 
 struct Vertex {
                             // Base Alignment  // Aligned Offset
@@ -30,19 +41,54 @@ struct Vertex {
     Vertex(glm::vec4 position, glm::vec4 normal=glm::vec4(0.0f), glm::vec2 tex_coords=glm::vec2(0.0f), int mesh_index=0);
     Vertex() = default;
 
-    void as_byte_array(unsigned char byte_array[vertex_struct_size_in_opengl]) const;
+    // Must exactly match the memory layout of an element of StaticPositionBuffer in GLSL
+    //                      // Base Alignment  // Aligned Offset
+    // vec4 position        // 16              // 0
+    // Total Size: 16
+    void position_as_byte_array(unsigned char byte_array[vertex_position_size_in_opengl]) const;
+    // Must exactly match the memory layout of an element of StaticPositionBuffer in GLSL when
+    // QUANTIZED_STATIC_POSITIONS is 1
+    //                      // Base Alignment  // Aligned Offset
+    // uint x, y            // 4               // 0
+    // uint z               // 4               // 4
+    // Total Size: 8
+    // Positions outside of the bounds are clamped to them
+    void quantized_position_as_byte_array(unsigned char byte_array[quantized_vertex_position_size_in_opengl], const glm::vec3& bounds_min, const glm::vec3& bounds_extent) const;
+
+    // Must exactly match the memory layout of the StoredVertexAttributes struct in GLSL
+    // With compressed_vertex_attributes:
+    //                      // Base Alignment  // Aligned Offset
+    // uint normal          // 4               // 0
+    // uint tex_coords      // 4               // 4
+    // Total Size: 8
+    // Otherwise:
+    //                      // Base Alignment  // Aligned Offset
+    // vec4 normal          // 16              // 0
+    // vec2 tex_coords      // 8               // 16
+    // int mesh_index       // 4               // 24
+    // (PADDING)            // 4               // 28
+    // Total Size: 32
+    void attributes_as_byte_array(unsigned char byte_array[vertex_attributes_size_in_opengl]) const;
 };
 
-/*
-If the compiler doesn't add any padding, the memory layout commented above should be correct
+typedef unsigned int Index;
+
+constexpr int triangle_record_size_in_opengl = 48;
 
-The C standard doesn't specify how/when padding should be used so we have to have make sure the memory
-layout is what we expect
+// Everything needed to intersect a ray with a triangle (Möller–Trumbore) without
+// going through the indices
+struct TriangleRecord {
+                            // Base Alignment  // Aligned Offset
+    glm::vec4 v0;           // 16              // 0
+    glm::vec4 edge1;        // 16              // 16
+    glm::vec4 edge2;        // 16              // 32
 
-The memory layout must exactly match the memory layout of the Vertex struct in GLSL
-*/
-constexpr bool vertex_is_opengl_compatible = (sizeof(Vertex) == vertex_struct_size_in_opengl) && std::is_standard_layout<Vertex>::value;
+    // Total Size: 48
 
-typedef unsigned int Index;
+    // Only the xyz of each position is used
+    TriangleRecord(const glm::vec4& v0, const glm::vec4& v1, const glm::vec4& v2);
+    TriangleRecord() = default;
+};
+constexpr bool triangle_record_is_opengl_compatible = (sizeof(TriangleRecord) == triangle_record_size_in_opengl) && std::is_standard_layout<TriangleRecord>::value;
 
 #endif
@@ -0,0 +1,343 @@
+#version 450 core
+
+/*
+Builds a linear BVH (LBVH) over the triangles of one dynamic mesh at a time
+
+Stages (in order, with a memory barrier between each):
+    morton_codes        One thread per triangle
+    radix_histogram     One work group per RADIX_BLOCK_SIZE triangles  \
+    radix_scan          A single work group                             > 8 times (4 bits at a time)
+    radix_scatter       One work group per RADIX_BLOCK_SIZE triangles  /
+    build_hierarchy     One thread per internal node (nr_triangles-1)
+    compute_bounds      One thread per triangle
+
+The hierarchy is built the same way as in "Maximizing Parallelism in the
+Construction of BVHs, Octrees, and k-d Trees" (Karras 2012)
+*/
+
+// This MUST match RADIX_BLOCK_SIZE in GPUBVHBuilder.hpp
+#define RADIX_BLOCK_SIZE 128
+#define RADIX_BITS 4
+#define RADIX_NR_DIGITS 16
+
+layout (local_size_x = RADIX_BLOCK_SIZE, local_size_y = 1, local_size_z = 1) in;
+
+layout (std430, binding=4) buffer DynamicPositionBuffer {
+    // Same as DynamicPositionBuffer in raytracer.glsl
+    vec4 dynamic_positions[];
+};
+
+layout (std430, binding=2) buffer DynamicIndexBuffer {
+    int dynamic_indices[];
+};
+
+struct LBVHNode {
+                        // Base Alignment  // Aligned Offset
+    vec3 aabb_min;      // 16              // 0
+    int left_child;     // 4               // 12
+    vec3 aabb_max;      // 16              // 16
+    int right_child;    // 4               // 28
+
+    // Children >= 0 are internal nodes
+    // Children < 0 are leaves: ~child is the leaf's triangle (relative to the mesh's first triangle)
+    // so tracing rays never has to go through the sorted triangles
+
+    // Total Size: 32
+};
+
+layout (std430, binding=12) coherent buffer LBVHNodeBuffer {
+    // Every mesh gets as many nodes as it has triangles (one is unused) starting at first_triangle
+    // The root is lbvh_nodes[first_triangle]
+    LBVHNode lbvh_nodes[];
+};
+
+layout (std430, binding=20) buffer LBVHPrimitiveBuffer {
+    // Two halves of nr_total_triangles each that the radix sort ping-pongs between
+    // Once the sort is done, the first half holds the mesh's triangles in Morton order
+    uint sort_values[];
+};
+
+layout (std430, binding=21) buffer LBVHKeyBuffer {
+    // Morton codes, laid out the same way as sort_values
+    uint sort_keys[];
+};
+
+layout (std430, binding=22) buffer RadixHistogramBuffer {
+    // Digit major: the count of digit d in block b is at d*nr_blocks + b
+    // radix_scan turns the counts into offsets
+    uint histograms[];
+};
+
+layout (std430, binding=23) buffer LBVHParentBuffer {
+    // Two per triangle starting at 2*first_triangle: internal nodes first, then leaves
+    // The root's parent is -1
+    int parents[];
+};
+
+layout (std430, binding=24) coherent buffer LBVHFlagBuffer {
+    // One per internal node; counts how many children have their bounds ready
+    uint flags[];
+};
+
+// Where the mesh being built starts in the LBVH buffers
+uniform int first_triangle;
+// Where the mesh being built starts in dynamic_indices
+uniform int first_index;
+// Where the mesh being built starts in dynamic_positions (indices are relative to it)
+uniform int base_vertex;
+uniform int nr_triangles;
+// Total number of triangles across every dynamic mesh (the size of each half of the sort buffers)
+uniform int nr_total_triangles;
+
+// Bounds of the mesh (in mesh space) used to quantize the centroids
+uniform vec3 bounds_min;
+uniform vec3 bounds_max;
+
+// Which half of the sort buffers the current radix pass reads from
+uniform int sort_source;
+// Which bits the current radix pass sorts by
+uniform int radix_shift;
+
+shared uint local_histogram[RADIX_NR_DIGITS];
+shared uint local_digits[RADIX_BLOCK_SIZE];
+shared uint scan_sums[RADIX_BLOCK_SIZE];
+
+vec3 get_position(int index) {
+    return dynamic_positions[index].xyz;
+}
+
+void get_triangle(uint triangle, out vec3 v0, out vec3 v1, out vec3 v2) {
+    int first = first_index + int(triangle)*3;
+    v0 = get_position(base_vertex + dynamic_indices[first]);
+    v1 = get_position(base_vertex + dynamic_indices[first+1]);
+    v2 = get_position(base_vertex + dynamic_indices[first+2]);
+}
+
+uint expand_bits(uint v) {
+    // Inserts two 0 bits after each of the 10 low bits of v
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+uint morton_code(vec3 point) {
+    // point must be in [0,1]
+    uvec3 quantized = uvec3(clamp(point * 1024.0f, 0.0f, 1023.0f));
+    return expand_bits(quantized.x) * 4u + expand_bits(quantized.y) * 2u + expand_bits(quantized.z);
+}
+
+subroutine void LBVHStage();
+subroutine uniform LBVHStage stage;
+
+subroutine(LBVHStage) void morton_codes() {
+    int i = int(gl_GlobalInvocationID.x);
+    if (i >= nr_triangles)
+        return;
+
+    vec3 v0, v1, v2;
+    get_triangle(uint(i), v0, v1, v2);
+    vec3 center = (v0 + v1 + v2) / 3.0f;
+
+    // Flat meshes would otherwise divide by 0
+    vec3 extent = max(bounds_max - bounds_min, vec3(1e-20f));
+    sort_keys[first_triangle + i] = morton_code((center - bounds_min) / extent);
+    sort_values[first_triangle + i] = uint(i);
+}
+
+subroutine(LBVHStage) void radix_histogram() {
+    uint local_id = gl_LocalInvocationID.x;
+    uint block = gl_WorkGroupID.x;
+    uint nr_blocks = gl_NumWorkGroups.x;
+    int i = int(gl_GlobalInvocationID.x);
+
+    if (local_id < RADIX_NR_DIGITS) {
+        local_histogram[local_id] = 0u;
+    }
+    barrier();
+
+    if (i < nr_triangles) {
+        uint key = sort_keys[sort_source*nr_total_triangles + first_triangle + i];
+        uint digit = (key >> radix_shift) & uint(RADIX_NR_DIGITS-1);
+        atomicAdd(local_histogram[digit], 1u);
+    }
+    barrier();
+
+    if (local_id < RADIX_NR_DIGITS) {
+        histograms[local_id*nr_blocks + block] = local_histogram[local_id];
+    }
+}
+
+subroutine(LBVHStage) void radix_scan() {
+    // Exclusive scan over every block's histogram
+    // Each thread sums a contiguous chunk, the chunk sums are scanned, then each chunk is scanned
+    uint local_id = gl_LocalInvocationID.x;
+    uint nr_blocks = (nr_triangles + RADIX_BLOCK_SIZE-1) / RADIX_BLOCK_SIZE;
+    uint size = nr_blocks * RADIX_NR_DIGITS;
+    uint chunk_size = (size + RADIX_BLOCK_SIZE-1) / RADIX_BLOCK_SIZE;
+    uint chunk_begin = min(local_id * chunk_size, size);
+    uint chunk_end = min(chunk_begin + chunk_size, size);
+
+    uint sum = 0u;
+    for (uint i=chunk_begin; i<chunk_end; i++) {
+        sum += histograms[i];
+    }
+    scan_sums[local_id] = sum;
+    barrier();
+
+    if (local_id == 0u) {
+        uint total = 0u;
+        for (uint i=0u; i<RADIX_BLOCK_SIZE; i++) {
+            uint chunk_sum = scan_sums[i];
+            scan_sums[i] = total;
+            total += chunk_sum;
+        }
+    }
+    barrier();
+
+    uint offset = scan_sums[local_id];
+    for (uint i=chunk_begin; i<chunk_end; i++) {
+        uint count = histograms[i];
+        histograms[i] = offset;
+        offset += count;
+    }
+}
+
+subroutine(LBVHStage) void radix_scatter() {
+    uint local_id = gl_LocalInvocationID.x;
+    uint block = gl_WorkGroupID.x;
+    uint nr_blocks = gl_NumWorkGroups.x;
+    int i = int(gl_GlobalInvocationID.x);
+    bool valid = i < nr_triangles;
+
+    int source = sort_source*nr_total_triangles + first_triangle;
+    int destination = (1-sort_source)*nr_total_triangles + first_triangle;
+
+    uint key = 0u;
+    uint value = 0u;
+    uint digit = RADIX_NR_DIGITS;
+    if (valid) {
+        key = sort_keys[source + i];
+        value = sort_values[source + i];
+        digit = (key >> radix_shift) & uint(RADIX_NR_DIGITS-1);
+    }
+    local_digits[local_id] = digit;
+    barrier();
+
+    if (!valid)
+        return;
+
+    // Counting the earlier elements in the block with the same digit keeps the sort stable
+    uint rank = 0u;
+    for (uint j=0u; j<local_id; j++) {
+        rank += uint(local_digits[j] == digit);
+    }
+
+    uint position = histograms[digit*nr_blocks + block] + rank;
+    sort_keys[destination + position] = key;
+    sort_values[destination + position] = value;
+}
+
+int common_prefix(int i, int j) {
+    // Length of the common prefix of keys i and j, or -1 if j is out of range
+    // Equal keys are told apart by their indices
+    if (j < 0 || j >= nr_triangles)
+        return -1;
+    uint key_i = sort_keys[first_triangle + i];
+    uint key_j = sort_keys[first_triangle + j];
+    if (key_i == key_j)
+        return 32 + (31 - findMSB(uint(i ^ j)));
+    return 31 - findMSB(key_i ^ key_j);
+}
+
+subroutine(LBVHStage) void build_hierarchy() {
+    int i = int(gl_GlobalInvocationID.x);
+    if (i == 0) {
+        parents[2*first_triangle] = -1;
+    }
+    if (i >= nr_triangles-1)
+        return;
+
+    // Which direction the node's range extends in
+    int d = common_prefix(i, i+1) > common_prefix(i, i-1) ? 1 : -1;
+
+    // Find the other end of the range
+    int min_prefix = common_prefix(i, i-d);
+    int max_length = 2;
+    while (common_prefix(i, i + max_length*d) > min_prefix) {
+        max_length *= 2;
+    }
+    int length = 0;
+    for (int t=max_length/2; t>=1; t/=2) {
+        if (common_prefix(i, i + (length+t)*d) > min_prefix) {
+            length += t;
+        }
+    }
+    int j = i + length*d;
+
+    // Find where the range splits
+    int node_prefix = common_prefix(i, j);
+    int split = 0;
+    int step = length;
+    do {
+        step = (step+1) / 2;
+        if (common_prefix(i, i + (split+step)*d) > node_prefix) {
+            split += step;
+        }
+    } while (step > 1);
+    int gamma = i + split*d + min(d, 0);
+
+    bool left_is_leaf = min(i, j) == gamma;
+    bool right_is_leaf = max(i, j) == gamma+1;
+    lbvh_nodes[first_triangle + i].left_child = left_is_leaf ? ~int(sort_values[first_triangle + gamma]) : gamma;
+    lbvh_nodes[first_triangle + i].right_child = right_is_leaf ? ~int(sort_values[first_triangle + gamma+1]) : gamma+1;
+
+    int parent_offset = 2*first_triangle;
+    parents[parent_offset + (left_is_leaf ? nr_triangles + gamma : gamma)] = i;
+    parents[parent_offset + (right_is_leaf ? nr_triangles + gamma+1 : gamma+1)] = i;
+
+    flags[first_triangle + i] = 0u;
+}
+
+void get_child_bounds(int child, out vec3 aabb_min, out vec3 aabb_max) {
+    if (child >= 0) {
+        aabb_min = lbvh_nodes[first_triangle + child].aabb_min;
+        aabb_max = lbvh_nodes[first_triangle + child].aabb_max;
+    } else {
+        vec3 v0, v1, v2;
+        get_triangle(uint(~child), v0, v1, v2);
+        aabb_min = min(min(v0, v1), v2);
+        aabb_max = max(max(v0, v1), v2);
+    }
+}
+
+subroutine(LBVHStage) void compute_bounds() {
+    // Walk up from every leaf
+    // The first child to reach a node stops there; the second one computes the node's
+    // bounds (both children are ready by then) and carries on up
+    int i = int(gl_GlobalInvocationID.x);
+    if (i >= nr_triangles)
+        return;
+
+    int parent_offset = 2*first_triangle;
+    int node = parents[parent_offset + nr_triangles + i];
+    while (node != -1) {
+        if (atomicAdd(flags[first_triangle + node], 1u) == 0u)
+            return;
+        memoryBarrierBuffer();
+
+        vec3 left_min, left_max, right_min, right_max;
+        get_child_bounds(lbvh_nodes[first_triangle + node].left_child, left_min, left_max);
+        get_child_bounds(lbvh_nodes[first_triangle + node].right_child, right_min, right_max);
+        lbvh_nodes[first_triangle + node].aabb_min = min(left_min, right_min);
+        lbvh_nodes[first_triangle + node].aabb_max = max(left_max, right_max);
+        memoryBarrierBuffer();
+
+        node = parents[parent_offset + node];
+    }
+}
+
+void main() {
+    stage();
+}
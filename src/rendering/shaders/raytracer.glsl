@@ -1,83 +1,175 @@
 #version 450 core
 
 struct Vertex {
+    // An interpolated vertex (the result of cast_ray)
+    // Vertices are stored as a position stream and an attribute stream instead (see below)
+    vec4 position;
+    vec4 normal;
+    vec2 tex_coord;
+    int mesh_index;
+};
+#define DEFAULT_VERTEX Vertex(vec4(0.0f,0.0f,0.0f,-1.0f), vec4(0.0f), vec2(0.0f), -1)
+
+// When 1, normals are octahedral encoded into 32 bits and texture coordinates are half floats
+// MUST match compressed_vertex_attributes in Vertex.hpp
+#define COMPRESSED_VERTEX_ATTRIBUTES 1
+// When 1, static positions are stored as 16 bit fixed point relative to their mesh's bounds
+// Dynamic positions are always full floats since the LBVH is built from them
+// MUST match quantized_static_positions in Vertex.hpp
+#define QUANTIZED_STATIC_POSITIONS 0
+
+layout (std430, binding=3) buffer StaticPositionBuffer {
+    // Vertex positions are in mesh space; they are never transformed on the GPU
+    // Rays are transformed into mesh space instead
+#if QUANTIZED_STATIC_POSITIONS
+    // x and y are packed into the first uint and z into the low half of the second (see Mesh.position_min)
+    uvec2 static_positions[];
+    //                  // Base Alignment  // Aligned Offset
+    // position[0]         8                  0
+    // position[1]         8                  8
+    // ...
+#else
+    vec4 static_positions[];
+    //                  // Base Alignment  // Aligned Offset
+    // position[0]         16                 0
+    // position[1]         16                 16
+    // position[2]         16                 32
+    // ...
+#endif
+};
+
+layout (std430, binding=4) buffer DynamicPositionBuffer {
+    // Same memory layout as StaticPositionBuffer
+    vec4 dynamic_positions[];
+};
+
+#if COMPRESSED_VERTEX_ATTRIBUTES
+struct StoredVertexAttributes {
+                    // Base Alignment  // Aligned Offset
+    uint normal;    // 4                  0  (two snorm16s, see decode_octahedral)
+    uint tex_coord; // 4                  4  (two half floats)
+
+    // Total Size: 8
+};
+#else
+struct StoredVertexAttributes {
                     // Base Alignment  // Aligned Offset
-    vec4 position;  // 4                  0
-                    // 4                  4
-                    // 4                  8
-                    // 4 (total:16)       12
-
-    vec4 normal;    // 4                  16
-                    // 4                  20
-                    // 4                  24
-                    // 4 (total:16)       28
-   
-    vec2 tex_coord; // 4                  32 
-                    // 4 (total:8)        36
-
-    int mesh_index; // 4                  40
-
-    // (PADDING)    // 4                  44
+    vec4 normal;    // 16                 0
+    vec2 tex_coord; // 8                  16
+    int mesh_index; // 4                  24
+
+    // (PADDING)    // 4                  28
     // (4 bytes of padding to pad out struct to a multiple of the size of a vec4 because it will be used in an array)
 
-    // Total Size: 48
+    // Total Size: 32
 };
-#define DEFAULT_VERTEX Vertex(vec4(0.0f,0.0f,0.0f,-1.0f), vec4(0.0f), vec2(0.0f), -1)
+#endif
 
-layout (std140, binding=0) buffer VertexBuffer {
-    Vertex vertices[];
-    //             // Base Alignment  // Aligned Offset
-    // vertex[0]      48                 0
-    // vertex[1]      48                 48
-    // vertex[2]      48                 96
-    // ...
-    // Maximum of 2,666,666 Vertices (128 MB / 48 B)
+// StoredVertexAttributes after decoding (see get_attributes)
+struct VertexAttributes {
+    vec3 normal;
+    vec2 tex_coord;
 };
 
-layout (std140, binding=3) buffer StaticVertexBuffer {
-    // Same memory layout as VertexBuffer
-    Vertex static_vertices[];
+layout (std430, binding=18) buffer StaticAttributeBuffer {
+    // Everything about a vertex except for its position, only read for the nearest hit
+    // static_attributes[i] belongs to static_positions[i]
+    StoredVertexAttributes static_attributes[];
 };
 
-layout (std140, binding=4) buffer DynamicVertexBuffer {
-    Vertex dynamic_vertices[];
+layout (std430, binding=19) buffer DynamicAttributeBuffer {
+    // Same as StaticAttributeBuffer for dynamic_positions
+    StoredVertexAttributes dynamic_attributes[];
 };
 
 layout (std430, binding=1) buffer StaticIndexBuffer {
     // Memory layout should exactly match that of a C++ int array
+    // Indices are relative to their mesh (see Mesh.base_vertex), so they are uploaded unmodified
+    // Each mesh's triangles are stored in the order of its BVH's leaves
     int static_indices[];
 };
 
 layout (std430, binding=2) buffer DynamicIndexBuffer {
     // Same as StaticIndexBuffer
-    // Indices correspond to vertices[dynamic_indices[i] + nr_static_indices]
+    // Meshes with a gpu_bvh leave their triangles in their original order
     int dynamic_indices[];
 };
 
 struct Mesh {
-                          // Base Alignment  // Aligned Offset
-    mat4 transformation;  // 16              // 0
-                          // 16              // 16
-                          // 16              // 32
-                          // 16 (total: 64)  // 48
-
-    int material_index;   // 4               // 64
-    
-    // (PADDING)          // 12              // 68
-    // (12 bytes of padding to pad out struct to a multiple of a vec4 because it will be used in an array)
-
-    // Total Size: 80
+                                  // Base Alignment  // Aligned Offset
+    mat4 transformation;          // 16              // 0
+                                  // 16              // 16
+                                  // 16              // 32
+                                  // 16 (total: 64)  // 48
+
+    mat4 inverse_transformation;  // 16              // 64
+                                  // 16              // 80
+                                  // 16              // 96
+                                  // 16 (total: 64)  // 112
+
+    int material_index;           // 4               // 128
+    int is_dynamic;               // 4               // 132
+    int first_index;              // 4               // 136
+    int nr_indices;               // 4               // 140
+    int bvh_node_offset;          // 4               // 144
+    int first_triangle;           // 4               // 148
+    int base_vertex;              // 4               // 152
+    int gpu_bvh;                  // 4               // 156
+
+    vec3 position_min;            // 16              // 160
+    vec3 position_extent;         // 16              // 176
+    int flat_normals;             // 4               // 188
+
+    // Total Size: 192
+
+    // If is_dynamic is 0, first_index is an index into static_indices and bvh_node_offset is an
+    // index into static_bvh_nodes. Otherwise, they index into the dynamic buffers
+    // If gpu_bvh is not 0, bvh_node_offset indexes lbvh_nodes instead (only for dynamic meshes)
+    // first_triangle indexes static_triangles or dynamic_triangles
+    // Indices are relative to the mesh's vertices; base_vertex is where they start in the position
+    // and attribute buffers
+    // position_min and position_extent are the mesh space bounds static_positions are quantized to
+    // If flat_normals is not 0, the mesh's vertices have no normals and each triangle is shaded
+    // with its own normal instead (see get_normal)
 };
 
 layout (std140, binding=5) buffer MeshBuffer {
     Mesh meshes[];
     //          // Base Alignment  // Aligned Offset
-    // mesh[0]  // 80              // 0
-    // mesh[1]  // 80              // 80
-    // mesh[3]  // 80              // 160
+    // Only the first nr_meshes are valid
+    // mesh[0]  // 192             // 0
+    // mesh[1]  // 192             // 192
+    // mesh[3]  // 192             // 384
     // ...
 };
 
+// When 1, rays are intersected with the precomputed triangle records using Möller–Trumbore
+// When 0, the triangle's plane is intersected and its barycentric coordinates are calculated from areas
+// Either way, vertex attributes are only read for the nearest hit
+#define USE_TRIANGLE_RECORDS 1
+
+struct TriangleRecord {
+                    // Base Alignment  // Aligned Offset
+    vec4 v0;        // 16              // 0
+    vec4 edge1;     // 16              // 16
+    vec4 edge2;     // 16              // 32
+
+    // edge1 = v1-v0 and edge2 = v2-v0 (in mesh space); w is unused
+
+    // Total Size: 48
+};
+
+layout (std430, binding=14) buffer StaticTriangleBuffer {
+    // One record per triangle in static_indices, in the same order
+    // A mesh's triangles start at its first_triangle
+    TriangleRecord static_triangles[];
+};
+
+layout (std430, binding=15) buffer DynamicTriangleBuffer {
+    // Same as StaticTriangleBuffer for dynamic_indices
+    TriangleRecord dynamic_triangles[];
+};
+
 #define MAX_NR_TEXTURES 3
 // From binding 1 (GL_TEXTURE1) to binding MAX_NR_TEXTURES (GL_TEXTURE1 + MAX_NR_TEXTURES)
 uniform sampler2D textures[MAX_NR_TEXTURES];
@@ -223,63 +315,443 @@ vec4 get_barycentric_coordinates(vec3 point, vec3 tri0, vec3 tri1, vec3 tri2) {
     return vec4(area0, area1, area2, 1);
 }
 
-bool triangle_intersection(Vertex v0, Vertex v1, Vertex v2, vec3 ray_origin, vec3 ray_dir, float offset, inout float depth, inout Vertex vert, inout vec3 barycentric_coordinates) {
-    vec3 normal = cross(vec3(v1.position-v0.position), vec3(v2.position-v0.position));
-    float rpi = ray_plane_int(ray_origin, ray_dir, v0.position.xyz, normalize(normal));
+bool triangle_hit(vec3 p0, vec3 p1, vec3 p2, vec3 ray_origin, vec3 ray_dir, float t_min, float t_max, out float t, out vec3 barycentric_coordinates) {
+    // t_min and t_max are in units of ray_dir (not distances) so they stay the same
+    // when the ray is transformed into mesh space
+    vec3 normal = cross(p1-p0, p2-p0);
+    t = ray_plane_int(ray_origin, ray_dir, p0, normalize(normal));
 
-    // If the ray intersects the triangle
-    float dist = rpi*length(ray_dir);
-    if (dist >= offset && dist <= depth) {
-        vec3 intersection_point = ray_origin + rpi*ray_dir;
-        vec4 bc = get_barycentric_coordinates(intersection_point, v0.position.xyz, v1.position.xyz, v2.position.xyz);
+    // If the ray intersects the triangle's plane
+    if (t >= t_min && t <= t_max) {
+        vec4 bc = get_barycentric_coordinates(ray_origin + t*ray_dir, p0, p1, p2);
+        barycentric_coordinates = bc.xyz;
         // If the point is inside of the triangle
-        if (bc.w > 0.0f) {
-            depth = dist;
-            vert.position = vec4(intersection_point, 1.0f);
-            vert.normal = bc.x*v0.normal + bc.y*v1.normal + bc.z*v2.normal;
-            vert.tex_coord = bc.x*v0.tex_coord + bc.y*v1.tex_coord + bc.z*v2.tex_coord;
-            vert.mesh_index = v0.mesh_index;
-            barycentric_coordinates = bc.xyz;
-            return true;
-        }
+        return bc.w > 0.0f;
     }
     return false;
 }
 
+bool triangle_record_hit(TriangleRecord tri, vec3 ray_origin, vec3 ray_dir, float t_min, float t_max, out float t, out vec3 barycentric_coordinates) {
+    // Möller–Trumbore
+    // The triangle is two-sided so the sign of the determinant doesn't matter
+    vec3 p = cross(ray_dir, tri.edge2.xyz);
+    float det = dot(tri.edge1.xyz, p);
+    if (det == 0.0f) {
+        // The ray is parallel to the triangle
+        return false;
+    }
+    float inv_det = 1.0f / det;
+
+    vec3 s = ray_origin - tri.v0.xyz;
+    float u = dot(s, p) * inv_det;
+    if (u < 0.0f || u > 1.0f) {
+        return false;
+    }
+    vec3 q = cross(s, tri.edge1.xyz);
+    float v = dot(ray_dir, q) * inv_det;
+    if (v < 0.0f || u+v > 1.0f) {
+        return false;
+    }
+
+    t = dot(tri.edge2.xyz, q) * inv_det;
+    barycentric_coordinates = vec3(1.0f-u-v, u, v);
+    return t >= t_min && t <= t_max;
+}
+
+// The nearest triangle found so far by a traversal
+struct Hit {
+    int mesh_index;
+    int triangle;   // Relative to the mesh's first triangle
+    float t;        // In units of ray_dir
+    vec3 barycentric_coordinates;
+};
+#define NO_HIT Hit(-1, -1, 0.0f, vec3(0.0f))
+
+vec3 get_position(int mesh_index, int index) {
+    // Returns the vertex's position (in mesh space) from the buffer the mesh is stored in
+    if (meshes[mesh_index].is_dynamic != 0) {
+        return dynamic_positions[index].xyz;
+    }
+#if QUANTIZED_STATIC_POSITIONS
+    uvec2 quantized = static_positions[index];
+    vec3 position = vec3(unpackUnorm2x16(quantized.x), unpackUnorm2x16(quantized.y).x);
+    return meshes[mesh_index].position_min + position*meshes[mesh_index].position_extent;
+#else
+    return static_positions[index].xyz;
+#endif
+}
+
+vec3 decode_octahedral(uint encoded) {
+    // The unit normal is projected onto the octahedron |x|+|y|+|z| = 1 and
+    // the lower half is folded over the upper half (see encode_octahedral in Vertex.cpp)
+    vec2 e = unpackSnorm2x16(encoded);
+    vec3 normal = vec3(e, 1.0f - abs(e.x) - abs(e.y));
+    float t = max(-normal.z, 0.0f);
+    normal.x += normal.x >= 0.0f ? -t : t;
+    normal.y += normal.y >= 0.0f ? -t : t;
+    return normalize(normal);
+}
+
+VertexAttributes decode_attributes(StoredVertexAttributes stored) {
+#if COMPRESSED_VERTEX_ATTRIBUTES
+    return VertexAttributes(decode_octahedral(stored.normal), unpackHalf2x16(stored.tex_coord));
+#else
+    return VertexAttributes(stored.normal.xyz, stored.tex_coord);
+#endif
+}
+
+VertexAttributes get_attributes(int mesh_index, int index) {
+    // Returns the vertex's attributes (in mesh space) from the buffer the mesh is stored in
+    if (meshes[mesh_index].is_dynamic != 0) {
+        return decode_attributes(dynamic_attributes[index]);
+    }
+    return decode_attributes(static_attributes[index]);
+}
+
+ivec3 get_triangle_indices(int mesh_index, int triangle) {
+    // triangle is relative to the mesh's first triangle
+    // The returned indices include the mesh's base vertex
+    int first = meshes[mesh_index].first_index + triangle*3;
+    int base_vertex = meshes[mesh_index].base_vertex;
+    if (meshes[mesh_index].is_dynamic != 0) {
+        return base_vertex + ivec3(dynamic_indices[first], dynamic_indices[first+1], dynamic_indices[first+2]);
+    }
+    return base_vertex + ivec3(static_indices[first], static_indices[first+1], static_indices[first+2]);
+}
+
+TriangleRecord get_triangle_record(int mesh_index, int triangle) {
+    triangle += meshes[mesh_index].first_triangle;
+    if (meshes[mesh_index].is_dynamic != 0) {
+        return dynamic_triangles[triangle];
+    }
+    return static_triangles[triangle];
+}
+
+vec3 get_normal(int mesh_index, int triangle, vec3 barycentric_coordinates, VertexAttributes v0, VertexAttributes v1, VertexAttributes v2) {
+    // Returns the (unnormalized) mesh space normal at the barycentric coordinates of the triangle
+    if (meshes[mesh_index].flat_normals != 0) {
+        TriangleRecord tri = get_triangle_record(mesh_index, triangle);
+        return cross(tri.edge1.xyz, tri.edge2.xyz);
+    }
+    vec3 bc = barycentric_coordinates;
+    return bc.x*v0.normal + bc.y*v1.normal + bc.z*v2.normal;
+}
+
+bool triangle_test(int mesh_index, int triangle, vec3 ray_origin, vec3 ray_dir, float t_min, float t_max, out float t, out vec3 barycentric_coordinates) {
+    // Only reads what the kernel selected by USE_TRIANGLE_RECORDS needs
+#if USE_TRIANGLE_RECORDS
+    return triangle_record_hit(get_triangle_record(mesh_index, triangle), ray_origin, ray_dir, t_min, t_max, t, barycentric_coordinates);
+#else
+    ivec3 tri_indices = get_triangle_indices(mesh_index, triangle);
+    return triangle_hit(
+        get_position(mesh_index, tri_indices[0]),
+        get_position(mesh_index, tri_indices[1]),
+        get_position(mesh_index, tri_indices[2]),
+        ray_origin, ray_dir, t_min, t_max, t, barycentric_coordinates
+    );
+#endif
+}
+
+void intersect_triangle(int mesh_index, int triangle, vec3 ray_origin, vec3 ray_dir, float t_min, inout float t_max, inout Hit hit) {
+    float t;
+    vec3 barycentric_coordinates;
+    if (triangle_test(mesh_index, triangle, ray_origin, ray_dir, t_min, t_max, t, barycentric_coordinates)) {
+        t_max = t;
+        hit = Hit(mesh_index, triangle, t, barycentric_coordinates);
+    }
+}
+
+bool triangle_occludes(int mesh_index, int triangle, vec3 ray_origin, vec3 ray_dir, float t_min, float t_max) {
+    float t;
+    vec3 barycentric_coordinates;
+    return triangle_test(mesh_index, triangle, ray_origin, ray_dir, t_min, t_max, t, barycentric_coordinates);
+}
+
+// BVH Traversal
+// There are two levels: a top level BVH (TLAS) in world space over the meshes' bounds and
+// a bottom level BVH per mesh in mesh space over the mesh's triangles
+
+struct BVHNode {
+                        // Base Alignment  // Aligned Offset
+    vec3 aabb_min;      // 16              // 0
+    int left_first;     // 4               // 12
+    vec3 aabb_max;      // 16              // 16
+    int nr_primitives;  // 4               // 28
+
+    // Interior nodes have nr_primitives == 0 and their children are at left_first and left_first+1
+    // Leaf nodes contain primitives left_first to left_first+nr_primitives-1
+
+    // Total Size: 32
+};
+
+layout (std430, binding=8) buffer StaticBVHNodeBuffer {
+    // The bottom level BVHs of every static mesh one after another
+    // Node indices are relative to the mesh's bvh_node_offset
+    // Leaf primitives are triangles relative to the mesh's first triangle
+    BVHNode static_bvh_nodes[];
+};
+
+layout (std430, binding=9) buffer DynamicBVHNodeBuffer {
+    // Same as StaticBVHNodeBuffer for dynamic meshes
+    BVHNode dynamic_bvh_nodes[];
+};
+
+layout (std430, binding=10) buffer TLASNodeBuffer {
+    // The root is tlas_nodes[0]
+    BVHNode tlas_nodes[];
+};
+
+layout (std430, binding=11) buffer TLASPrimitiveBuffer {
+    // Leaf primitives of the TLAS index this to get the mesh index
+    int tlas_primitives[];
+};
+
+struct LBVHNode {
+    // Same as LBVHNode in lbvh.glsl
+    vec3 aabb_min;
+    int left_child;
+    vec3 aabb_max;
+    int right_child;
+
+    // Children >= 0 are internal nodes
+    // Children < 0 are leaves: ~child is the leaf's triangle
+};
+
+layout (std430, binding=12) buffer LBVHNodeBuffer {
+    // The BVHs built on the GPU for dynamic meshes (see lbvh.glsl)
+    // A mesh's root is lbvh_nodes[bvh_node_offset]
+    LBVHNode lbvh_nodes[];
+};
+
+// When false every ray is tested against every triangle (for comparison)
+uniform bool use_bvh = true;
+// The mesh buffer only ever grows so it can have more elements than there are meshes
+uniform int nr_meshes = 0;
+
+// Must match bvh_stack_size and tlas_stack_size in BVH.hpp, which limit how deep the hierarchies are built
+#define BVH_STACK_SIZE 64
+#define TLAS_STACK_SIZE 32
+
+float ray_aabb_intersection(vec3 ray_origin, vec3 inv_ray_dir, vec3 aabb_min, vec3 aabb_max) {
+    /*
+    Slab test
+    Returns t (in units of ray_dir) where the ray enters the box or 0 if the ray starts in the box
+    Negative output means no intersection
+    */
+    vec3 t0 = (aabb_min - ray_origin) * inv_ray_dir;
+    vec3 t1 = (aabb_max - ray_origin) * inv_ray_dir;
+    vec3 t_small = min(t0, t1);
+    vec3 t_big = max(t0, t1);
+
+    float t_near = max(max(t_small.x, t_small.y), t_small.z);
+    float t_far = min(min(t_big.x, t_big.y), t_big.z);
+
+    if (t_near > t_far || t_far < 0.0f) {
+        return -1.0f;
+    }
+    return max(t_near, 0.0f);
+}
+
+BVHNode get_bvh_node(int mesh_index, int node) {
+    node += meshes[mesh_index].bvh_node_offset;
+    if (meshes[mesh_index].is_dynamic != 0) {
+        return dynamic_bvh_nodes[node];
+    }
+    return static_bvh_nodes[node];
+}
+
+void intersect_lbvh(int mesh_index, vec3 ray_origin, vec3 ray_dir, float t_min, inout float t_max, inout Hit hit) {
+    // Traverse a dynamic mesh's BVH built on the GPU (already in mesh space)
+    int nr_triangles = meshes[mesh_index].nr_indices/3;
+    int node_offset = meshes[mesh_index].bvh_node_offset;
+    if (nr_triangles < 2) {
+        // Meshes with less than two triangles have no hierarchy
+        if (nr_triangles == 1) {
+            intersect_triangle(mesh_index, 0, ray_origin, ray_dir, t_min, t_max, hit);
+        }
+        return;
+    }
+
+    vec3 inv_ray_dir = 1.0f / ray_dir;
+
+    int stack[BVH_STACK_SIZE];
+    int stack_size = 0;
+
+    LBVHNode root = lbvh_nodes[node_offset];
+    float root_t = ray_aabb_intersection(ray_origin, inv_ray_dir, root.aabb_min, root.aabb_max);
+    if (root_t >= 0.0f && root_t <= t_max) {
+        stack[stack_size++] = 0;
+    }
+
+    while (stack_size > 0) {
+        LBVHNode node = lbvh_nodes[node_offset + stack[--stack_size]];
+
+        // Leaves hold a single triangle so they are intersected straight away
+        // rather than testing their bounds first
+        int children[2] = int[2](node.left_child, node.right_child);
+        float children_t[2] = float[2](-1.0f, -1.0f);
+        for (int i=0; i<2; i++) {
+            if (children[i] < 0) {
+                intersect_triangle(mesh_index, ~children[i], ray_origin, ray_dir, t_min, t_max, hit);
+            } else {
+                LBVHNode child = lbvh_nodes[node_offset + children[i]];
+                children_t[i] = ray_aabb_intersection(ray_origin, inv_ray_dir, child.aabb_min, child.aabb_max);
+            }
+        }
+
+        int near = children_t[1] >= 0.0f && (children_t[0] < 0.0f || children_t[1] < children_t[0]) ? 1 : 0;
+        int far = 1 - near;
+        if (children_t[far] >= 0.0f && children_t[far] <= t_max && stack_size < BVH_STACK_SIZE) {
+            stack[stack_size++] = children[far];
+        }
+        if (children_t[near] >= 0.0f && children_t[near] <= t_max && stack_size < BVH_STACK_SIZE) {
+            stack[stack_size++] = children[near];
+        }
+    }
+}
+
+void intersect_mesh(int mesh_index, vec3 world_ray_origin, vec3 world_ray_dir, float t_min, inout float t_max, inout Hit hit) {
+    // Traverse the mesh's BVH in mesh space
+    // t is unchanged by the transformation so t_min and t_max can be shared with world space
+    mat4 inverse_transformation = meshes[mesh_index].inverse_transformation;
+    vec3 ray_origin = (inverse_transformation * vec4(world_ray_origin, 1.0f)).xyz;
+    vec3 ray_dir = mat3(inverse_transformation) * world_ray_dir;
+
+    if (!use_bvh) {
+        for (int i=0; i<meshes[mesh_index].nr_indices/3; i++) {
+            intersect_triangle(mesh_index, i, ray_origin, ray_dir, t_min, t_max, hit);
+        }
+        return;
+    }
+
+    if (meshes[mesh_index].gpu_bvh != 0) {
+        intersect_lbvh(mesh_index, ray_origin, ray_dir, t_min, t_max, hit);
+        return;
+    }
+
+    vec3 inv_ray_dir = 1.0f / ray_dir;
+
+    int stack[BVH_STACK_SIZE];
+    int stack_size = 0;
+
+    BVHNode root = get_bvh_node(mesh_index, 0);
+    float root_t = ray_aabb_intersection(ray_origin, inv_ray_dir, root.aabb_min, root.aabb_max);
+    if (root_t >= 0.0f && root_t <= t_max) {
+        stack[stack_size++] = 0;
+    }
+
+    while (stack_size > 0) {
+        BVHNode node = get_bvh_node(mesh_index, stack[--stack_size]);
+
+        if (node.nr_primitives > 0) {
+            for (int i=0; i<node.nr_primitives; i++) {
+                intersect_triangle(mesh_index, node.left_first+i, ray_origin, ray_dir, t_min, t_max, hit);
+            }
+            continue;
+        }
+
+        int near_child = node.left_first;
+        int far_child = node.left_first+1;
+        BVHNode near_node = get_bvh_node(mesh_index, near_child);
+        BVHNode far_node = get_bvh_node(mesh_index, far_child);
+        float near_t = ray_aabb_intersection(ray_origin, inv_ray_dir, near_node.aabb_min, near_node.aabb_max);
+        float far_t = ray_aabb_intersection(ray_origin, inv_ray_dir, far_node.aabb_min, far_node.aabb_max);
+        if (near_t < 0.0f || (far_t >= 0.0f && far_t < near_t)) {
+            int tmp_child = near_child;
+            near_child = far_child;
+            far_child = tmp_child;
+            float tmp_t = near_t;
+            near_t = far_t;
+            far_t = tmp_t;
+        }
+
+        // Push the far child first so the near child is visited first and can shrink t_max
+        if (far_t >= 0.0f && far_t <= t_max && stack_size < BVH_STACK_SIZE) {
+            stack[stack_size++] = far_child;
+        }
+        if (near_t >= 0.0f && near_t <= t_max && stack_size < BVH_STACK_SIZE) {
+            stack[stack_size++] = near_child;
+        }
+    }
+}
+
 Vertex cast_ray(vec3 ray_origin, vec3 ray_dir, float offset, float max_dist, out ivec3 indices, out vec3 barycentric_coordinates) {
     /*
-    Returns an interpolated vertex from the intersection between the ray and the
-    nearest triangle it collides with
+    Returns an interpolated vertex (in world space) from the intersection between the ray
+    and the nearest triangle it collides with
+
+    indices are the indices of the triangle in the mesh's vertex buffer (static or dynamic)
 
     If there is no triangle, the mesh_index will be -1
     */
-    float depth = max_dist;
-    Vertex vert = DEFAULT_VERTEX;
-    for (int i=0; i<static_indices.length()/3; i++) {
-        Vertex v0 = vertices[static_indices[i*3]];
-        Vertex v1 = vertices[static_indices[i*3+1]];
-        Vertex v2 = vertices[static_indices[i*3+2]];
-
-        if (triangle_intersection(v0, v1, v2, ray_origin, ray_dir, offset, depth, vert, barycentric_coordinates)) {
-            indices = ivec3(
-                static_indices[i*3],
-                static_indices[i*3+1],
-                static_indices[i*3+2]
-            );
+    float ray_length = length(ray_dir);
+    float t_min = offset / ray_length;
+    float t_max = max_dist / ray_length;
+    Hit hit = NO_HIT;
+
+    if (!use_bvh) {
+        for (int i=0; i<nr_meshes; i++) {
+            intersect_mesh(i, ray_origin, ray_dir, t_min, t_max, hit);
         }
-    }
-    for (int i=0; i<dynamic_indices.length()/3; i++) {
-        Vertex v0 = vertices[dynamic_indices[i*3]   + static_vertices.length()];
-        Vertex v1 = vertices[dynamic_indices[i*3+1] + static_vertices.length()];
-        Vertex v2 = vertices[dynamic_indices[i*3+2] + static_vertices.length()];
-
-        if (triangle_intersection(v0, v1, v2, ray_origin, ray_dir, offset, depth, vert, barycentric_coordinates)) {
-            indices = ivec3(
-                dynamic_indices[i*3]+static_vertices.length(),
-                dynamic_indices[i*3+1]+static_vertices.length(),
-                dynamic_indices[i*3+2]+static_vertices.length()
-            );
+    } else {
+        vec3 inv_ray_dir = 1.0f / ray_dir;
+
+        int stack[TLAS_STACK_SIZE];
+        int stack_size = 0;
+
+        float root_t = ray_aabb_intersection(ray_origin, inv_ray_dir, tlas_nodes[0].aabb_min, tlas_nodes[0].aabb_max);
+        if (root_t >= 0.0f && root_t <= t_max) {
+            stack[stack_size++] = 0;
         }
+
+        while (stack_size > 0) {
+            BVHNode node = tlas_nodes[stack[--stack_size]];
+
+            if (node.nr_primitives > 0) {
+                for (int i=0; i<node.nr_primitives; i++) {
+                    intersect_mesh(tlas_primitives[node.left_first+i], ray_origin, ray_dir, t_min, t_max, hit);
+                }
+                continue;
+            }
+
+            int near_child = node.left_first;
+            int far_child = node.left_first+1;
+            float near_t = ray_aabb_intersection(ray_origin, inv_ray_dir, tlas_nodes[near_child].aabb_min, tlas_nodes[near_child].aabb_max);
+            float far_t = ray_aabb_intersection(ray_origin, inv_ray_dir, tlas_nodes[far_child].aabb_min, tlas_nodes[far_child].aabb_max);
+            if (near_t < 0.0f || (far_t >= 0.0f && far_t < near_t)) {
+                int tmp_child = near_child;
+                near_child = far_child;
+                far_child = tmp_child;
+                float tmp_t = near_t;
+                near_t = far_t;
+                far_t = tmp_t;
+            }
+
+            if (far_t >= 0.0f && far_t <= t_max && stack_size < TLAS_STACK_SIZE) {
+                stack[stack_size++] = far_child;
+            }
+            if (near_t >= 0.0f && near_t <= t_max && stack_size < TLAS_STACK_SIZE) {
+                stack[stack_size++] = near_child;
+            }
+        }
+    }
+
+    Vertex vert = DEFAULT_VERTEX;
+    if (hit.mesh_index != -1) {
+        // Only the nearest hit's vertex attributes are ever read
+        indices = get_triangle_indices(hit.mesh_index, hit.triangle);
+        barycentric_coordinates = hit.barycentric_coordinates;
+        VertexAttributes v0 = get_attributes(hit.mesh_index, indices[0]);
+        VertexAttributes v1 = get_attributes(hit.mesh_index, indices[1]);
+        VertexAttributes v2 = get_attributes(hit.mesh_index, indices[2]);
+        vec3 bc = barycentric_coordinates;
+
+        // t is the same in mesh and world space
+        vert.position = vec4(ray_origin + hit.t*ray_dir, 1.0f);
+        vec3 normal = get_normal(hit.mesh_index, hit.triangle, bc, v0, v1, v2);
+        vert.normal = vec4(transpose(mat3(meshes[hit.mesh_index].inverse_transformation)) * normal, 1.0f);
+        vert.tex_coord = bc.x*v0.tex_coord + bc.y*v1.tex_coord + bc.z*v2.tex_coord;
+        vert.mesh_index = hit.mesh_index;
     }
     return vert;
 }
@@ -290,6 +762,137 @@ Vertex cast_ray(vec3 ray_origin, vec3 ray_dir, float offset, float max_dist) {
     return cast_ray(ray_origin, ray_dir, offset, max_dist, indices, barycentric_coordinates);
 }
 
+// Any-hit versions of the traversals above for shadow rays
+// These return as soon as anything is hit and never interpolate vertex attributes
+// Children are visited in whatever order since the nearest hit doesn't matter
+
+bool lbvh_occluded(int mesh_index, vec3 ray_origin, vec3 ray_dir, float t_min, float t_max) {
+    int nr_triangles = meshes[mesh_index].nr_indices/3;
+    int node_offset = meshes[mesh_index].bvh_node_offset;
+    if (nr_triangles < 2) {
+        return nr_triangles == 1 && triangle_occludes(mesh_index, 0, ray_origin, ray_dir, t_min, t_max);
+    }
+
+    vec3 inv_ray_dir = 1.0f / ray_dir;
+
+    int stack[BVH_STACK_SIZE];
+    int stack_size = 0;
+
+    LBVHNode root = lbvh_nodes[node_offset];
+    float root_t = ray_aabb_intersection(ray_origin, inv_ray_dir, root.aabb_min, root.aabb_max);
+    if (root_t >= 0.0f && root_t <= t_max) {
+        stack[stack_size++] = 0;
+    }
+
+    while (stack_size > 0) {
+        LBVHNode node = lbvh_nodes[node_offset + stack[--stack_size]];
+        int children[2] = int[2](node.left_child, node.right_child);
+        for (int i=0; i<2; i++) {
+            if (children[i] < 0) {
+                if (triangle_occludes(mesh_index, ~children[i], ray_origin, ray_dir, t_min, t_max)) {
+                    return true;
+                }
+                continue;
+            }
+            LBVHNode child = lbvh_nodes[node_offset + children[i]];
+            float child_t = ray_aabb_intersection(ray_origin, inv_ray_dir, child.aabb_min, child.aabb_max);
+            if (child_t >= 0.0f && child_t <= t_max && stack_size < BVH_STACK_SIZE) {
+                stack[stack_size++] = children[i];
+            }
+        }
+    }
+    return false;
+}
+
+bool mesh_occluded(int mesh_index, vec3 world_ray_origin, vec3 world_ray_dir, float t_min, float t_max) {
+    mat4 inverse_transformation = meshes[mesh_index].inverse_transformation;
+    vec3 ray_origin = (inverse_transformation * vec4(world_ray_origin, 1.0f)).xyz;
+    vec3 ray_dir = mat3(inverse_transformation) * world_ray_dir;
+
+    if (!use_bvh) {
+        for (int i=0; i<meshes[mesh_index].nr_indices/3; i++) {
+            if (triangle_occludes(mesh_index, i, ray_origin, ray_dir, t_min, t_max)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    if (meshes[mesh_index].gpu_bvh != 0) {
+        return lbvh_occluded(mesh_index, ray_origin, ray_dir, t_min, t_max);
+    }
+
+    vec3 inv_ray_dir = 1.0f / ray_dir;
+
+    int stack[BVH_STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size > 0) {
+        BVHNode node = get_bvh_node(mesh_index, stack[--stack_size]);
+        float node_t = ray_aabb_intersection(ray_origin, inv_ray_dir, node.aabb_min, node.aabb_max);
+        if (node_t < 0.0f || node_t > t_max) {
+            continue;
+        }
+
+        if (node.nr_primitives > 0) {
+            for (int i=0; i<node.nr_primitives; i++) {
+                if (triangle_occludes(mesh_index, node.left_first+i, ray_origin, ray_dir, t_min, t_max)) {
+                    return true;
+                }
+            }
+        } else if (stack_size+2 <= BVH_STACK_SIZE) {
+            stack[stack_size++] = node.left_first+1;
+            stack[stack_size++] = node.left_first;
+        }
+    }
+    return false;
+}
+
+bool occluded(vec3 ray_origin, vec3 ray_dir, float offset, float max_dist) {
+    /*
+    Returns true if the ray hits any triangle between offset and max_dist
+    */
+    float ray_length = length(ray_dir);
+    float t_min = offset / ray_length;
+    float t_max = max_dist / ray_length;
+
+    if (!use_bvh) {
+        for (int i=0; i<nr_meshes; i++) {
+            if (mesh_occluded(i, ray_origin, ray_dir, t_min, t_max)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    vec3 inv_ray_dir = 1.0f / ray_dir;
+
+    int stack[TLAS_STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size > 0) {
+        BVHNode node = tlas_nodes[stack[--stack_size]];
+        float node_t = ray_aabb_intersection(ray_origin, inv_ray_dir, node.aabb_min, node.aabb_max);
+        if (node_t < 0.0f || node_t > t_max) {
+            continue;
+        }
+
+        if (node.nr_primitives > 0) {
+            for (int i=0; i<node.nr_primitives; i++) {
+                if (mesh_occluded(tlas_primitives[node.left_first+i], ray_origin, ray_dir, t_min, t_max)) {
+                    return true;
+                }
+            }
+        } else if (stack_size+2 <= TLAS_STACK_SIZE) {
+            stack[stack_size++] = node.left_first+1;
+            stack[stack_size++] = node.left_first;
+        }
+    }
+    return false;
+}
+
 
 // PBR Shading
 
@@ -354,7 +957,7 @@ uniform Light sunlight = Light(normalize(vec3(-0.2f, 1.0f, 0.2f)), vec3(3.0f), 0
 
 vec3 calculate_light(vec3 position, vec3 normal, vec3 ray_dir, MaterialData material, Light light) {
     #if SHADOWS
-        if (cast_ray(position, light.direction, BIAS, FAR_PLANE).mesh_index != -1) {
+        if (occluded(position, light.direction, BIAS, FAR_PLANE)) {
             return material.albedo.rgb * material.AO * light.ambient_multiplier;
         }
     #endif
@@ -459,23 +1062,29 @@ mat3 rotate_a_to_b(vec3 a, vec3 b) {
 subroutine(Trace)
 void offline_trace(vec3 ray_origin, vec3 ray_dir, ivec2 pix, ivec2 size) {
     vec4 col = imageLoad(framebuffer, pix);
-    ivec3 inds = imageLoad(per_pixel_indices, pix).xyz;
-    vec3 bc = imageLoad(scene_barycentric_coordinates, pix).xyz;
-    Vertex v0 = vertices[inds[0]];
-    Vertex v1 = vertices[inds[1]];
-    Vertex v2 = vertices[inds[2]];
-    vec4 pos = bc.x*v0.position + bc.y*v1.position + bc.z*v2.position;
-    vec4 norm = bc.x*v0.normal + bc.y*v1.normal + bc.z*v2.normal;
-    vec2 tex_coord = bc.x*v0.tex_coord + bc.y*v1.tex_coord + bc.z*v2.tex_coord;
-    vec3 normal = norm.xyz;
-    normal = normalize(vec3(normal)) * sign(dot(vec3(normal), -ray_dir));
-
     int mesh_index = mesh_indices[pix.x+pix.y*size.x];
 
     if (mesh_index == -1) {
         imageStore(framebuffer, pix, vec4(col.xyz, 1.0f));
         return;
     }
+
+    ivec3 inds = imageLoad(per_pixel_indices, pix).xyz;
+    vec3 bc = imageLoad(scene_barycentric_coordinates, pix).xyz;
+    VertexAttributes v0 = get_attributes(mesh_index, inds[0]);
+    VertexAttributes v1 = get_attributes(mesh_index, inds[1]);
+    VertexAttributes v2 = get_attributes(mesh_index, inds[2]);
+    vec3 p0 = get_position(mesh_index, inds[0]);
+    vec3 p1 = get_position(mesh_index, inds[1]);
+    vec3 p2 = get_position(mesh_index, inds[2]);
+    vec3 pos = bc.x*p0 + bc.y*p1 + bc.z*p2;
+    // Only the indices of the triangle are stored per pixel, not which triangle it is
+    vec3 norm = meshes[mesh_index].flat_normals != 0 ? cross(p1-p0, p2-p0) : bc.x*v0.normal + bc.y*v1.normal + bc.z*v2.normal;
+    vec2 tex_coord = bc.x*v0.tex_coord + bc.y*v1.tex_coord + bc.z*v2.tex_coord;
+    // The vertices are in mesh space
+    pos = (meshes[mesh_index].transformation * vec4(pos, 1.0f)).xyz;
+    vec3 normal = transpose(mat3(meshes[mesh_index].inverse_transformation)) * norm;
+    normal = normalize(vec3(normal)) * sign(dot(vec3(normal), -ray_dir));
     
     Material material = materials[meshes[mesh_index].material_index];
     MaterialData material_data = get_material_data(material, meshes[mesh_index].material_index, tex_coord);
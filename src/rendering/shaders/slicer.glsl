@@ -0,0 +1,305 @@
+#version 450 core
+
+/*
+Slices the tetrahedra of a 4D mesh with a hyperplane straight into the
+dynamic vertex and index buffers, one mesh at a time
+The vertices are first rotated into slice space (Hyperplane4D::get_slice_space), where the
+hyperplane is w = slice and the cross section's x, y and z are the vertices' x, y and z
+
+Stages (in order, with a memory barrier between each):
+    rotate_vertices     One thread per vertex
+    intersect_edges     One thread per edge
+    count_triangles     One thread per tetrahedron
+    (the CPU reads the counts back and allocates the dynamic buffers)
+    write_triangles     One thread per tetrahedron
+
+The slice is the same as DimensionDropper::SliceMode::EdgeTable: every edge is intersected
+once and each tetrahedron's cross section is triangulated with a case table, so the
+triangles are the same (only their order differs since they are allocated with atomics)
+*/
+
+// When 1, normals are octahedral encoded into 32 bits and texture coordinates are half floats
+// MUST match COMPRESSED_VERTEX_ATTRIBUTES in raytracer.glsl
+#define COMPRESSED_VERTEX_ATTRIBUTES 1
+
+// This MUST match slicer_block_size in GPUDimensionDropper.hpp
+#define SLICER_BLOCK_SIZE 128
+
+layout (local_size_x = SLICER_BLOCK_SIZE, local_size_y = 1, local_size_z = 1) in;
+
+layout (std430, binding=4) buffer DynamicPositionBuffer {
+    // Same as DynamicPositionBuffer in raytracer.glsl
+    vec4 dynamic_positions[];
+};
+
+#if COMPRESSED_VERTEX_ATTRIBUTES
+struct StoredVertexAttributes {
+                    // Base Alignment  // Aligned Offset
+    uint normal;    // 4                  0  (two snorm16s, see encode_octahedral)
+    uint tex_coord; // 4                  4  (two half floats)
+
+    // Total Size: 8
+};
+#else
+struct StoredVertexAttributes {
+                    // Base Alignment  // Aligned Offset
+    vec4 normal;    // 16                 0
+    vec2 tex_coord; // 8                  16
+    int mesh_index; // 4                  24
+    // (PADDING)    // 4                  28
+
+    // Total Size: 32
+};
+#endif
+
+layout (std430, binding=19) buffer DynamicAttributeBuffer {
+    // Same as DynamicAttributeBuffer in raytracer.glsl
+    StoredVertexAttributes dynamic_attributes[];
+};
+
+layout (std430, binding=2) buffer DynamicIndexBuffer {
+    // Same as DynamicIndexBuffer in raytracer.glsl
+    int dynamic_indices[];
+};
+
+struct TriangleRecord {
+    // Same as TriangleRecord in raytracer.glsl
+    vec4 v0;
+    vec4 edge1;
+    vec4 edge2;
+};
+
+layout (std430, binding=15) buffer DynamicTriangleBuffer {
+    TriangleRecord dynamic_triangles[];
+};
+
+// The 4D meshes, uploaded once (see GPUDimensionDropper)
+// Everything is relative to the mesh's first vertex, edge and tetrahedron
+
+layout (std430, binding=25) buffer SliceVertexBuffer {
+    // The loaded (unrotated) positions
+    vec4 vertices4d[];
+};
+
+layout (std430, binding=26) buffer SliceEdgeBuffer {
+    // The vertices of every unique edge (see DimensionDropper::Topology)
+    uvec2 edges[];
+};
+
+layout (std430, binding=27) buffer SliceTetrahedronBuffer {
+    // The vertices of every tetrahedron
+    uvec4 tetrahedra[];
+};
+
+layout (std430, binding=28) buffer SliceTetrahedronEdgeBuffer {
+    // The 6 edges of every tetrahedron, in the order of DimensionDropper::Topology::tetrahedron_edges
+    uint tetrahedron_edges[];
+};
+
+// Scratch buffers that share the ranges of the buffers above
+
+layout (std430, binding=29) buffer SliceCrossingBuffer {
+    // Where each edge crosses the slice, only written for the edges that do
+    vec4 crossings[];
+};
+
+layout (std430, binding=30) buffer SliceRotatedVertexBuffer {
+    // vertices4d in slice space
+    vec4 rotated_vertices[];
+};
+
+layout (std430, binding=31) buffer SliceCounterBuffer {
+    // Two per mesh sliced this frame (at 2*counter_index):
+    // The number of triangles count_triangles found, which is what is read back
+    // The number of triangles write_triangles has allocated so far
+    uint counters[];
+};
+
+uniform mat4 slice_space;
+uniform float slice;
+
+uniform int first_vertex;
+uniform int first_edge;
+uniform int first_tetrahedron;
+// The number of vertices, edges or tetrahedra depending on the stage
+uniform int nr_items;
+uniform int counter_index;
+
+// Where the mesh's triangles go in the dynamic buffers
+uniform int first_triangle;
+uniform int first_index;
+uniform int base_vertex;
+// The number of triangles count_triangles found, write_triangles never writes more than this
+uniform int nr_triangles;
+
+// The edges (of tetrahedron_edges) the vertices of each case's triangles are on, 4 bits each starting at the lowest
+// Unused triangles are 0xFFF
+// MUST match slice_cases in DimensionDropper.cpp
+const uint slice_case_nr_triangles[16] = uint[16](0, 1, 1, 2, 1, 2, 2, 1, 1, 2, 2, 1, 2, 1, 1, 0);
+const uvec2 slice_case_triangles[16] = uvec2[16](
+    uvec2(0xFFF, 0xFFF),    // 0000
+    uvec2(0x210, 0xFFF),    // 0001 vertex 0
+    uvec2(0x430, 0xFFF),    // 0010 vertex 1
+    uvec2(0x421, 0x341),    // 0011 vertices 0 and 1
+    uvec2(0x531, 0xFFF),    // 0100 vertex 2
+    uvec2(0x520, 0x350),    // 0101 vertices 0 and 2
+    uvec2(0x510, 0x450),    // 0110 vertices 1 and 2
+    uvec2(0x542, 0xFFF),    // 0111 vertex 3
+    uvec2(0x542, 0xFFF),    // 1000 vertex 3
+    uvec2(0x510, 0x450),    // 1001 vertices 0 and 3
+    uvec2(0x520, 0x350),    // 1010 vertices 1 and 3
+    uvec2(0x531, 0xFFF),    // 1011 vertex 2
+    uvec2(0x421, 0x341),    // 1100 vertices 2 and 3
+    uvec2(0x430, 0xFFF),    // 1101 vertex 1
+    uvec2(0x210, 0xFFF),    // 1110 vertex 0
+    uvec2(0xFFF, 0xFFF)     // 1111
+);
+
+// MUST be the same test as above_slice in DimensionDropper.cpp
+bool above_slice(vec4 position) {
+    return position.w - slice > 0.0f;
+}
+
+uint get_slice_case(uint tetrahedron) {
+    uvec4 vertices = tetrahedra[first_tetrahedron + tetrahedron];
+    uint slice_case = 0;
+    for (int i=0; i<4; i++) {
+        if (above_slice(rotated_vertices[first_vertex + vertices[i]]))
+            slice_case |= 1u << i;
+    }
+    return slice_case;
+}
+
+// The corners of one of the triangles of a tetrahedron's cross section
+void get_triangle(uint tetrahedron, uint edges, out vec3 p0, out vec3 p1, out vec3 p2) {
+    uint first = 6*(first_tetrahedron + tetrahedron);
+    p0 = crossings[first_edge + tetrahedron_edges[first + ( edges       & 0xFu)]].xyz;
+    p1 = crossings[first_edge + tetrahedron_edges[first + ((edges >> 4) & 0xFu)]].xyz;
+    p2 = crossings[first_edge + tetrahedron_edges[first + ((edges >> 8) & 0xFu)]].xyz;
+}
+
+// A slice going exactly through a vertex makes several edges cross at the same point,
+// which can leave triangles without any area
+// The same triangles are skipped by DimensionDropper
+bool has_area(vec3 p0, vec3 p1, vec3 p2) {
+    return cross(p1 - p0, p2 - p0) != vec3(0.0f);
+}
+
+// Must be the same as encode_octahedral in Vertex.cpp
+uint encode_octahedral(vec3 normal) {
+    float l1_norm = abs(normal.x) + abs(normal.y) + abs(normal.z);
+    if (l1_norm == 0.0f)
+        return packSnorm2x16(vec2(0.0f));
+
+    vec2 encoded = normal.xy / l1_norm;
+    if (normal.z < 0.0f) {
+        vec2 signs = vec2(encoded.x >= 0.0f ? 1.0f : -1.0f, encoded.y >= 0.0f ? 1.0f : -1.0f);
+        encoded = (1.0f - abs(encoded.yx)) * signs;
+    }
+    return packSnorm2x16(encoded);
+}
+
+void write_vertex(int vertex, vec3 position, vec3 normal) {
+    dynamic_positions[base_vertex + vertex] = vec4(position, 0.0f);
+#if COMPRESSED_VERTEX_ATTRIBUTES
+    dynamic_attributes[base_vertex + vertex] = StoredVertexAttributes(encode_octahedral(normal), packHalf2x16(vec2(0.0f)));
+#else
+    dynamic_attributes[base_vertex + vertex] = StoredVertexAttributes(vec4(normal, 0.0f), vec2(0.0f), 0);
+#endif
+}
+
+subroutine void SlicerStage();
+subroutine uniform SlicerStage stage;
+
+subroutine(SlicerStage) void rotate_vertices() {
+    int i = int(gl_GlobalInvocationID.x);
+    if (i >= nr_items)
+        return;
+
+    rotated_vertices[first_vertex + i] = slice_space * vertices4d[first_vertex + i];
+}
+
+subroutine(SlicerStage) void intersect_edges() {
+    int i = int(gl_GlobalInvocationID.x);
+    if (i >= nr_items)
+        return;
+
+    uvec2 edge = edges[first_edge + i];
+    vec4 a = rotated_vertices[first_vertex + edge.x];
+    vec4 b = rotated_vertices[first_vertex + edge.y];
+    if (above_slice(a) == above_slice(b))
+        return;
+
+    a.w -= slice;
+    b.w -= slice;
+    float t = a.w / (a.w - b.w);
+    crossings[first_edge + i] = mix(a, b, t);
+}
+
+subroutine(SlicerStage) void count_triangles() {
+    int i = int(gl_GlobalInvocationID.x);
+    if (i >= nr_items)
+        return;
+
+    uint slice_case = get_slice_case(uint(i));
+    uint nr_case_triangles = slice_case_nr_triangles[slice_case];
+    uint nr_tetrahedron_triangles = 0;
+    for (uint j=0; j<nr_case_triangles; j++) {
+        vec3 p0, p1, p2;
+        get_triangle(uint(i), slice_case_triangles[slice_case][j], p0, p1, p2);
+        if (has_area(p0, p1, p2))
+            nr_tetrahedron_triangles++;
+    }
+    if (nr_tetrahedron_triangles > 0)
+        atomicAdd(counters[2*counter_index], nr_tetrahedron_triangles);
+}
+
+subroutine(SlicerStage) void write_triangles() {
+    int i = int(gl_GlobalInvocationID.x);
+    if (i >= nr_items)
+        return;
+
+    uint slice_case = get_slice_case(uint(i));
+    uint nr_case_triangles = slice_case_nr_triangles[slice_case];
+    vec3 triangles[2][3];
+    uint nr_tetrahedron_triangles = 0;
+    for (uint j=0; j<nr_case_triangles; j++) {
+        vec3 p0, p1, p2;
+        get_triangle(uint(i), slice_case_triangles[slice_case][j], p0, p1, p2);
+        if (!has_area(p0, p1, p2))
+            continue;
+        triangles[nr_tetrahedron_triangles][0] = p0;
+        triangles[nr_tetrahedron_triangles][1] = p1;
+        triangles[nr_tetrahedron_triangles][2] = p2;
+        nr_tetrahedron_triangles++;
+    }
+    if (nr_tetrahedron_triangles == 0)
+        return;
+
+    // Every triangle gets its own three vertices so it can have a flat normal, like the
+    // meshes DimensionDropper returns
+    uint first = atomicAdd(counters[2*counter_index + 1], nr_tetrahedron_triangles);
+    for (uint j=0; j<nr_tetrahedron_triangles; j++) {
+        int triangle = int(first + j);
+        if (triangle >= nr_triangles)
+            return;
+
+        vec3 p0 = triangles[j][0];
+        vec3 p1 = triangles[j][1];
+        vec3 p2 = triangles[j][2];
+        vec3 normal = normalize(cross(p0 - p1, p0 - p2));
+        write_vertex(3*triangle,     p0, normal);
+        write_vertex(3*triangle + 1, p1, normal);
+        write_vertex(3*triangle + 2, p2, normal);
+
+        dynamic_indices[first_index + 3*triangle]     = 3*triangle;
+        dynamic_indices[first_index + 3*triangle + 1] = 3*triangle + 1;
+        dynamic_indices[first_index + 3*triangle + 2] = 3*triangle + 2;
+
+        dynamic_triangles[first_triangle + triangle] = TriangleRecord(vec4(p0, 0.0f), vec4(p1 - p0, 0.0f), vec4(p2 - p0, 0.0f));
+    }
+}
+
+void main() {
+    stage();
+}